@@ -1,10 +1,17 @@
 #include <jsi/jsi.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include <android/log.h>
 #include <fbjni/fbjni.h>
 #include <jni.h>
 
 #include "onig_regex.h"
+#include "onig_pattern_bundle.hpp"
+#include "onig_scanner_store.hpp"
+#include "onig_usage_profile.hpp"
 
 using namespace facebook::jni;
 using namespace facebook::jsi;
@@ -17,28 +24,30 @@ extern "C" JNIEXPORT jdouble JNICALL Java_com_shikiengine_ShikiEngineModule_crea
   JNIEnv* env,
   jobject thiz,
   jobjectArray patterns,
-  jdouble maxCacheSize
+  jdouble maxCacheSize,
+  jboolean lazy
 ) {
   try {
     jsize length = env->GetArrayLength(patterns);
     std::vector<std::string> patternStrings;
-    std::vector<const char*> patternPtrs;
-
     patternStrings.reserve(length);
-    patternPtrs.reserve(length);
 
     for (jsize i = 0; i < length; i++) {
       jstring str = (jstring)env->GetObjectArrayElement(patterns, i);
       const char* chars = env->GetStringUTFChars(str, nullptr);
       patternStrings.push_back(chars);
-      patternPtrs.push_back(patternStrings.back().c_str());
       env->ReleaseStringUTFChars(str, chars);
       env->DeleteLocalRef(str);
     }
 
-    OnigContext* context = create_scanner(patternPtrs.data(), length, static_cast<size_t>(maxCacheSize));
+    // Identical pattern lists share one scanner; destroyScanner drops a handle.
+    OnigContext* context = scanner_store_acquire(
+      patternStrings,
+      static_cast<size_t>(maxCacheSize),
+      lazy ? ONIG_SCANNER_LAZY : ONIG_SCANNER_DEFAULT
+    );
     if (!context) {
-      LOGE("Failed to create scanner");
+      LOGE("Failed to create scanner: %s", scanner_last_error());
       return -1;
     }
 
@@ -51,6 +60,174 @@ extern "C" JNIEXPORT jdouble JNICALL Java_com_shikiengine_ShikiEngineModule_crea
   }
 }
 
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_shikiengine_ShikiEngineModule_registerPatternStrings(JNIEnv* env, jobject thiz, jobjectArray patterns) {
+  try {
+    jsize length = env->GetArrayLength(patterns);
+    std::vector<std::string> patternStrings;
+    patternStrings.reserve(length);
+
+    for (jsize i = 0; i < length; i++) {
+      jstring str = (jstring)env->GetObjectArrayElement(patterns, i);
+      const char* chars = env->GetStringUTFChars(str, nullptr);
+      patternStrings.push_back(chars);
+      env->ReleaseStringUTFChars(str, chars);
+      env->DeleteLocalRef(str);
+    }
+
+    std::vector<std::string_view> sources(patternStrings.begin(), patternStrings.end());
+    std::vector<PatternId> ids = pattern_registry_intern_all(sources);
+
+    std::vector<jint> values(ids.begin(), ids.end());
+    jintArray result = env->NewIntArray(length);
+    env->SetIntArrayRegion(result, 0, length, values.data());
+    return result;
+  } catch (const std::exception& e) {
+    LOGE("Exception in registerPatternStrings: %s", e.what());
+    return nullptr;
+  }
+}
+
+extern "C" JNIEXPORT jdouble JNICALL Java_com_shikiengine_ShikiEngineModule_createScannerFromIdArray(
+  JNIEnv* env,
+  jobject thiz,
+  jintArray ids,
+  jdouble maxCacheSize,
+  jboolean lazy
+) {
+  try {
+    jsize length = env->GetArrayLength(ids);
+    std::vector<jint> values(length);
+    env->GetIntArrayRegion(ids, 0, length, values.data());
+    std::vector<PatternId> patternIds(values.begin(), values.end());
+
+    OnigContext* context = scanner_store_acquire_ids(
+      patternIds,
+      static_cast<size_t>(maxCacheSize),
+      lazy ? ONIG_SCANNER_LAZY : ONIG_SCANNER_DEFAULT
+    );
+    if (!context) {
+      LOGE("Failed to create scanner from pattern IDs: %s", scanner_last_error());
+      return -1;
+    }
+
+    uint64_t ptr = reinterpret_cast<uint64_t>(context);
+    return static_cast<jdouble>(ptr);
+  } catch (const std::exception& e) {
+    LOGE("Exception in createScannerFromIdArray: %s", e.what());
+    return -1;
+  }
+}
+
+extern "C" JNIEXPORT jdouble JNICALL
+Java_com_shikiengine_ShikiEngineModule_preloadPatternSet(JNIEnv* env, jobject thiz, jobjectArray patterns) {
+  try {
+    jsize length = env->GetArrayLength(patterns);
+    std::vector<std::string> patternStrings;
+    std::vector<const char*> patternPtrs;
+    patternStrings.reserve(length);
+    patternPtrs.reserve(length);
+
+    for (jsize i = 0; i < length; i++) {
+      jstring str = (jstring)env->GetObjectArrayElement(patterns, i);
+      const char* chars = env->GetStringUTFChars(str, nullptr);
+      patternStrings.push_back(chars);
+      env->ReleaseStringUTFChars(str, chars);
+      env->DeleteLocalRef(str);
+    }
+    for (const auto& pattern : patternStrings) {
+      patternPtrs.push_back(pattern.c_str());
+    }
+
+    double compileTimeMs = 0;
+    int failed = preload_patterns(patternPtrs.data(), length, &compileTimeMs);
+    return failed == 0 ? compileTimeMs : -1;
+  } catch (const std::exception& e) {
+    LOGE("Exception in preloadPatternSet: %s", e.what());
+    return -1;
+  }
+}
+
+// A Java string as UTF-8 for Oniguruma, with tables between its UTF-16
+// offsets, which JS and Java use, and the UTF-8 byte offsets searches use.
+// GetStringUTFChars would hand over modified UTF-8, which encodes characters
+// outside the BMP as two three-byte surrogates.
+struct Utf8Text {
+  std::string bytes;
+  // Size bytes + 1; continuation bytes map to their code point's offset.
+  std::vector<int> byteToUtf16;
+  // Size length + 1; the second half of a surrogate pair maps past the pair.
+  std::vector<int> utf16ToByte;
+};
+
+static Utf8Text readUtf8Text(JNIEnv* env, jstring text) {
+  const jsize length = env->GetStringLength(text);
+  std::vector<jchar> units(length);
+  env->GetStringRegion(text, 0, length, units.data());
+
+  Utf8Text result;
+  result.bytes.reserve(length);
+  result.utf16ToByte.resize(length + 1);
+  jsize i = 0;
+  while (i < length) {
+    uint32_t codePoint = units[i];
+    int width = 1;
+    if (codePoint >= 0xD800 && codePoint < 0xDC00 && i + 1 < length && units[i + 1] >= 0xDC00 &&
+        units[i + 1] < 0xE000) {
+      codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (units[i + 1] - 0xDC00);
+      width = 2;
+    } else if (codePoint >= 0xD800 && codePoint < 0xE000) {
+      // A lone surrogate, replaced the way JSI's utf8() does
+      codePoint = 0xFFFD;
+    }
+
+    const int start = static_cast<int>(result.bytes.size());
+    if (codePoint < 0x80) {
+      result.bytes += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+      result.bytes += static_cast<char>(0xC0 | (codePoint >> 6));
+      result.bytes += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+      result.bytes += static_cast<char>(0xE0 | (codePoint >> 12));
+      result.bytes += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+      result.bytes += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else {
+      result.bytes += static_cast<char>(0xF0 | (codePoint >> 18));
+      result.bytes += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+      result.bytes += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+      result.bytes += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    const int end = static_cast<int>(result.bytes.size());
+
+    result.utf16ToByte[i] = start;
+    if (width == 2) {
+      result.utf16ToByte[i + 1] = end;
+    }
+    result.byteToUtf16.resize(end, i);
+    i += width;
+  }
+  result.utf16ToByte[length] = static_cast<int>(result.bytes.size());
+  result.byteToUtf16.push_back(length);
+  return result;
+}
+
+// The byte offset a search from UTF-16 offset position starts at.
+static int startByteOffset(const Utf8Text& text, double position) {
+  if (!(position > 0)) {
+    return 0;
+  }
+  const size_t index = std::min(static_cast<size_t>(position), text.utf16ToByte.size() - 1);
+  return text.utf16ToByte[index];
+}
+
+// Maps a capture offset to UTF-16, keeping -1 for groups that didn't take part.
+static int toUtf16Offset(const Utf8Text& text, int byteOffset) {
+  if (byteOffset < 0) {
+    return byteOffset;
+  }
+  return text.byteToUtf16[std::min(static_cast<size_t>(byteOffset), text.byteToUtf16.size() - 1)];
+}
+
 extern "C" JNIEXPORT jobject JNICALL Java_com_shikiengine_ShikiEngineModule_findNextMatchSync(
   JNIEnv* env,
   jobject thiz,
@@ -66,9 +243,9 @@ extern "C" JNIEXPORT jobject JNICALL Java_com_shikiengine_ShikiEngineModule_find
       return nullptr;
     }
 
-    const char* textChars = env->GetStringUTFChars(text, nullptr);
-    OnigResult* result = find_next_match(context, textChars, static_cast<int>(startPosition));
-    env->ReleaseStringUTFChars(text, textChars);
+    // Offsets cross the bridge in UTF-16 code units, as on the C++ module.
+    const Utf8Text utf8 = readUtf8Text(env, text);
+    OnigResult* result = find_next_match(context, utf8.bytes.c_str(), startByteOffset(utf8, startPosition));
 
     if (!result) {
       return nullptr;
@@ -90,16 +267,14 @@ extern "C" JNIEXPORT jobject JNICALL Java_com_shikiengine_ShikiEngineModule_find
     jobject captureIndices = env->NewObject(writableArrayClass, arrayConstructor);
     jmethodID pushMap = env->GetMethodID(writableArrayClass, "pushMap", "(Lcom/facebook/react/bridge/WritableMap;)V");
 
-    for (int i = 0; i < result->capture_count / 2; i++) {
+    // capture_indices holds a start/end pair for each of the capture_count groups.
+    for (int i = 0; i < result->capture_count; i++) {
+      const int start = toUtf16Offset(utf8, result->capture_indices[i * 2]);
+      const int end = toUtf16Offset(utf8, result->capture_indices[i * 2 + 1]);
       jobject capture = env->NewObject(writableMapClass, constructor);
-      env->CallVoidMethod(capture, putInt, env->NewStringUTF("start"), result->capture_indices[i * 2]);
-      env->CallVoidMethod(capture, putInt, env->NewStringUTF("end"), result->capture_indices[i * 2 + 1]);
-      env->CallVoidMethod(
-        capture,
-        putInt,
-        env->NewStringUTF("length"),
-        result->capture_indices[i * 2 + 1] - result->capture_indices[i * 2]
-      );
+      env->CallVoidMethod(capture, putInt, env->NewStringUTF("start"), start);
+      env->CallVoidMethod(capture, putInt, env->NewStringUTF("end"), end);
+      env->CallVoidMethod(capture, putInt, env->NewStringUTF("length"), end - start);
       env->CallVoidMethod(captureIndices, pushMap, capture);
       env->DeleteLocalRef(capture);
     }
@@ -116,15 +291,220 @@ extern "C" JNIEXPORT jobject JNICALL Java_com_shikiengine_ShikiEngineModule_find
   }
 }
 
+// Every match in text for findAllMatchesAsync, packed as the C++ module packs
+// one snippet: the match count, then [captureCount, index, start0, end0, ...]
+// per match in UTF-16 offsets. Each search resumes where the previous match
+// ended, one code point further after an empty match; positions stay in UTF-8
+// bytes until they are packed.
+extern "C" JNIEXPORT jintArray JNICALL
+Java_com_shikiengine_ShikiEngineModule_findAllMatches(JNIEnv* env, jobject thiz, jdouble scannerId, jstring text) {
+  try {
+    uint64_t ptr = static_cast<uint64_t>(scannerId);
+    OnigContext* context = reinterpret_cast<OnigContext*>(ptr);
+    if (!context) {
+      LOGE("Invalid scanner ID");
+      return nullptr;
+    }
+
+    const Utf8Text utf8 = readUtf8Text(env, text);
+    const int length = static_cast<int>(utf8.bytes.size());
+    std::vector<jint> values = {0};
+    int position = 0;
+    while (position <= length) {
+      OnigResult* result = find_next_match(context, utf8.bytes.c_str(), position);
+      if (!result) {
+        break;
+      }
+      values[0]++;
+      values.push_back(result->capture_count);
+      values.push_back(result->pattern_index);
+      for (int i = 0; i < result->capture_count * 2; i++) {
+        values.push_back(toUtf16Offset(utf8, result->capture_indices[i]));
+      }
+      const int end = result->capture_indices[1];
+      free_result(result);
+
+      if (end > position) {
+        position = end;
+      } else {
+        do {
+          position++;
+        } while (position < length && (static_cast<unsigned char>(utf8.bytes[position]) & 0xC0) == 0x80);
+      }
+    }
+
+    jintArray packed = env->NewIntArray(static_cast<jsize>(values.size()));
+    env->SetIntArrayRegion(packed, 0, static_cast<jsize>(values.size()), values.data());
+    return packed;
+  } catch (const std::exception& e) {
+    LOGE("Exception in findAllMatches: %s", e.what());
+    return nullptr;
+  }
+}
+
 extern "C" JNIEXPORT void JNICALL
 Java_com_shikiengine_ShikiEngineModule_destroyScanner(JNIEnv* env, jobject thiz, jdouble scannerId) {
   try {
     uint64_t ptr = static_cast<uint64_t>(scannerId);
     OnigContext* context = reinterpret_cast<OnigContext*>(ptr);
     if (context) {
-      free_scanner(context);
+      scanner_store_release(context);
     }
   } catch (const std::exception& e) {
     LOGE("Exception in destroyScanner: %s", e.what());
   }
 }
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_shikiengine_ShikiEngineModule_retainScanner(JNIEnv* env, jobject thiz, jdouble scannerId) {
+  uint64_t ptr = static_cast<uint64_t>(scannerId);
+  // Looks the pointer up without dereferencing it, so a destroyed ID is safe.
+  return scanner_store_retain(reinterpret_cast<OnigContext*>(ptr)) ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_shikiengine_ShikiEngineModule_releaseScanner(JNIEnv* env, jobject thiz, jdouble scannerId) {
+  uint64_t ptr = static_cast<uint64_t>(scannerId);
+  scanner_store_release(reinterpret_cast<OnigContext*>(ptr));
+}
+
+extern "C" JNIEXPORT jobject JNICALL Java_com_shikiengine_ShikiEngineModule_getCacheStats(JNIEnv* env, jobject thiz) {
+  try {
+    OnigCacheStats stats{};
+    get_cache_stats(&stats);
+
+    jclass writableMapClass = env->FindClass("com/facebook/react/bridge/WritableNativeMap");
+    jmethodID constructor = env->GetMethodID(writableMapClass, "<init>", "()V");
+    jmethodID putDouble = env->GetMethodID(writableMapClass, "putDouble", "(Ljava/lang/String;D)V");
+    jobject writableMap = env->NewObject(writableMapClass, constructor);
+
+    const double lookups = static_cast<double>(stats.hits + stats.misses);
+    const std::pair<const char*, double> values[] = {
+      {"entries", static_cast<double>(stats.entries)},
+      {"idleEntries", static_cast<double>(stats.idle_entries)},
+      {"memoryUsage", static_cast<double>(stats.memory_usage)},
+      {"unownedMemoryUsage", static_cast<double>(stats.unowned_memory_usage)},
+      {"hits", static_cast<double>(stats.hits)},
+      {"misses", static_cast<double>(stats.misses)},
+      {"hitRate", lookups > 0 ? static_cast<double>(stats.hits) / lookups : 0.0},
+      {"evictions", static_cast<double>(stats.evictions)},
+      {"compileTimeMs", stats.compile_time_ms},
+      {"compileTimeSavedMs", stats.compile_time_saved_ms},
+      {"memoryBudget", static_cast<double>(stats.memory_budget)},
+      {"scanners", static_cast<double>(stats.scanners)},
+      {"hibernatedScanners", static_cast<double>(stats.hibernated_scanners)},
+      {"hibernations", static_cast<double>(stats.hibernations)},
+      {"scannerHandles", static_cast<double>(stats.scanner_handles)},
+      {"scannerDedupHits", static_cast<double>(stats.scanner_dedup_hits)},
+      {"lazyCompiles", static_cast<double>(stats.lazy_compiles)},
+      {"profileSets", static_cast<double>(stats.profile_sets)},
+      {"profilePrewarmedSets", static_cast<double>(stats.profile_prewarmed_sets)},
+      {"bundlePatterns", static_cast<double>(stats.bundle_patterns)},
+      {"bundleHits", static_cast<double>(stats.bundle_hits)},
+    };
+    for (const auto& value : values) {
+      jstring key = env->NewStringUTF(value.first);
+      env->CallVoidMethod(writableMap, putDouble, key, value.second);
+      env->DeleteLocalRef(key);
+    }
+
+    jmethodID putBoolean = env->GetMethodID(writableMapClass, "putBoolean", "(Ljava/lang/String;Z)V");
+    jstring exactKey = env->NewStringUTF("exactMemory");
+    env->CallVoidMethod(writableMap, putBoolean, exactKey, static_cast<jboolean>(stats.exact_memory != 0));
+    env->DeleteLocalRef(exactKey);
+
+    return writableMap;
+  } catch (const std::exception& e) {
+    LOGE("Exception in getCacheStats: %s", e.what());
+    return nullptr;
+  }
+}
+
+extern "C" JNIEXPORT jobject JNICALL
+Java_com_shikiengine_ShikiEngineModule_getScannerStats(JNIEnv* env, jobject thiz, jdouble scannerId) {
+  try {
+    uint64_t ptr = static_cast<uint64_t>(scannerId);
+    OnigContext* context = reinterpret_cast<OnigContext*>(ptr);
+    // Looks the pointer up before dereferencing it, so a destroyed ID is safe,
+    // and holds it so another thread can't free it while the stats are read.
+    if (!scanner_store_retain(context)) {
+      LOGE("Invalid scanner ID");
+      return nullptr;
+    }
+
+    OnigScannerStats stats{};
+    get_scanner_stats(context, &stats);
+    scanner_store_release(context);
+    // Not counting the handle taken above
+    stats.handles--;
+
+    jclass writableMapClass = env->FindClass("com/facebook/react/bridge/WritableNativeMap");
+    jmethodID constructor = env->GetMethodID(writableMapClass, "<init>", "()V");
+    jmethodID putInt = env->GetMethodID(writableMapClass, "putInt", "(Ljava/lang/String;I)V");
+    jmethodID putDouble = env->GetMethodID(writableMapClass, "putDouble", "(Ljava/lang/String;D)V");
+    jmethodID putBoolean = env->GetMethodID(writableMapClass, "putBoolean", "(Ljava/lang/String;Z)V");
+    jobject writableMap = env->NewObject(writableMapClass, constructor);
+
+    env->CallVoidMethod(writableMap, putInt, env->NewStringUTF("patternCount"), stats.pattern_count);
+    env->CallVoidMethod(writableMap, putInt, env->NewStringUTF("compiledPatterns"), stats.compiled_patterns);
+    env->CallVoidMethod(
+      writableMap,
+      putDouble,
+      env->NewStringUTF("memoryUsage"),
+      static_cast<jdouble>(stats.memory_usage)
+    );
+    env->CallVoidMethod(writableMap, putDouble, env->NewStringUTF("handles"), static_cast<jdouble>(stats.handles));
+    env->CallVoidMethod(
+      writableMap,
+      putBoolean,
+      env->NewStringUTF("exactMemory"),
+      static_cast<jboolean>(stats.exact_memory != 0)
+    );
+    env->CallVoidMethod(
+      writableMap,
+      putBoolean,
+      env->NewStringUTF("hibernated"),
+      static_cast<jboolean>(stats.hibernated != 0)
+    );
+    env->CallVoidMethod(writableMap, putBoolean, env->NewStringUTF("lazy"), static_cast<jboolean>(stats.lazy != 0));
+
+    return writableMap;
+  } catch (const std::exception& e) {
+    LOGE("Exception in getScannerStats: %s", e.what());
+    return nullptr;
+  }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_shikiengine_ShikiEngineModule_setMemoryBudget(JNIEnv* env, jobject thiz, jdouble bytes) {
+  if (bytes >= 0) {
+    set_memory_budget(static_cast<size_t>(bytes));
+  }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_shikiengine_ShikiEngineModule_setCacheSize(JNIEnv* env, jobject thiz, jdouble entries) {
+  if (entries >= 0) {
+    set_cache_max_entries(static_cast<size_t>(entries));
+  }
+}
+
+extern "C" JNIEXPORT jdouble JNICALL
+Java_com_shikiengine_ShikiEngineModule_trimMemory(JNIEnv* env, jobject thiz, jdouble level) {
+  return static_cast<jdouble>(trim_memory(static_cast<int>(level)));
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_shikiengine_ShikiEngineModule_setUsageProfilePath(JNIEnv* env, jobject thiz, jstring path) {
+  const char* chars = env->GetStringUTFChars(path, nullptr);
+  usage_profile_open(chars);
+  env->ReleaseStringUTFChars(path, chars);
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_shikiengine_ShikiEngineModule_loadPatternBundle(JNIEnv* env, jobject thiz, jstring path) {
+  const char* chars = env->GetStringUTFChars(path, nullptr);
+  bool loaded = pattern_bundle_open(chars);
+  env->ReleaseStringUTFChars(path, chars);
+  return loaded ? JNI_TRUE : JNI_FALSE;
+}
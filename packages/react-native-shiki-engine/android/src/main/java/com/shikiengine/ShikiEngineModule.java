@@ -1,11 +1,25 @@
 package com.shikiengine;
 
+import android.os.Process;
 import androidx.annotation.NonNull;
+import androidx.annotation.Nullable;
+import com.facebook.react.bridge.Arguments;
+import com.facebook.react.bridge.Callback;
+import com.facebook.react.bridge.Promise;
 import com.facebook.react.bridge.ReactApplicationContext;
+import com.facebook.react.bridge.WritableArray;
 import com.facebook.react.bridge.WritableMap;
 import com.facebook.react.bridge.ReadableArray;
+import com.facebook.react.bridge.ReadableMap;
 import com.facebook.react.module.annotations.ReactModule;
 
+import java.util.ArrayList;
+import java.util.List;
+import java.util.concurrent.ConcurrentHashMap;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
+import java.util.concurrent.atomic.AtomicBoolean;
+
 @ReactModule(name = NativeShikiEngineSpec.NAME)
 public class ShikiEngineModule extends NativeShikiEngineSpec {
     static {
@@ -16,6 +30,24 @@ public class ShikiEngineModule extends NativeShikiEngineSpec {
         }
     }
 
+    // Compiles scanners for createScannerAsync off the JS thread.
+    private static final ExecutorService compileExecutor = Executors.newSingleThreadExecutor();
+
+    // Warms the pattern cache for preloadPatterns without competing with the UI.
+    private static final ExecutorService preloadExecutor = Executors.newSingleThreadExecutor(
+        runnable -> new Thread(() -> {
+            Process.setThreadPriority(Process.THREAD_PRIORITY_BACKGROUND);
+            runnable.run();
+        }, "ShikiEnginePreload")
+    );
+
+    // Runs findNextMatchesAsync batches off the JS thread.
+    private static final ExecutorService matchExecutor =
+        Executors.newFixedThreadPool(Math.max(1, Math.min(4, Runtime.getRuntime().availableProcessors() - 1)));
+
+    // Cancellation flags of findNextMatchesAsync requests still running.
+    private final ConcurrentHashMap<Double, AtomicBoolean> pendingRequests = new ConcurrentHashMap<>();
+
     public ShikiEngineModule(ReactApplicationContext reactContext) {
         super(reactContext);
     }
@@ -27,11 +59,308 @@ public class ShikiEngineModule extends NativeShikiEngineSpec {
     }
 
     @Override
-    public native double createScanner(ReadableArray patterns, double maxCacheSize);
+    public native double createScanner(ReadableArray patterns, double maxCacheSize, boolean lazy);
+
+    // Scanner objects are JSI host objects; here scanners are only known by ID.
+    @Override
+    public WritableMap createScannerObject(ReadableArray patterns, double maxCacheSize, boolean lazy) {
+        return null;
+    }
+
+    @Override
+    public WritableArray registerPatterns(String patterns, ReadableArray endOffsets) {
+        // Java strings are UTF-16 too, so the offsets index them directly.
+        String[] sources = new String[endOffsets.size()];
+        int start = 0;
+        for (int i = 0; i < sources.length; i++) {
+            int end = (int) endOffsets.getDouble(i);
+            sources[i] = patterns.substring(start, end);
+            start = end;
+        }
+
+        WritableArray ids = Arguments.createArray();
+        for (int id : registerPatternStrings(sources)) {
+            ids.pushDouble(id);
+        }
+        return ids;
+    }
+
+    private native int[] registerPatternStrings(String[] patterns);
+
+    @Override
+    public double createScannerFromIds(ReadableArray ids, double maxCacheSize, boolean lazy) {
+        int[] patternIds = new int[ids.size()];
+        for (int i = 0; i < patternIds.length; i++) {
+            double id = ids.getDouble(i);
+            // The cast would silently turn NaN into 0 and clamp out-of-range values.
+            if (!(id >= 0) || id != Math.floor(id) || id > Integer.MAX_VALUE) {
+                throw new IllegalArgumentException("Pattern IDs must be integers returned by registerPatterns");
+            }
+            patternIds[i] = (int) id;
+        }
+        return createScannerFromIdArray(patternIds, maxCacheSize, lazy);
+    }
+
+    private native double createScannerFromIdArray(int[] ids, double maxCacheSize, boolean lazy);
+
+    @Override
+    public void createScannerAsync(ReadableArray patterns, double maxCacheSize, Promise promise) {
+        compileExecutor.execute(() -> {
+            double scannerId = createScanner(patterns, maxCacheSize, false);
+            if (scannerId < 0) {
+                promise.reject("E_CREATE_SCANNER", "Failed to create scanner");
+            } else {
+                promise.resolve(scannerId);
+            }
+        });
+    }
+
+    @Override
+    public void preloadPatterns(ReadableArray patternSets, Callback onProgress, Promise promise) {
+        preloadExecutor.execute(() -> {
+            // Bridge callbacks fire once, so per-set times only arrive with the promise.
+            WritableArray compileTimes = Arguments.createArray();
+            for (int i = 0; i < patternSets.size(); i++) {
+                ReadableArray set = patternSets.getArray(i);
+                String[] patterns = new String[set.size()];
+                for (int j = 0; j < patterns.length; j++) {
+                    patterns[j] = set.getString(j);
+                }
+                compileTimes.pushDouble(preloadPatternSet(patterns));
+            }
+            promise.resolve(compileTimes);
+        });
+    }
+
+    private native double preloadPatternSet(String[] patterns);
 
     @Override
     public native WritableMap findNextMatchSync(double scannerId, String text, double startPosition);
 
+    // The packed result buffer is an ArrayBuffer shared over JSI; the bridge
+    // has no equivalent, so the JS side falls back to findNextMatchSync.
+    @Override
+    public WritableMap getMatchBuffer() {
+        return null;
+    }
+
+    @Override
+    public double findNextMatchPacked(double scannerId, String text, double startPosition) {
+        return -2;
+    }
+
+    @Override
+    public void findNextMatchesAsync(
+        double requestId,
+        ReadableMap scanner,
+        ReadableArray lines,
+        ReadableArray startPositions,
+        double priority,
+        Promise promise
+    ) {
+        if (!scanner.hasKey("id") || startPositions.size() != lines.size()) {
+            promise.reject("E_INVALID_ARGUMENT", "Expected a scanner ID and one start position per line");
+            return;
+        }
+
+        double scannerId = scanner.getDouble("id");
+        // Hold the scanner so a destroyScanner from JS can't free it under the executor.
+        if (!retainScanner(scannerId)) {
+            promise.reject("E_INVALID_SCANNER", "Invalid scanner ID");
+            return;
+        }
+        AtomicBoolean cancelled = new AtomicBoolean(false);
+        pendingRequests.put(requestId, cancelled);
+        matchExecutor.execute(() -> {
+            // Same layout as the C++ module: [captureCount, index, start0, end0, ...] or [-1] per line,
+            // with every capture group and UTF-16 offsets, as findNextMatchSync returns them.
+            WritableArray results = Arguments.createArray();
+            try {
+                for (int i = 0; i < lines.size() && !cancelled.get(); i++) {
+                    WritableMap match = findNextMatchSync(scannerId, lines.getString(i), startPositions.getDouble(i));
+                    if (match == null) {
+                        results.pushInt(-1);
+                        continue;
+                    }
+                    ReadableArray captures = match.getArray("captureIndices");
+                    results.pushInt(captures.size());
+                    results.pushInt(match.getInt("index"));
+                    for (int j = 0; j < captures.size(); j++) {
+                        ReadableMap capture = captures.getMap(j);
+                        results.pushInt(capture.getInt("start"));
+                        results.pushInt(capture.getInt("end"));
+                    }
+                }
+            } catch (RuntimeException e) {
+                // An exception escaping the executor would kill the process and leave JS waiting.
+                promise.reject("E_MATCH_FAILED", e);
+                return;
+            } finally {
+                releaseScanner(scannerId);
+                pendingRequests.remove(requestId);
+            }
+
+            if (cancelled.get()) {
+                promise.reject("E_CANCELLED", "Request cancelled");
+            } else {
+                promise.resolve(results);
+            }
+        });
+    }
+
+    @Override
+    public void findAllMatchesAsync(ReadableArray scanners, ReadableArray texts, Promise promise) {
+        if (scanners.size() != texts.size()) {
+            promise.reject("E_INVALID_ARGUMENT", "Expected one scanner per text");
+            return;
+        }
+
+        // Hold every scanner so a destroyScanner from JS can't free one under the executor.
+        List<Double> retained = new ArrayList<>();
+        for (int i = 0; i < scanners.size(); i++) {
+            double scannerId = scanners.getMap(i).getDouble("id");
+            if (retained.contains(scannerId)) {
+                continue;
+            }
+            if (!retainScanner(scannerId)) {
+                for (double id : retained) {
+                    releaseScanner(id);
+                }
+                promise.reject("E_INVALID_SCANNER", "Invalid scanner ID");
+                return;
+            }
+            retained.add(scannerId);
+        }
+
+        matchExecutor.execute(() -> {
+            // Same layout as the C++ module: per snippet the match count, then each match.
+            WritableArray results = Arguments.createArray();
+            try {
+                for (int i = 0; i < texts.size(); i++) {
+                    int[] matches = findAllMatches(scanners.getMap(i).getDouble("id"), texts.getString(i));
+                    if (matches == null) {
+                        throw new IllegalStateException("Search failed");
+                    }
+                    for (int value : matches) {
+                        results.pushInt(value);
+                    }
+                }
+            } catch (RuntimeException e) {
+                // An exception escaping the executor would kill the process and leave JS waiting.
+                promise.reject("E_MATCH_FAILED", e);
+                return;
+            } finally {
+                for (double id : retained) {
+                    releaseScanner(id);
+                }
+            }
+            promise.resolve(results);
+        });
+    }
+
+    // Every match in text, packed with UTF-16 offsets; null if the search fails.
+    private native int[] findAllMatches(double scannerId, String text);
+
+    // The bridge never runs modules on the JS thread, so there is nothing to
+    // slice; these batches go to the background executor like any other.
+    @Override
+    public void findNextMatchesSliced(
+        double requestId,
+        ReadableMap scanner,
+        ReadableArray lines,
+        ReadableArray startPositions,
+        double sliceBudgetMs,
+        Promise promise
+    ) {
+        findNextMatchesAsync(requestId, scanner, lines, startPositions, 0, promise);
+    }
+
+    // Batches here run in submission order; priorities only affect the C++ module.
+    @Override
+    public void setRequestPriority(double requestId, double priority) {}
+
+    @Override
+    public void cancelRequest(double requestId) {
+        AtomicBoolean cancelled = pendingRequests.get(requestId);
+        if (cancelled != null) {
+            cancelled.set(true);
+        }
+    }
+
     @Override
     public native void destroyScanner(double scannerId);
+
+    // Takes another handle on a live scanner for work on another thread; false if it was destroyed.
+    private native boolean retainScanner(double scannerId);
+
+    // Drops a handle taken with retainScanner.
+    private native void releaseScanner(double scannerId);
+
+    @Override
+    public native WritableMap getCacheStats();
+
+    @Override
+    public native WritableMap getScannerStats(double scannerId);
+
+    @Override
+    public native void setMemoryBudget(double bytes);
+
+    @Override
+    public native void setCacheSize(double entries);
+
+    @Override
+    public native double trimMemory(double level);
+
+    @Override
+    public native void setUsageProfilePath(String path);
+
+    @Override
+    public native boolean loadPatternBundle(String path);
+
+    // The native tokenizer hands grammars and rule stacks to JS as JSI host
+    // objects, which this module can't create; callers fall back to
+    // vscode-textmate.
+    @Override
+    public WritableMap loadGrammar(ReadableMap grammar) {
+        return null;
+    }
+
+    @Override
+    public WritableMap tokenizeLine(ReadableMap grammar, String line, @Nullable ReadableMap ruleStack) {
+        return null;
+    }
+
+    @Override
+    public void tokenizeLinesAsync(
+        double requestId,
+        ReadableMap grammar,
+        ReadableArray lines,
+        @Nullable ReadableMap ruleStack,
+        double priority,
+        Promise promise
+    ) {
+        promise.reject("E_UNSUPPORTED", "The native tokenizer is not available on this platform");
+    }
+
+    @Override
+    public void tokenizeLinesSliced(
+        double requestId,
+        ReadableMap grammar,
+        ReadableArray lines,
+        @Nullable ReadableMap ruleStack,
+        double sliceBudgetMs,
+        Promise promise
+    ) {
+        promise.reject("E_UNSUPPORTED", "The native tokenizer is not available on this platform");
+    }
+
+    @Override
+    public WritableArray takeRuleStacks(double requestId) {
+        return Arguments.createArray();
+    }
+
+    @Override
+    public void tokenizeSnippetsAsync(ReadableArray grammars, ReadableArray texts, Promise promise) {
+        promise.reject("E_UNSUPPORTED", "The native tokenizer is not available on this platform");
+    }
 }
@@ -1,13 +1,20 @@
 #include "NativeShikiEngineModule.h"
 
-#include <unordered_map>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <string_view>
 #include <vector>
 
-namespace facebook::react {
+#include "onig_grammar.hpp"
+#include "onig_pattern_bundle.hpp"
+#include "onig_scanner_store.hpp"
+#include "onig_scheduler.hpp"
+#include "onig_sliced_task.hpp"
+#include "onig_thread_pool.hpp"
+#include "onig_usage_profile.hpp"
 
-// Store scanner contexts with their IDs
-static std::unordered_map<double, OnigContext*> g_scanners;
-static double g_nextScannerId = 1;
+namespace facebook::react {
 
 // ---- UTF-8 <-> UTF-16 offset conversion ----
 //
@@ -75,15 +82,29 @@ static inline int byteToUtf16Offset(const std::vector<int>& table, int byteOffse
   return table[byteOffset];
 }
 
+// Reads a JS array of pattern sources.
+static std::vector<std::string> readPatterns(jsi::Runtime& rt, const jsi::Array& patterns) {
+  size_t patternCount = patterns.length(rt);
+  std::vector<std::string> patternStrings;
+  patternStrings.reserve(patternCount);
+
+  for (size_t i = 0; i < patternCount; i++) {
+    jsi::String pattern = patterns.getValueAtIndex(rt, i).asString(rt);
+    patternStrings.push_back(pattern.utf8(rt));
+  }
+  return patternStrings;
+}
+
 NativeShikiEngineModule::NativeShikiEngineModule(std::shared_ptr<CallInvoker> jsInvoker)
-  : NativeShikiEngineCxxSpec<NativeShikiEngineModule>(std::move(jsInvoker)) {}
+  : NativeShikiEngineCxxSpec<NativeShikiEngineModule>(std::move(jsInvoker)),
+    self_(std::make_shared<NativeShikiEngineModule*>(this)) {}
 
 NativeShikiEngineModule::~NativeShikiEngineModule() {
-  // Clean up any remaining scanners
-  for (const auto& pair : g_scanners) {
-    free_scanner(pair.second);
+  // Drop this runtime's handles; compiled patterns stay cached for the next one
+  for (const auto& pair : scanners_) {
+    scanner_store_release(pair.second);
   }
-  g_scanners.clear();
+  scanners_.clear();
 }
 
 jsi::Object NativeShikiEngineModule::getConstants(jsi::Runtime& rt) {
@@ -91,91 +112,1363 @@ jsi::Object NativeShikiEngineModule::getConstants(jsi::Runtime& rt) {
   return jsi::Object(rt);
 }
 
-double NativeShikiEngineModule::createScanner(jsi::Runtime& rt, jsi::Array patterns, double maxCacheSize) {
-  // Convert JSI array to C string array
-  size_t patternCount = patterns.length(rt);
-  std::vector<std::string> patternStrings;
-  std::vector<const char*> patternPtrs;
+double
+NativeShikiEngineModule::createScanner(jsi::Runtime& rt, jsi::Array patterns, double maxCacheSize, bool lazy) {
+  // Identical pattern lists share one compiled scanner; each ID is a handle.
+  OnigContext* context = scanner_store_acquire(
+    readPatterns(rt, patterns),
+    static_cast<size_t>(maxCacheSize),
+    lazy ? ONIG_SCANNER_LAZY : ONIG_SCANNER_DEFAULT
+  );
 
-  patternStrings.reserve(patternCount);
-  patternPtrs.reserve(patternCount);
+  if (!context) {
+    const std::string error = scanner_last_error();
+    throw jsi::JSError(rt, error.empty() ? "Failed to create scanner" : "Failed to create scanner: " + error);
+  }
+
+  // Store scanner and return its ID
+  double scannerId = nextScannerId_++;
+  scanners_[scannerId] = context;
+  return scannerId;
+}
+
+jsi::Array NativeShikiEngineModule::registerPatterns(jsi::Runtime& rt, jsi::String patterns, jsi::Array endOffsets) {
+  // One string crosses JSI for the whole batch. Offsets are UTF-16 code units
+  // (JS string indices); map them to UTF-8 bytes in a single forward pass.
+  const std::string buffer = patterns.utf8(rt);
+  const std::vector<int> b2u = buildByteToUtf16Table(buffer);
+  const size_t patternCount = endOffsets.length(rt);
 
+  std::vector<std::string_view> sources;
+  sources.reserve(patternCount);
+  size_t startByte = 0;
+  size_t byte = 0;
   for (size_t i = 0; i < patternCount; i++) {
-    jsi::String pattern = patterns.getValueAtIndex(rt, i).asString(rt);
-    patternStrings.push_back(pattern.utf8(rt));
-    patternPtrs.push_back(patternStrings.back().c_str());
+    const double endOffset = endOffsets.getValueAtIndex(rt, i).asNumber();
+    if (endOffset < b2u[startByte] || endOffset > b2u[buffer.size()]) {
+      throw jsi::JSError(rt, "Pattern offsets must be ascending and within the buffer");
+    }
+    while (byte < buffer.size() && b2u[byte] < endOffset) {
+      byte++;
+    }
+    sources.emplace_back(buffer.data() + startByte, byte - startByte);
+    startByte = byte;
+  }
+
+  const std::vector<PatternId> ids = pattern_registry_intern_all(sources);
+  jsi::Array result(rt, ids.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    result.setValueAtIndex(rt, i, static_cast<double>(ids[i]));
+  }
+  return result;
+}
+
+double NativeShikiEngineModule::createScannerFromIds(
+  jsi::Runtime& rt,
+  jsi::Array patternIds,
+  double maxCacheSize,
+  bool lazy
+) {
+  const size_t patternCount = patternIds.length(rt);
+  const size_t registered = pattern_registry_size();
+  std::vector<PatternId> ids;
+  ids.reserve(patternCount);
+  for (size_t i = 0; i < patternCount; i++) {
+    const double id = patternIds.getValueAtIndex(rt, i).asNumber();
+    // Checked before the cast, which is undefined for NaN and out-of-range values.
+    if (!(id >= 0) || id != std::floor(id) || id >= static_cast<double>(registered)) {
+      throw jsi::JSError(rt, "Pattern IDs must be integers returned by registerPatterns");
+    }
+    ids.push_back(static_cast<PatternId>(id));
   }
 
-  // Create scanner with the provided patterns
   OnigContext* context =
-    create_scanner(patternPtrs.data(), static_cast<int>(patternCount), static_cast<size_t>(maxCacheSize));
+    scanner_store_acquire_ids(ids, static_cast<size_t>(maxCacheSize), lazy ? ONIG_SCANNER_LAZY : ONIG_SCANNER_DEFAULT);
 
   if (!context) {
-    throw jsi::JSError(rt, "Failed to create scanner");
+    const std::string error = scanner_last_error();
+    throw jsi::JSError(
+      rt,
+      error.empty() ? "Failed to create scanner: unknown pattern ID" : "Failed to create scanner: " + error
+    );
   }
 
-  // Store scanner and return its ID
-  double scannerId = g_nextScannerId++;
-  g_scanners[scannerId] = context;
+  double scannerId = nextScannerId_++;
+  scanners_[scannerId] = context;
   return scannerId;
 }
 
-std::optional<jsi::Object>
-NativeShikiEngineModule::findNextMatchSync(jsi::Runtime& rt, double scannerId, jsi::String text, double startPosition) {
-  auto it = g_scanners.find(scannerId);
-  if (it == g_scanners.end()) {
+AsyncPromise<double>
+NativeShikiEngineModule::createScannerAsync(jsi::Runtime& rt, jsi::Array patterns, double maxCacheSize) {
+  AsyncPromise<double> promise(rt, jsInvoker_);
+
+  // A lazy scanner costs nothing to create, so the handle exists right away
+  // and a search that races the background compile only compiles what it hits.
+  OnigContext* context =
+    scanner_store_acquire(readPatterns(rt, patterns), static_cast<size_t>(maxCacheSize), ONIG_SCANNER_LAZY);
+  if (!context) {
+    promise.reject(Error("Failed to create scanner"));
+    return promise;
+  }
+
+  double scannerId = nextScannerId_++;
+  scanners_[scannerId] = context;
+
+  // The task's own handle keeps the scanner alive if JS destroys it early.
+  scanner_store_retain(context);
+  std::weak_ptr<NativeShikiEngineModule*> self = self_;
+  thread_pool_post([context, scannerId, promise, self, jsInvoker = jsInvoker_]() mutable {
+    const bool warmed = warm_scanner(context) == 0;
+    const std::string error = warmed ? "" : scanner_last_error();
+    scanner_store_release(context);
+
+    if (warmed) {
+      promise.resolve(scannerId);
+      return;
+    }
+    jsInvoker->invokeAsync([scannerId, promise, self, error](jsi::Runtime& rt) mutable {
+      if (auto module = self.lock()) {
+        (*module)->destroyScanner(rt, scannerId);
+      }
+      promise.reject(Error("Failed to create scanner: " + error));
+    });
+  });
+
+  return promise;
+}
+
+AsyncPromise<std::vector<double>> NativeShikiEngineModule::preloadPatterns(
+  jsi::Runtime& rt,
+  jsi::Array patternSets,
+  AsyncCallback<double, double> onProgress
+) {
+  AsyncPromise<std::vector<double>> promise(rt, jsInvoker_);
+
+  size_t setCount = patternSets.length(rt);
+  std::vector<std::vector<std::string>> sets;
+  sets.reserve(setCount);
+  for (size_t i = 0; i < setCount; i++) {
+    sets.push_back(readPatterns(rt, patternSets.getValueAtIndex(rt, i).asObject(rt).asArray(rt)));
+  }
+
+  // Speculative work: a single low-priority thread, one set after another,
+  // so startup rendering and real createScanner calls aren't slowed down.
+  thread_pool_post_background([sets = std::move(sets), promise, onProgress]() mutable {
+    std::vector<double> compileTimes;
+    compileTimes.reserve(sets.size());
+
+    for (size_t i = 0; i < sets.size(); i++) {
+      std::vector<const char*> patternPtrs;
+      patternPtrs.reserve(sets[i].size());
+      for (const auto& pattern : sets[i]) {
+        patternPtrs.push_back(pattern.c_str());
+      }
+
+      double compileTimeMs = 0;
+      int failed = preload_patterns(patternPtrs.data(), static_cast<int>(patternPtrs.size()), &compileTimeMs);
+      // Sets with invalid patterns report -1; the valid ones are still cached.
+      compileTimes.push_back(failed == 0 ? compileTimeMs : -1);
+      onProgress(static_cast<double>(i), compileTimes.back());
+    }
+
+    promise.resolve(std::move(compileTimes));
+  });
+
+  return promise;
+}
+
+OnigContext* NativeShikiEngineModule::lookupScanner(jsi::Runtime& rt, double scannerId) {
+  auto it = scanners_.find(scannerId);
+  if (it == scanners_.end()) {
     throw jsi::JSError(rt, "Invalid scanner ID");
   }
+  return it->second;
+}
 
+// Runs a search; on a match, byteToUtf16 maps its byte offsets for JS.
+static OnigResult* search(
+  jsi::Runtime& rt,
+  OnigContext* context,
+  const jsi::String& text,
+  double startPosition,
+  std::vector<int>* byteToUtf16
+) {
   std::string textStr = text.utf8(rt);
 
   // JS side (vscode-textmate) speaks UTF-16 offsets; oniguruma speaks UTF-8
   // byte offsets. Convert startPosition in, and all capture indices out.
-  const std::vector<int> b2u = buildByteToUtf16Table(textStr);
-  const int startByte = utf16ToByteOffset(b2u, static_cast<int>(startPosition));
+  *byteToUtf16 = buildByteToUtf16Table(textStr);
+  const int startByte = utf16ToByteOffset(*byteToUtf16, static_cast<int>(startPosition));
+
+  return find_next_match(context, textStr.c_str(), startByte);
+}
+
+// Property names match results answer to, created once per runtime so
+// lookups compare PropNameIDs instead of strings.
+struct MatchPropNames {
+  explicit MatchPropNames(jsi::Runtime& rt)
+    : index(jsi::PropNameID::forAscii(rt, "index")),
+      captureIndices(jsi::PropNameID::forAscii(rt, "captureIndices")),
+      length(jsi::PropNameID::forAscii(rt, "length")),
+      start(jsi::PropNameID::forAscii(rt, "start")),
+      end(jsi::PropNameID::forAscii(rt, "end")) {}
+
+  jsi::PropNameID index;
+  jsi::PropNameID captureIndices;
+  jsi::PropNameID length;
+  jsi::PropNameID start;
+  jsi::PropNameID end;
+};
+
+// Returns the array index a property name spells, or -1.
+static int parseArrayIndex(const std::string& name) {
+  if (name.empty() || name.size() > 9 || (name[0] == '0' && name.size() > 1)) {
+    return -1;
+  }
+  int index = 0;
+  for (const char c : name) {
+    if (c < '0' || c > '9') {
+      return -1;
+    }
+    index = index * 10 + (c - '0');
+  }
+  return index;
+}
+
+// A match from findNextMatchSync, shaped like vscode-textmate's IOnigMatch.
+// captureIndices is a real array, since vscode-textmate calls array methods
+// on it when resolving back-references, but it is only built the first time
+// it is read and then reused; rules that only look at index never build it.
+class MatchResult : public jsi::HostObject {
+ public:
+  MatchResult(int patternIndex, std::vector<int32_t> offsets, std::shared_ptr<MatchPropNames> names)
+    : patternIndex_(patternIndex), offsets_(std::move(offsets)), names_(std::move(names)) {}
+
+  jsi::Value get(jsi::Runtime& rt, const jsi::PropNameID& name) override {
+    if (jsi::PropNameID::compare(rt, name, names_->index)) {
+      return patternIndex_;
+    }
+    if (jsi::PropNameID::compare(rt, name, names_->captureIndices)) {
+      if (!captureIndices_) {
+        captureIndices_ = buildCaptureIndices(rt);
+      }
+      return jsi::Value(rt, *captureIndices_);
+    }
+    return jsi::Value::undefined();
+  }
+
+  std::vector<jsi::PropNameID> getPropertyNames(jsi::Runtime& rt) override {
+    std::vector<jsi::PropNameID> names;
+    names.push_back(jsi::PropNameID::forAscii(rt, "index"));
+    names.push_back(jsi::PropNameID::forAscii(rt, "captureIndices"));
+    return names;
+  }
+
+ private:
+  jsi::Value buildCaptureIndices(jsi::Runtime& rt) {
+    const size_t count = offsets_.size() / 2;
+    jsi::Array captures(rt, count);
+    for (size_t i = 0; i < count; i++) {
+      // Unmatched optional groups report negative offsets; pass them through.
+      const int start = offsets_[i * 2];
+      const int end = offsets_[i * 2 + 1];
+      jsi::Object capture(rt);
+      capture.setProperty(rt, names_->start, start);
+      capture.setProperty(rt, names_->end, end);
+      capture.setProperty(rt, names_->length, end - start);
+      captures.setValueAtIndex(rt, i, std::move(capture));
+    }
+    offsets_ = {};
+    return jsi::Value(rt, captures);
+  }
+
+  int patternIndex_;
+  // UTF-16 [start0, end0, start1, end1, ...], until captureIndices is built.
+  std::vector<int32_t> offsets_;
+  std::optional<jsi::Value> captureIndices_;
+  std::shared_ptr<MatchPropNames> names_;
+};
+
+// Wraps a match in a MatchResult and frees it.
+static jsi::Object toMatchResult(
+  jsi::Runtime& rt,
+  OnigResult* result,
+  const std::vector<int>& b2u,
+  const std::shared_ptr<MatchPropNames>& names
+) {
+  std::vector<int32_t> offsets(result->capture_count * 2);
+  for (size_t i = 0; i < offsets.size(); i++) {
+    offsets[i] = byteToUtf16Offset(b2u, result->capture_indices[i]);
+  }
+  const int patternIndex = result->pattern_index;
+  free_result(result);
+
+  return jsi::Object::createFromHostObject(rt, std::make_shared<MatchResult>(patternIndex, std::move(offsets), names));
+}
+
+const std::shared_ptr<MatchPropNames>& NativeShikiEngineModule::matchPropNames(jsi::Runtime& rt) {
+  if (!matchPropNames_) {
+    matchPropNames_ = std::make_shared<MatchPropNames>(rt);
+  }
+  return matchPropNames_;
+}
 
-  OnigResult* result = find_next_match(it->second, textStr.c_str(), startByte);
+std::optional<jsi::Object>
+NativeShikiEngineModule::findNextMatchSync(jsi::Runtime& rt, double scannerId, jsi::String text, double startPosition) {
+  std::vector<int> b2u;
+  OnigResult* result = search(rt, lookupScanner(rt, scannerId), text, startPosition, &b2u);
 
   if (!result) {
     return std::nullopt;
   }
+  return toMatchResult(rt, result, b2u, matchPropNames(rt));
+}
+
+// Backs the ArrayBuffer handed out by getMatchBuffer. findNextMatchPacked
+// fills it as int32 [patternIndex, start0, end0, start1, end1, ...] in UTF-16
+// offsets, so a search returns a single number instead of an object graph.
+class MatchBuffer : public jsi::MutableBuffer {
+ public:
+  // Matches with more captures than this fall back to findNextMatchSync.
+  static constexpr int kMaxCaptures = 128;
+
+  size_t size() const override {
+    return sizeof(values);
+  }
+
+  uint8_t* data() override {
+    return reinterpret_cast<uint8_t*>(values);
+  }
+
+  int32_t values[1 + kMaxCaptures * 2] = {};
+};
+
+// findNextMatchPacked results besides a capture count.
+static constexpr double kPackedNoMatch = -1;
+static constexpr double kPackedDoesNotFit = -2;
+
+// Writes a match into buffer and frees it; returns the findNextMatchPacked result.
+static double packMatch(OnigResult* result, const std::vector<int>& b2u, MatchBuffer* buffer) {
+  if (!result) {
+    return kPackedNoMatch;
+  }
+  if (!buffer || result->capture_count > MatchBuffer::kMaxCaptures) {
+    free_result(result);
+    return kPackedDoesNotFit;
+  }
+
+  int32_t* values = buffer->values;
+  values[0] = result->pattern_index;
+  for (int i = 0; i < result->capture_count * 2; i++) {
+    values[1 + i] = byteToUtf16Offset(b2u, result->capture_indices[i]);
+  }
+
+  const int captureCount = result->capture_count;
+  free_result(result);
+  return captureCount;
+}
+
+std::optional<jsi::Object> NativeShikiEngineModule::getMatchBuffer(jsi::Runtime& rt) {
+  if (!matchBuffer_) {
+    matchBuffer_ = std::make_shared<MatchBuffer>();
+  }
+  return jsi::ArrayBuffer(rt, matchBuffer_);
+}
+
+double NativeShikiEngineModule::findNextMatchPacked(
+  jsi::Runtime& rt,
+  double scannerId,
+  jsi::String text,
+  double startPosition
+) {
+  std::vector<int> b2u;
+  OnigResult* result = search(rt, lookupScanner(rt, scannerId), text, startPosition, &b2u);
+  return packMatch(result, b2u, matchBuffer_.get());
+}
+
+// One scanner store handle, released when dispose() is called or when the
+// scanner object and every method taken from it have been garbage collected.
+class ScannerHandle {
+ public:
+  explicit ScannerHandle(OnigContext* context) : context_(context) {}
+
+  ~ScannerHandle() {
+    release();
+  }
+
+  OnigContext* get(jsi::Runtime& rt) const {
+    if (!context_) {
+      throw jsi::JSError(rt, "Scanner has been disposed");
+    }
+    return context_;
+  }
+
+  void release() {
+    if (context_) {
+      scanner_store_release(context_);
+      context_ = nullptr;
+    }
+  }
+
+ private:
+  OnigContext* context_;
+};
+
+// search() for a scanner object method called as (text, startPosition).
+static OnigResult* searchArgs(
+  jsi::Runtime& rt,
+  OnigContext* context,
+  const jsi::Value* args,
+  size_t count,
+  std::vector<int>* byteToUtf16
+) {
+  if (count < 2 || !args[0].isString() || !args[1].isNumber()) {
+    throw jsi::JSError(rt, "Expected (text: string, startPosition: number)");
+  }
+  return search(rt, context, args[0].getString(rt), args[1].getNumber(), byteToUtf16);
+}
 
-  // Convert OnigResult to JSI object matching JS implementation
-  jsi::Object matchObj(rt);
-  matchObj.setProperty(rt, "index", result->pattern_index);
+// What createScannerObject returns: a scanner whose methods search its context
+// directly instead of looking an ID up in scanners_.
+class ScannerObject : public jsi::HostObject {
+ public:
+  ScannerObject(
+    std::shared_ptr<ScannerHandle> handle,
+    std::shared_ptr<MatchPropNames> names,
+    std::shared_ptr<MatchBuffer> buffer
+  )
+    : handle_(std::move(handle)), names_(std::move(names)), buffer_(std::move(buffer)) {}
 
-  jsi::Array captureIndices(rt, result->capture_count);
-  for (int i = 0; i < result->capture_count; i++) {
-    jsi::Object capture(rt);
-    int start = result->capture_indices[i * 2];
-    int end = result->capture_indices[i * 2 + 1];
+  OnigContext* context(jsi::Runtime& rt) const {
+    return handle_->get(rt);
+  }
 
-    // Unmatched optional groups report negative offsets; pass them through.
-    if (start >= 0) {
-      start = byteToUtf16Offset(b2u, start);
+  jsi::Value get(jsi::Runtime& rt, const jsi::PropNameID& name) override {
+    const std::string method = name.utf8(rt);
+    // Methods capture what they need rather than this object, so they stay
+    // usable after being destructured from it.
+    if (method == "findNextMatchSync") {
+      return jsi::Function::createFromHostFunction(
+        rt,
+        name,
+        2,
+        [handle = handle_, names = names_](
+          jsi::Runtime& rt,
+          const jsi::Value&,
+          const jsi::Value* args,
+          size_t count
+        ) {
+          std::vector<int> b2u;
+          OnigResult* result = searchArgs(rt, handle->get(rt), args, count, &b2u);
+          return result ? jsi::Value(rt, toMatchResult(rt, result, b2u, names)) : jsi::Value::null();
+        }
+      );
+    }
+    if (method == "findNextMatchPacked") {
+      return jsi::Function::createFromHostFunction(
+        rt,
+        name,
+        2,
+        [handle = handle_, buffer = buffer_](
+          jsi::Runtime& rt,
+          const jsi::Value&,
+          const jsi::Value* args,
+          size_t count
+        ) {
+          std::vector<int> b2u;
+          OnigResult* result = searchArgs(rt, handle->get(rt), args, count, &b2u);
+          return jsi::Value(packMatch(result, b2u, buffer.get()));
+        }
+      );
     }
-    if (end >= 0) {
-      end = byteToUtf16Offset(b2u, end);
+    if (method == "dispose") {
+      return jsi::Function::createFromHostFunction(
+        rt,
+        name,
+        0,
+        [handle = handle_](jsi::Runtime&, const jsi::Value&, const jsi::Value*, size_t) {
+          handle->release();
+          return jsi::Value::undefined();
+        }
+      );
     }
+    return jsi::Value::undefined();
+  }
+
+  std::vector<jsi::PropNameID> getPropertyNames(jsi::Runtime& rt) override {
+    std::vector<jsi::PropNameID> names;
+    names.push_back(jsi::PropNameID::forAscii(rt, "findNextMatchSync"));
+    names.push_back(jsi::PropNameID::forAscii(rt, "findNextMatchPacked"));
+    names.push_back(jsi::PropNameID::forAscii(rt, "dispose"));
+    return names;
+  }
+
+ private:
+  std::shared_ptr<ScannerHandle> handle_;
+  std::shared_ptr<MatchPropNames> names_;
+  std::shared_ptr<MatchBuffer> buffer_;
+};
+
+std::optional<jsi::Object> NativeShikiEngineModule::createScannerObject(
+  jsi::Runtime& rt,
+  jsi::Array patterns,
+  double maxCacheSize,
+  bool lazy
+) {
+  OnigContext* context = scanner_store_acquire(
+    readPatterns(rt, patterns),
+    static_cast<size_t>(maxCacheSize),
+    lazy ? ONIG_SCANNER_LAZY : ONIG_SCANNER_DEFAULT
+  );
 
-    capture.setProperty(rt, "start", start);
-    capture.setProperty(rt, "end", end);
-    capture.setProperty(rt, "length", end - start);
+  if (!context) {
+    const std::string error = scanner_last_error();
+    throw jsi::JSError(rt, error.empty() ? "Failed to create scanner" : "Failed to create scanner: " + error);
+  }
+
+  // Packed searches write into the same buffer getMatchBuffer hands out.
+  if (!matchBuffer_) {
+    matchBuffer_ = std::make_shared<MatchBuffer>();
+  }
+  return jsi::Object::createFromHostObject(
+    rt,
+    std::make_shared<ScannerObject>(std::make_shared<ScannerHandle>(context), matchPropNames(rt), matchBuffer_)
+  );
+}
 
-    captureIndices.setValueAtIndex(rt, i, std::move(capture));
+OnigContext* NativeShikiEngineModule::resolveScanner(jsi::Runtime& rt, const jsi::Object& scanner) {
+  if (scanner.isHostObject<ScannerObject>(rt)) {
+    return scanner.getHostObject<ScannerObject>(rt)->context(rt);
   }
-  matchObj.setProperty(rt, "captureIndices", std::move(captureIndices));
+  return lookupScanner(rt, scanner.getProperty(rt, "id").asNumber());
+}
 
+// Appends a match to a findNextMatchesAsync result and frees it:
+// [captureCount, patternIndex, start0, end0, ...], or [-1] for no match.
+static void appendPackedMatch(OnigResult* result, const std::vector<int>& b2u, std::vector<double>* out) {
+  if (!result) {
+    out->push_back(-1);
+    return;
+  }
+
+  out->push_back(result->capture_count);
+  out->push_back(result->pattern_index);
+  for (int i = 0; i < result->capture_count * 2; i++) {
+    out->push_back(byteToUtf16Offset(b2u, result->capture_indices[i]));
+  }
   free_result(result);
-  return matchObj;
+}
+
+// Inputs and progress of a findNextMatchesAsync request; only its steps
+// touch it once scheduled.
+struct MatchBatch {
+  OnigContext* context = nullptr;
+  std::vector<std::string> texts;
+  std::vector<int> starts;
+  size_t next = 0;
+  std::vector<double> results;
+};
+
+// Inputs and progress of a tokenizeLinesAsync or tokenizeLinesSliced
+// request; only its steps touch it once started. Kept after it finishes
+// until JS takes its rule stacks.
+struct TokenizeBatch {
+  std::shared_ptr<Grammar> grammar;
+  std::vector<std::string> lines;
+  GrammarState state;
+  size_t next = 0;
+  // Per line, the value count and then the tokens as packLineTokens lays them out.
+  std::vector<double> results;
+  // The state each line ended with.
+  std::vector<GrammarState> states;
+};
+
+AsyncPromise<std::vector<double>> NativeShikiEngineModule::findNextMatchesAsync(
+  jsi::Runtime& rt,
+  double requestId,
+  jsi::Object scanner,
+  jsi::Array lines,
+  jsi::Array startPositions,
+  double priority
+) {
+  OnigContext* context = resolveScanner(rt, scanner);
+  const size_t lineCount = lines.length(rt);
+  if (startPositions.length(rt) != lineCount) {
+    throw jsi::JSError(rt, "Expected one start position per line");
+  }
+
+  auto batch = std::make_shared<MatchBatch>();
+  batch->context = context;
+  batch->texts.reserve(lineCount);
+  batch->starts.reserve(lineCount);
+  for (size_t i = 0; i < lineCount; i++) {
+    batch->texts.push_back(lines.getValueAtIndex(rt, i).asString(rt).utf8(rt));
+    batch->starts.push_back(static_cast<int>(startPositions.getValueAtIndex(rt, i).asNumber()));
+  }
+
+  AsyncPromise<std::vector<double>> promise(rt, jsInvoker_);
+  // The request's own handle keeps the scanner alive if JS disposes it early.
+  scanner_store_retain(context);
+  std::weak_ptr<NativeShikiEngineModule*> self = self_;
+
+  auto work = std::make_shared<ScheduledWork>();
+  work->priority.store(static_cast<int>(priority));
+  work->step = [batch, requestId, promise, self, jsInvoker = jsInvoker_](ScheduledWork& work) mutable {
+    // Yields between lines, so visible lines never wait behind a whole
+    // background document.
+    while (batch->next < batch->texts.size() && !work.cancelled.load(std::memory_order_relaxed)) {
+      if (scheduler_should_yield(work)) {
+        return false;
+      }
+      const std::string& text = batch->texts[batch->next];
+      const std::vector<int> b2u = buildByteToUtf16Table(text);
+      const int startByte = utf16ToByteOffset(b2u, batch->starts[batch->next]);
+      appendPackedMatch(find_next_match(batch->context, text.c_str(), startByte), b2u, &batch->results);
+      batch->next++;
+    }
+    scanner_store_release(batch->context);
+
+    const bool cancelled = work.cancelled.load(std::memory_order_relaxed);
+    jsInvoker->invokeAsync([requestId, cancelled, promise, self, batch](jsi::Runtime&) mutable {
+      if (auto module = self.lock()) {
+        (*module)->pendingRequests_.erase(requestId);
+      }
+      if (cancelled) {
+        promise.reject(Error("Request cancelled"));
+      } else {
+        promise.resolve(std::move(batch->results));
+      }
+    });
+    return true;
+  };
+
+  pendingRequests_[requestId] = work;
+  scheduler_submit(work);
+  return promise;
+}
+
+void NativeShikiEngineModule::setRequestPriority(jsi::Runtime& rt, double requestId, double priority) {
+  auto it = pendingRequests_.find(requestId);
+  if (it != pendingRequests_.end()) {
+    scheduler_set_priority(it->second, static_cast<int>(priority));
+  }
+}
+
+// Appends every match in text for findAllMatchesAsync: the match count, then
+// each match as appendPackedMatch lays it out. Each search resumes where the
+// previous match ended, one code point further after an empty match.
+static void appendAllMatches(OnigContext* context, const std::string& text, std::vector<double>* out) {
+  const std::vector<int> b2u = buildByteToUtf16Table(text);
+  const int length = static_cast<int>(text.size());
+  const size_t countIndex = out->size();
+  out->push_back(0);
+
+  int position = 0;
+  while (position <= length) {
+    OnigResult* result = find_next_match(context, text.c_str(), position);
+    if (!result) {
+      break;
+    }
+    const int end = result->capture_indices[1];
+    appendPackedMatch(result, b2u, out);
+    (*out)[countIndex]++;
+
+    if (end > position) {
+      position = end;
+    } else {
+      do {
+        position++;
+      } while (position < length && (static_cast<unsigned char>(text[position]) & 0xC0) == 0x80);
+    }
+  }
+}
+
+AsyncPromise<std::vector<double>>
+NativeShikiEngineModule::findAllMatchesAsync(jsi::Runtime& rt, jsi::Array scanners, jsi::Array texts) {
+  const size_t snippetCount = scanners.length(rt);
+  if (texts.length(rt) != snippetCount) {
+    throw jsi::JSError(rt, "Expected one scanner per text");
+  }
+
+  auto contexts = std::make_shared<std::vector<OnigContext*>>();
+  auto snippets = std::make_shared<std::vector<std::string>>();
+  contexts->reserve(snippetCount);
+  snippets->reserve(snippetCount);
+  for (size_t i = 0; i < snippetCount; i++) {
+    snippets->push_back(texts.getValueAtIndex(rt, i).asString(rt).utf8(rt));
+    contexts->push_back(resolveScanner(rt, scanners.getValueAtIndex(rt, i).asObject(rt)));
+  }
+  // The request's own handles keep the scanners alive if JS disposes them early.
+  for (OnigContext* context : *contexts) {
+    scanner_store_retain(context);
+  }
+
+  AsyncPromise<std::vector<double>> promise(rt, jsInvoker_);
+  request_queue_post(
+    [contexts, snippets, promise]() mutable {
+      // Snippets vary a lot in length; work stealing keeps every core busy
+      // until the last one is done.
+      std::vector<std::vector<double>> matches(snippets->size());
+      thread_pool_parallel_for(snippets->size(), [&](size_t i) {
+        appendAllMatches((*contexts)[i], (*snippets)[i], &matches[i]);
+      });
+      for (OnigContext* context : *contexts) {
+        scanner_store_release(context);
+      }
+
+      size_t total = 0;
+      for (const std::vector<double>& snippet : matches) {
+        total += snippet.size();
+      }
+      std::vector<double> results;
+      results.reserve(total);
+      for (const std::vector<double>& snippet : matches) {
+        results.insert(results.end(), snippet.begin(), snippet.end());
+      }
+      promise.resolve(std::move(results));
+    },
+    REQUEST_PRIORITY_VISIBLE
+  );
+
+  return promise;
+}
+
+// Searches a batch's lines, pausing between them once the slice is used up.
+static SlicedTask searchLines(MatchBatch* batch) {
+  for (; batch->next < batch->texts.size(); batch->next++) {
+    co_await SliceCheckpoint{};
+    const std::string& text = batch->texts[batch->next];
+    const std::vector<int> b2u = buildByteToUtf16Table(text);
+    const int startByte = utf16ToByteOffset(b2u, batch->starts[batch->next]);
+    appendPackedMatch(find_next_match(batch->context, text.c_str(), startByte), b2u, &batch->results);
+  }
+}
+
+// A findNextMatchesSliced or tokenizeLinesSliced request. Only touched on
+// the JS thread.
+struct SlicedRequest {
+  SlicedRequest(AsyncPromise<std::vector<double>> promise, std::chrono::steady_clock::duration budget)
+    : promise(std::move(promise)), budget(budget) {}
+
+  ~SlicedRequest() {
+    // The task goes first: its frame points into the batch.
+    task.reset();
+    if (batch.context) {
+      scanner_store_release(batch.context);
+    }
+  }
+
+  // findNextMatchesSliced searches batch; tokenizeLinesSliced tokenizes lines.
+  MatchBatch batch;
+  std::shared_ptr<TokenizeBatch> lines;
+  std::optional<SlicedTask> task;
+  AsyncPromise<std::vector<double>> promise;
+  std::chrono::steady_clock::duration budget;
+  bool cancelled = false;
+};
+
+AsyncPromise<std::vector<double>> NativeShikiEngineModule::findNextMatchesSliced(
+  jsi::Runtime& rt,
+  double requestId,
+  jsi::Object scanner,
+  jsi::Array lines,
+  jsi::Array startPositions,
+  double sliceBudgetMs
+) {
+  OnigContext* context = resolveScanner(rt, scanner);
+  const size_t lineCount = lines.length(rt);
+  if (startPositions.length(rt) != lineCount) {
+    throw jsi::JSError(rt, "Expected one start position per line");
+  }
+
+  AsyncPromise<std::vector<double>> promise(rt, jsInvoker_);
+  auto request = std::make_shared<SlicedRequest>(
+    promise,
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(sliceBudgetMs)
+    )
+  );
+  // The request's own handle keeps the scanner alive if JS disposes it early.
+  scanner_store_retain(context);
+  request->batch.context = context;
+  request->batch.texts.reserve(lineCount);
+  request->batch.starts.reserve(lineCount);
+  for (size_t i = 0; i < lineCount; i++) {
+    request->batch.texts.push_back(lines.getValueAtIndex(rt, i).asString(rt).utf8(rt));
+    request->batch.starts.push_back(static_cast<int>(startPositions.getValueAtIndex(rt, i).asNumber()));
+  }
+  request->task.emplace(searchLines(&request->batch));
+
+  slicedRequests_[requestId] = request;
+  // The first slice runs now, so small batches finish without a round trip.
+  runSlice(requestId);
+  return promise;
+}
+
+void NativeShikiEngineModule::runSlice(double requestId) {
+  auto it = slicedRequests_.find(requestId);
+  if (it == slicedRequests_.end()) {
+    return;
+  }
+  SlicedRequest& request = *it->second;
+
+  if (request.cancelled) {
+    request.promise.reject(Error("Request cancelled"));
+    slicedRequests_.erase(it);
+    return;
+  }
+
+  bool finished = false;
+  try {
+    finished = request.task->run_slice(request.budget);
+  } catch (const std::exception& e) {
+    request.promise.reject(Error(e.what()));
+    slicedRequests_.erase(it);
+    return;
+  }
+
+  if (!finished) {
+    // Back of the JS queue, so whatever else is waiting runs between slices.
+    std::weak_ptr<NativeShikiEngineModule*> self = self_;
+    jsInvoker_->invokeAsync([self, requestId](jsi::Runtime&) {
+      if (auto module = self.lock()) {
+        (*module)->runSlice(requestId);
+      }
+    });
+    return;
+  }
+
+  if (request.lines) {
+    // Stored before resolving, so the promise's handlers can take them.
+    tokenizedRequests_[requestId] = request.lines;
+    request.promise.resolve(std::move(request.lines->results));
+  } else {
+    request.promise.resolve(std::move(request.batch.results));
+  }
+  slicedRequests_.erase(it);
+}
+
+void NativeShikiEngineModule::cancelRequest(jsi::Runtime& rt, double requestId) {
+  auto it = pendingRequests_.find(requestId);
+  if (it != pendingRequests_.end()) {
+    scheduler_cancel(it->second);
+  }
+
+  // Rejected when its next slice comes up.
+  auto sliced = slicedRequests_.find(requestId);
+  if (sliced != slicedRequests_.end()) {
+    sliced->second->cancelled = true;
+  }
 }
 
 void NativeShikiEngineModule::destroyScanner(jsi::Runtime& rt, double scannerId) {
-  auto it = g_scanners.find(scannerId);
-  if (it != g_scanners.end()) {
-    free_scanner(it->second);
-    g_scanners.erase(it);
+  auto it = scanners_.find(scannerId);
+  if (it != scanners_.end()) {
+    scanner_store_release(it->second);
+    scanners_.erase(it);
+  }
+}
+
+jsi::Object NativeShikiEngineModule::getCacheStats(jsi::Runtime& rt) {
+  OnigCacheStats stats{};
+  get_cache_stats(&stats);
+
+  const double lookups = static_cast<double>(stats.hits + stats.misses);
+
+  jsi::Object result(rt);
+  result.setProperty(rt, "entries", static_cast<double>(stats.entries));
+  result.setProperty(rt, "idleEntries", static_cast<double>(stats.idle_entries));
+  result.setProperty(rt, "memoryUsage", static_cast<double>(stats.memory_usage));
+  result.setProperty(rt, "unownedMemoryUsage", static_cast<double>(stats.unowned_memory_usage));
+  result.setProperty(rt, "exactMemory", stats.exact_memory != 0);
+  result.setProperty(rt, "hits", static_cast<double>(stats.hits));
+  result.setProperty(rt, "misses", static_cast<double>(stats.misses));
+  result.setProperty(rt, "hitRate", lookups > 0 ? static_cast<double>(stats.hits) / lookups : 0.0);
+  result.setProperty(rt, "evictions", static_cast<double>(stats.evictions));
+  result.setProperty(rt, "compileTimeMs", stats.compile_time_ms);
+  result.setProperty(rt, "compileTimeSavedMs", stats.compile_time_saved_ms);
+  result.setProperty(rt, "memoryBudget", static_cast<double>(stats.memory_budget));
+  result.setProperty(rt, "scanners", static_cast<double>(stats.scanners));
+  result.setProperty(rt, "hibernatedScanners", static_cast<double>(stats.hibernated_scanners));
+  result.setProperty(rt, "hibernations", static_cast<double>(stats.hibernations));
+  result.setProperty(rt, "scannerHandles", static_cast<double>(stats.scanner_handles));
+  result.setProperty(rt, "scannerDedupHits", static_cast<double>(stats.scanner_dedup_hits));
+  result.setProperty(rt, "lazyCompiles", static_cast<double>(stats.lazy_compiles));
+  result.setProperty(rt, "profileSets", static_cast<double>(stats.profile_sets));
+  result.setProperty(rt, "profilePrewarmedSets", static_cast<double>(stats.profile_prewarmed_sets));
+  result.setProperty(rt, "bundlePatterns", static_cast<double>(stats.bundle_patterns));
+  result.setProperty(rt, "bundleHits", static_cast<double>(stats.bundle_hits));
+  return result;
+}
+
+jsi::Object NativeShikiEngineModule::getScannerStats(jsi::Runtime& rt, double scannerId) {
+  auto it = scanners_.find(scannerId);
+  if (it == scanners_.end()) {
+    throw jsi::JSError(rt, "Invalid scanner ID");
+  }
+
+  OnigScannerStats stats{};
+  get_scanner_stats(it->second, &stats);
+
+  jsi::Object result(rt);
+  result.setProperty(rt, "patternCount", stats.pattern_count);
+  result.setProperty(rt, "compiledPatterns", stats.compiled_patterns);
+  result.setProperty(rt, "lazy", stats.lazy != 0);
+  result.setProperty(rt, "memoryUsage", static_cast<double>(stats.memory_usage));
+  result.setProperty(rt, "exactMemory", stats.exact_memory != 0);
+  result.setProperty(rt, "hibernated", stats.hibernated != 0);
+  result.setProperty(rt, "handles", static_cast<double>(stats.handles));
+  return result;
+}
+
+void NativeShikiEngineModule::setMemoryBudget(jsi::Runtime& rt, double bytes) {
+  if (bytes < 0) {
+    throw jsi::JSError(rt, "Memory budget must be >= 0");
+  }
+  set_memory_budget(static_cast<size_t>(bytes));
+}
+
+void NativeShikiEngineModule::setCacheSize(jsi::Runtime& rt, double entries) {
+  if (!(entries >= 0)) {
+    throw jsi::JSError(rt, "Cache size must be >= 0");
+  }
+  set_cache_max_entries(static_cast<size_t>(entries));
+}
+
+double NativeShikiEngineModule::trimMemory(jsi::Runtime& rt, double level) {
+  return static_cast<double>(trim_memory(static_cast<int>(level)));
+}
+
+void NativeShikiEngineModule::setUsageProfilePath(jsi::Runtime& rt, jsi::String path) {
+  usage_profile_open(path.utf8(rt));
+}
+
+bool NativeShikiEngineModule::loadPatternBundle(jsi::Runtime& rt, jsi::String path) {
+  return pattern_bundle_open(path.utf8(rt));
+}
+
+// ---- Grammars ----
+
+// Reads a string property of a grammar rule; "" when it's missing.
+static std::string readString(jsi::Runtime& rt, const jsi::Object& object, const char* name) {
+  const jsi::Value value = object.getProperty(rt, name);
+  return value.isString() ? value.asString(rt).utf8(rt) : std::string();
+}
+
+// Reads a captures object: {"1": {name}, ...}.
+static std::vector<GrammarCaptureSource>
+readCaptures(jsi::Runtime& rt, const jsi::Object& object, const char* name) {
+  std::vector<GrammarCaptureSource> captures;
+  const jsi::Value value = object.getProperty(rt, name);
+  if (!value.isObject()) {
+    return captures;
+  }
+
+  const jsi::Object captureObject = value.asObject(rt);
+  const jsi::Array keys = captureObject.getPropertyNames(rt);
+  const size_t keyCount = keys.length(rt);
+  for (size_t i = 0; i < keyCount; i++) {
+    const std::string key = keys.getValueAtIndex(rt, i).asString(rt).utf8(rt);
+    const int index = parseArrayIndex(key);
+    const jsi::Value capture = captureObject.getProperty(rt, key.c_str());
+    if (index >= 0 && capture.isObject()) {
+      captures.push_back({index, readString(rt, capture.asObject(rt), "name")});
+    }
+  }
+  return captures;
+}
+
+static GrammarRuleSource readRule(jsi::Runtime& rt, const jsi::Object& rule);
+
+static std::vector<GrammarRuleSource> readPatternList(jsi::Runtime& rt, const jsi::Object& object) {
+  std::vector<GrammarRuleSource> patterns;
+  const jsi::Value value = object.getProperty(rt, "patterns");
+  if (!value.isObject() || !value.asObject(rt).isArray(rt)) {
+    return patterns;
   }
+
+  const jsi::Array array = value.asObject(rt).asArray(rt);
+  const size_t count = array.length(rt);
+  patterns.reserve(count);
+  for (size_t i = 0; i < count; i++) {
+    const jsi::Value pattern = array.getValueAtIndex(rt, i);
+    if (pattern.isObject()) {
+      patterns.push_back(readRule(rt, pattern.asObject(rt)));
+    }
+  }
+  return patterns;
+}
+
+static std::vector<GrammarRuleSource> readRepository(jsi::Runtime& rt, const jsi::Object& object) {
+  std::vector<GrammarRuleSource> repository;
+  const jsi::Value value = object.getProperty(rt, "repository");
+  if (!value.isObject()) {
+    return repository;
+  }
+
+  const jsi::Object entries = value.asObject(rt);
+  const jsi::Array keys = entries.getPropertyNames(rt);
+  const size_t keyCount = keys.length(rt);
+  repository.reserve(keyCount);
+  for (size_t i = 0; i < keyCount; i++) {
+    const std::string key = keys.getValueAtIndex(rt, i).asString(rt).utf8(rt);
+    const jsi::Value entry = entries.getProperty(rt, key.c_str());
+    if (entry.isObject()) {
+      repository.push_back(readRule(rt, entry.asObject(rt)));
+      repository.back().key = key;
+    }
+  }
+  return repository;
+}
+
+static GrammarRuleSource readRule(jsi::Runtime& rt, const jsi::Object& rule) {
+  GrammarRuleSource source;
+  source.include = readString(rt, rule, "include");
+  source.name = readString(rt, rule, "name");
+  source.content_name = readString(rt, rule, "contentName");
+  source.match = readString(rt, rule, "match");
+  source.begin = readString(rt, rule, "begin");
+  source.end = readString(rt, rule, "end");
+  source.while_ = readString(rt, rule, "while");
+  const jsi::Value applyEndPatternLast = rule.getProperty(rt, "applyEndPatternLast");
+  source.apply_end_pattern_last = applyEndPatternLast.isBool()
+    ? applyEndPatternLast.getBool()
+    : applyEndPatternLast.isNumber() && applyEndPatternLast.getNumber() != 0;
+  source.captures = readCaptures(rt, rule, "captures");
+  source.begin_captures = readCaptures(rt, rule, "beginCaptures");
+  source.end_captures = readCaptures(rt, rule, "endCaptures");
+  source.while_captures = readCaptures(rt, rule, "whileCaptures");
+  source.patterns = readPatternList(rt, rule);
+  source.repository = readRepository(rt, rule);
+  return source;
+}
+
+// A grammar from loadGrammar. Opaque to JS.
+class GrammarObject : public jsi::HostObject {
+ public:
+  explicit GrammarObject(std::shared_ptr<Grammar> grammar) : grammar_(std::move(grammar)) {}
+
+  const std::shared_ptr<Grammar>& grammar() const {
+    return grammar_;
+  }
+
+ private:
+  std::shared_ptr<Grammar> grammar_;
+};
+
+// The rule stack at the end of a line, as tokenizeLine returns it. Opaque to
+// JS; freed once no line state refers to it.
+class RuleStackObject : public jsi::HostObject {
+ public:
+  RuleStackObject(std::shared_ptr<Grammar> grammar, GrammarState state)
+    : grammar_(std::move(grammar)), state_(std::move(state)) {}
+
+  const std::shared_ptr<Grammar>& grammar() const {
+    return grammar_;
+  }
+
+  const GrammarState& state() const {
+    return state_;
+  }
+
+ private:
+  // The grammar the rule IDs in state belong to. Owning, so its address can't
+  // be reused by another grammar while this stack is alive.
+  std::shared_ptr<Grammar> grammar_;
+  GrammarState state_;
+};
+
+std::optional<jsi::Object> NativeShikiEngineModule::loadGrammar(jsi::Runtime& rt, jsi::Object grammar) {
+  GrammarSource source;
+  source.scope_name = readString(rt, grammar, "scopeName");
+  source.patterns = readPatternList(rt, grammar);
+  source.repository = readRepository(rt, grammar);
+
+  auto compiled = std::make_shared<Grammar>(source);
+  const std::vector<std::string>& names = compiled->scope_names();
+  jsi::Array scopeNames(rt, names.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    scopeNames.setValueAtIndex(rt, i, jsi::String::createFromUtf8(rt, names[i]));
+  }
+
+  jsi::Object result(rt);
+  result.setProperty(rt, "grammar", jsi::Object::createFromHostObject(rt, std::make_shared<GrammarObject>(compiled)));
+  result.setProperty(rt, "scopeNames", scopeNames);
+  return result;
+}
+
+// The grammar behind a loadGrammar result.
+static std::shared_ptr<Grammar> readGrammar(jsi::Runtime& rt, const jsi::Object& grammar) {
+  if (!grammar.isHostObject<GrammarObject>(rt)) {
+    throw jsi::JSError(rt, "Expected a grammar from loadGrammar");
+  }
+  return grammar.getHostObject<GrammarObject>(rt)->grammar();
+}
+
+// The state behind a rule stack from tokenizeLine, null for the first line.
+static GrammarState
+readRuleStack(jsi::Runtime& rt, const std::optional<jsi::Object>& ruleStack, const std::shared_ptr<Grammar>& grammar) {
+  if (!ruleStack) {
+    return nullptr;
+  }
+  if (!ruleStack->isHostObject<RuleStackObject>(rt)) {
+    throw jsi::JSError(rt, "Expected a rule stack from tokenizeLine");
+  }
+  auto previous = ruleStack->getHostObject<RuleStackObject>(rt);
+  if (previous->grammar() != grammar) {
+    throw jsi::JSError(rt, "Rule stack belongs to another grammar");
+  }
+  return previous->state();
+}
+
+// Appends a line's tokens as [startIndex, endIndex, scopeCount, scope0, ...]
+// per token, in UTF-16 offsets into text.
+static void packLineTokens(const std::string& text, const std::vector<GrammarToken>& tokens, std::vector<double>* out) {
+  // Token offsets run one past the line, over the "\n" the tokenizer adds.
+  const std::vector<int> b2u = buildByteToUtf16Table(text + "\n");
+  for (const auto& token : tokens) {
+    out->push_back(byteToUtf16Offset(b2u, token.start));
+    out->push_back(byteToUtf16Offset(b2u, token.end));
+    out->push_back(static_cast<double>(token.scopes.size()));
+    out->insert(out->end(), token.scopes.begin(), token.scopes.end());
+  }
+}
+
+jsi::Object NativeShikiEngineModule::tokenizeLine(
+  jsi::Runtime& rt,
+  jsi::Object grammar,
+  jsi::String line,
+  std::optional<jsi::Object> ruleStack
+) {
+  const std::shared_ptr<Grammar> compiled = readGrammar(rt, grammar);
+  GrammarState state = readRuleStack(rt, ruleStack, compiled);
+
+  const std::string text = line.utf8(rt);
+  std::vector<GrammarToken> tokens;
+  state = compiled->tokenize_line(text, state, &tokens);
+
+  std::vector<double> packed;
+  packLineTokens(text, tokens, &packed);
+  jsi::Array values(rt, packed.size());
+  for (size_t i = 0; i < packed.size(); i++) {
+    values.setValueAtIndex(rt, i, packed[i]);
+  }
+
+  jsi::Object result(rt);
+  result.setProperty(rt, "tokens", values);
+  result.setProperty(
+    rt,
+    "ruleStack",
+    jsi::Object::createFromHostObject(rt, std::make_shared<RuleStackObject>(compiled, std::move(state)))
+  );
+  return result;
+}
+
+// A tokenize request's inputs, read on the JS thread.
+static std::shared_ptr<TokenizeBatch> readTokenizeBatch(
+  jsi::Runtime& rt,
+  const jsi::Object& grammar,
+  const jsi::Array& lines,
+  const std::optional<jsi::Object>& ruleStack
+) {
+  auto batch = std::make_shared<TokenizeBatch>();
+  batch->grammar = readGrammar(rt, grammar);
+  batch->state = readRuleStack(rt, ruleStack, batch->grammar);
+  const size_t lineCount = lines.length(rt);
+  batch->lines.reserve(lineCount);
+  batch->states.reserve(lineCount);
+  for (size_t i = 0; i < lineCount; i++) {
+    batch->lines.push_back(lines.getValueAtIndex(rt, i).asString(rt).utf8(rt));
+  }
+  return batch;
+}
+
+// Tokenizes the batch's next line.
+static void tokenizeNextLine(TokenizeBatch* batch, std::vector<GrammarToken>* tokens) {
+  const std::string& text = batch->lines[batch->next++];
+  batch->state = batch->grammar->tokenize_line(text, batch->state, tokens);
+  batch->states.push_back(batch->state);
+
+  const size_t countIndex = batch->results.size();
+  batch->results.push_back(0);
+  packLineTokens(text, *tokens, &batch->results);
+  batch->results[countIndex] = static_cast<double>(batch->results.size() - countIndex - 1);
+}
+
+AsyncPromise<std::vector<double>> NativeShikiEngineModule::tokenizeLinesAsync(
+  jsi::Runtime& rt,
+  double requestId,
+  jsi::Object grammar,
+  jsi::Array lines,
+  std::optional<jsi::Object> ruleStack,
+  double priority
+) {
+  auto batch = readTokenizeBatch(rt, grammar, lines, ruleStack);
+
+  AsyncPromise<std::vector<double>> promise(rt, jsInvoker_);
+  std::weak_ptr<NativeShikiEngineModule*> self = self_;
+
+  auto work = std::make_shared<ScheduledWork>();
+  work->priority.store(static_cast<int>(priority));
+  work->step = [batch, requestId, promise, self, jsInvoker = jsInvoker_](ScheduledWork& work) mutable {
+    // Yields between lines, like findNextMatchesAsync.
+    std::vector<GrammarToken> tokens;
+    while (batch->next < batch->lines.size() && !work.cancelled.load(std::memory_order_relaxed)) {
+      if (scheduler_should_yield(work)) {
+        return false;
+      }
+      tokenizeNextLine(batch.get(), &tokens);
+    }
+
+    const bool cancelled = work.cancelled.load(std::memory_order_relaxed);
+    jsInvoker->invokeAsync([requestId, cancelled, promise, self, batch](jsi::Runtime&) mutable {
+      auto module = self.lock();
+      if (module) {
+        (*module)->pendingRequests_.erase(requestId);
+      }
+      if (cancelled || !module) {
+        promise.reject(Error("Request cancelled"));
+        return;
+      }
+      // Stored before resolving, so the promise's handlers can take them.
+      (*module)->tokenizedRequests_[requestId] = batch;
+      promise.resolve(std::move(batch->results));
+    });
+    return true;
+  };
+
+  pendingRequests_[requestId] = work;
+  scheduler_submit(work);
+  return promise;
+}
+
+jsi::Array NativeShikiEngineModule::takeRuleStacks(jsi::Runtime& rt, double requestId) {
+  auto it = tokenizedRequests_.find(requestId);
+  if (it == tokenizedRequests_.end()) {
+    return jsi::Array(rt, 0);
+  }
+  const std::shared_ptr<TokenizeBatch> batch = std::move(it->second);
+  tokenizedRequests_.erase(it);
+
+  jsi::Array ruleStacks(rt, batch->states.size());
+  for (size_t i = 0; i < batch->states.size(); i++) {
+    ruleStacks.setValueAtIndex(
+      rt,
+      i,
+      jsi::Object::createFromHostObject(rt, std::make_shared<RuleStackObject>(batch->grammar, batch->states[i]))
+    );
+  }
+  return ruleStacks;
+}
+
+// Tokenizes a batch's lines, pausing between them once the slice is used up.
+static SlicedTask tokenizeLines(TokenizeBatch* batch) {
+  std::vector<GrammarToken> tokens;
+  while (batch->next < batch->lines.size()) {
+    co_await SliceCheckpoint{};
+    tokenizeNextLine(batch, &tokens);
+  }
+}
+
+AsyncPromise<std::vector<double>> NativeShikiEngineModule::tokenizeLinesSliced(
+  jsi::Runtime& rt,
+  double requestId,
+  jsi::Object grammar,
+  jsi::Array lines,
+  std::optional<jsi::Object> ruleStack,
+  double sliceBudgetMs
+) {
+  auto batch = readTokenizeBatch(rt, grammar, lines, ruleStack);
+
+  AsyncPromise<std::vector<double>> promise(rt, jsInvoker_);
+  auto request = std::make_shared<SlicedRequest>(
+    promise,
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double, std::milli>(sliceBudgetMs)
+    )
+  );
+  request->lines = batch;
+  request->task.emplace(tokenizeLines(batch.get()));
+
+  slicedRequests_[requestId] = request;
+  // The first slice runs now, like findNextMatchesSliced.
+  runSlice(requestId);
+  return promise;
+}
+
+// Tokenizes a snippet from the start of a document for tokenizeSnippetsAsync:
+// its line count, then each line as tokenizeNextLine lays it out. Lines end
+// at "\n", with a "\r" before it dropped, as Shiki splits them.
+static void appendSnippetTokens(Grammar& grammar, const std::string& code, std::vector<double>* out) {
+  const size_t countIndex = out->size();
+  out->push_back(0);
+
+  GrammarState state;
+  std::vector<GrammarToken> tokens;
+  size_t start = 0;
+  for (;;) {
+    size_t end = code.find('\n', start);
+    const bool last = end == std::string::npos;
+    if (last) {
+      end = code.size();
+    }
+    const size_t length = end > start && code[end - 1] == '\r' ? end - start - 1 : end - start;
+    const std::string line = code.substr(start, length);
+    state = grammar.tokenize_line(line, state, &tokens);
+
+    const size_t valueIndex = out->size();
+    out->push_back(0);
+    packLineTokens(line, tokens, out);
+    (*out)[valueIndex] = static_cast<double>(out->size() - valueIndex - 1);
+    (*out)[countIndex]++;
+    if (last) {
+      break;
+    }
+    start = end + 1;
+  }
+}
+
+AsyncPromise<std::vector<double>>
+NativeShikiEngineModule::tokenizeSnippetsAsync(jsi::Runtime& rt, jsi::Array grammars, jsi::Array texts) {
+  const size_t snippetCount = grammars.length(rt);
+  if (texts.length(rt) != snippetCount) {
+    throw jsi::JSError(rt, "Expected one grammar per text");
+  }
+
+  auto compiled = std::make_shared<std::vector<std::shared_ptr<Grammar>>>();
+  auto snippets = std::make_shared<std::vector<std::string>>();
+  compiled->reserve(snippetCount);
+  snippets->reserve(snippetCount);
+  for (size_t i = 0; i < snippetCount; i++) {
+    compiled->push_back(readGrammar(rt, grammars.getValueAtIndex(rt, i).asObject(rt)));
+    snippets->push_back(texts.getValueAtIndex(rt, i).asString(rt).utf8(rt));
+  }
+
+  AsyncPromise<std::vector<double>> promise(rt, jsInvoker_);
+  request_queue_post(
+    [compiled, snippets, promise]() mutable {
+      // Spread like findAllMatchesAsync; snippets sharing a grammar tokenize
+      // on different threads at once.
+      std::vector<std::vector<double>> tokens(snippets->size());
+      thread_pool_parallel_for(snippets->size(), [&](size_t i) {
+        appendSnippetTokens(*(*compiled)[i], (*snippets)[i], &tokens[i]);
+      });
+
+      size_t total = 0;
+      for (const std::vector<double>& snippet : tokens) {
+        total += snippet.size();
+      }
+      std::vector<double> results;
+      results.reserve(total);
+      for (const std::vector<double>& snippet : tokens) {
+        results.insert(results.end(), snippet.begin(), snippet.end());
+      }
+      promise.resolve(std::move(results));
+    },
+    REQUEST_PRIORITY_VISIBLE
+  );
+
+  return promise;
 }
 
 }  // namespace facebook::react
@@ -3,9 +3,13 @@
 #include <ReactCommon/CallInvoker.h>
 
 #include <jsi/jsi.h>
+#include <react/bridging/Function.h>
+#include <react/bridging/Promise.h>
 
 #include <memory>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 
 #if __has_include(<react/renderer/components/NativeShikiEngineSpec/NativeShikiEngineSpecJSI.h>)
 #  include <react/renderer/components/NativeShikiEngineSpec/NativeShikiEngineSpecJSI.h>
@@ -23,18 +27,108 @@
 #  include "onig_regex.h"
 #endif
 
+struct ScheduledWork;
+
 namespace facebook::react {
 
+class MatchBuffer;
+struct MatchPropNames;
+struct SlicedRequest;
+struct TokenizeBatch;
+
 class NativeShikiEngineModule : public NativeShikiEngineCxxSpec<NativeShikiEngineModule> {
  public:
   NativeShikiEngineModule(std::shared_ptr<CallInvoker> jsInvoker);
   ~NativeShikiEngineModule();
 
   jsi::Object getConstants(jsi::Runtime& rt);
-  double createScanner(jsi::Runtime& rt, jsi::Array patterns, double maxCacheSize);
+  double createScanner(jsi::Runtime& rt, jsi::Array patterns, double maxCacheSize, bool lazy);
+  std::optional<jsi::Object>
+  createScannerObject(jsi::Runtime& rt, jsi::Array patterns, double maxCacheSize, bool lazy);
+  jsi::Array registerPatterns(jsi::Runtime& rt, jsi::String patterns, jsi::Array endOffsets);
+  double createScannerFromIds(jsi::Runtime& rt, jsi::Array patternIds, double maxCacheSize, bool lazy);
+  AsyncPromise<double> createScannerAsync(jsi::Runtime& rt, jsi::Array patterns, double maxCacheSize);
+  AsyncPromise<std::vector<double>>
+  preloadPatterns(jsi::Runtime& rt, jsi::Array patternSets, AsyncCallback<double, double> onProgress);
   std::optional<jsi::Object>
   findNextMatchSync(jsi::Runtime& rt, double scannerId, jsi::String text, double startPosition);
+  std::optional<jsi::Object> getMatchBuffer(jsi::Runtime& rt);
+  double findNextMatchPacked(jsi::Runtime& rt, double scannerId, jsi::String text, double startPosition);
+  AsyncPromise<std::vector<double>> findNextMatchesAsync(
+    jsi::Runtime& rt,
+    double requestId,
+    jsi::Object scanner,
+    jsi::Array lines,
+    jsi::Array startPositions,
+    double priority
+  );
+  void setRequestPriority(jsi::Runtime& rt, double requestId, double priority);
+  AsyncPromise<std::vector<double>> findAllMatchesAsync(jsi::Runtime& rt, jsi::Array scanners, jsi::Array texts);
+  AsyncPromise<std::vector<double>> findNextMatchesSliced(
+    jsi::Runtime& rt,
+    double requestId,
+    jsi::Object scanner,
+    jsi::Array lines,
+    jsi::Array startPositions,
+    double sliceBudgetMs
+  );
+  void cancelRequest(jsi::Runtime& rt, double requestId);
   void destroyScanner(jsi::Runtime& rt, double scannerId);
+  jsi::Object getCacheStats(jsi::Runtime& rt);
+  jsi::Object getScannerStats(jsi::Runtime& rt, double scannerId);
+  void setMemoryBudget(jsi::Runtime& rt, double bytes);
+  void setCacheSize(jsi::Runtime& rt, double entries);
+  double trimMemory(jsi::Runtime& rt, double level);
+  void setUsageProfilePath(jsi::Runtime& rt, jsi::String path);
+  bool loadPatternBundle(jsi::Runtime& rt, jsi::String path);
+  std::optional<jsi::Object> loadGrammar(jsi::Runtime& rt, jsi::Object grammar);
+  jsi::Object
+  tokenizeLine(jsi::Runtime& rt, jsi::Object grammar, jsi::String line, std::optional<jsi::Object> ruleStack);
+  AsyncPromise<std::vector<double>> tokenizeLinesAsync(
+    jsi::Runtime& rt,
+    double requestId,
+    jsi::Object grammar,
+    jsi::Array lines,
+    std::optional<jsi::Object> ruleStack,
+    double priority
+  );
+  AsyncPromise<std::vector<double>> tokenizeLinesSliced(
+    jsi::Runtime& rt,
+    double requestId,
+    jsi::Object grammar,
+    jsi::Array lines,
+    std::optional<jsi::Object> ruleStack,
+    double sliceBudgetMs
+  );
+  jsi::Array takeRuleStacks(jsi::Runtime& rt, double requestId);
+  AsyncPromise<std::vector<double>> tokenizeSnippetsAsync(jsi::Runtime& rt, jsi::Array grammars, jsi::Array texts);
+
+ private:
+  OnigContext* lookupScanner(jsi::Runtime& rt, double scannerId);
+  // A scanner object, or {id} for a scanner from createScanner.
+  OnigContext* resolveScanner(jsi::Runtime& rt, const jsi::Object& scanner);
+  const std::shared_ptr<MatchPropNames>& matchPropNames(jsi::Runtime& rt);
+  // Runs the next slice of a findNextMatchesSliced or tokenizeLinesSliced
+  // request, and schedules the one after on the JS thread if there's more.
+  void runSlice(double requestId);
+
+  // Handles owned by this runtime. The compiled scanners behind them live in
+  // the process-wide scanner store and pattern cache, so a reload or a second
+  // React instance reuses them instead of compiling again.
+  std::unordered_map<double, OnigContext*> scanners_;
+  double nextScannerId_ = 1;
+  // Expires with the module; background work checks it before calling back.
+  std::shared_ptr<NativeShikiEngineModule*> self_;
+  // Shared with JS by getMatchBuffer; findNextMatchPacked writes into it.
+  std::shared_ptr<MatchBuffer> matchBuffer_;
+  // Created on first use; shared with the match results handed to JS.
+  std::shared_ptr<MatchPropNames> matchPropNames_;
+  // findNextMatchesAsync and tokenizeLinesAsync requests still running.
+  std::unordered_map<double, std::shared_ptr<ScheduledWork>> pendingRequests_;
+  // Sliced requests still running on the JS thread.
+  std::unordered_map<double, std::shared_ptr<SlicedRequest>> slicedRequests_;
+  // Finished tokenize requests whose rule stacks JS hasn't taken yet.
+  std::unordered_map<double, std::shared_ptr<TokenizeBatch>> tokenizedRequests_;
 };
 
 }  // namespace facebook::react
@@ -0,0 +1,72 @@
+#ifndef ONIG_ALLOC_HOOKS_H
+#define ONIG_ALLOC_HOOKS_H
+
+/*
+ * Allocation hooks compiled into Oniguruma by scripts/build-ios.sh and
+ * scripts/build-android.sh. Those scripts force-include this header into every
+ * Oniguruma source with ONIG_ALLOC_HOOKS_IMPLEMENTATION defined, routing the
+ * library's malloc/realloc/calloc/free through the installed hooks, and emit
+ * onig_build_config.h defining ONIG_BUILT_WITH_ALLOC_HOOKS next to
+ * oniguruma.h so the engine knows the bundled library supports them.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct OnigAllocHooks {
+  void* (*malloc_fn)(size_t size);
+  void* (*realloc_fn)(void* ptr, size_t size);
+  void* (*calloc_fn)(size_t count, size_t size);
+  void (*free_fn)(void* ptr);
+} OnigAllocHooks;
+
+/* Must be installed before Oniguruma allocates anything, i.e. before onig_initialize. */
+void shiki_onig_set_alloc_hooks(const OnigAllocHooks* hooks);
+
+#ifdef ONIG_ALLOC_HOOKS_IMPLEMENTATION
+
+/* Weak so every Oniguruma object file can carry a copy of the definitions. */
+__attribute__((weak)) const OnigAllocHooks* shiki_onig_alloc_hooks = NULL;
+
+__attribute__((weak)) void shiki_onig_set_alloc_hooks(const OnigAllocHooks* hooks) {
+  shiki_onig_alloc_hooks = hooks;
+}
+
+/* Parenthesized names call the C library directly, bypassing the macros below. */
+static inline void* shiki_onig_malloc(size_t size) {
+  return shiki_onig_alloc_hooks ? shiki_onig_alloc_hooks->malloc_fn(size) : (malloc)(size);
+}
+
+static inline void* shiki_onig_realloc(void* ptr, size_t size) {
+  return shiki_onig_alloc_hooks ? shiki_onig_alloc_hooks->realloc_fn(ptr, size) : (realloc)(ptr, size);
+}
+
+static inline void* shiki_onig_calloc(size_t count, size_t size) {
+  return shiki_onig_alloc_hooks ? shiki_onig_alloc_hooks->calloc_fn(count, size) : (calloc)(count, size);
+}
+
+static inline void shiki_onig_free(void* ptr) {
+  if (shiki_onig_alloc_hooks) {
+    shiki_onig_alloc_hooks->free_fn(ptr);
+  } else {
+    (free)(ptr);
+  }
+}
+
+/* Oniguruma's xmalloc/xrealloc/xcalloc/xfree expand to these names. */
+#  define malloc(size)        shiki_onig_malloc(size)
+#  define realloc(ptr, size)  shiki_onig_realloc(ptr, size)
+#  define calloc(count, size) shiki_onig_calloc(count, size)
+#  define free(ptr)           shiki_onig_free(ptr)
+
+#endif  // ONIG_ALLOC_HOOKS_IMPLEMENTATION
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ONIG_ALLOC_HOOKS_H
@@ -0,0 +1,24 @@
+#ifndef ONIG_CLOCK_HPP
+#define ONIG_CLOCK_HPP
+
+#include <time.h>
+
+#include <chrono>
+#include <cstdint>
+
+/** Monotonic seconds from the cheapest clock available. Cache expiry and
+ *  scanner recency only need second resolution and must not jump with
+ *  wall-clock changes. */
+inline int64_t coarse_monotonic_seconds() {
+#if defined(__APPLE__)
+  return static_cast<int64_t>(clock_gettime_nsec_np(CLOCK_MONOTONIC_RAW_APPROX) / 1000000000ULL);
+#elif defined(CLOCK_MONOTONIC_COARSE)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return static_cast<int64_t>(ts.tv_sec);
+#else
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#endif  // ONIG_CLOCK_HPP
@@ -1,27 +1,67 @@
 #ifndef ONIG_CONTEXT_HPP
 #define ONIG_CONTEXT_HPP
 
-#include <string>
-#include <unordered_map>
-#include <unordered_set>
-#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <string_view>
 
+#include "onig_pattern_analysis.hpp"
+#include "onig_pattern_cache.hpp"
 #include "onig_regex.h"
-#include "oniguruma.h"
 
-struct CachedPattern {
-  regex_t* regex;
-  time_t last_used;
-  size_t memory_size;
-};
+struct SearchRegions;
+
+// Scans a scanner's patterns for the leftmost match from start_pos, leaving it
+// in regions->best. Returns the winning pattern index, or -1.
+using ScanKernel = int (*)(
+  OnigContext* context,
+  const char* text,
+  int text_length,
+  int start_pos,
+  SearchRegions* regions,
+  bool* compiled
+);
 
+// A scanner is a single allocation: the OnigContext, this struct, then the
+// per-pattern arrays below, laid out as structure-of-arrays in the order a
+// search reads them. Searches walk contiguous memory and free_scanner is one
+// free. The arrays are sized at creation and never reallocated.
 struct OnigContextImpl {
-  std::unordered_map<std::string, CachedPattern> pattern_cache;
-  std::unordered_set<regex_t*> active_regexes;
+  // Searches hold this shared; hibernation and rehydration hold it exclusively.
+  std::shared_mutex lock;
+  std::atomic<int> compiled_patterns{0};
+  bool lazy = false;
+  std::atomic<bool> hibernated{false};
+  std::atomic<int64_t> last_used{0};
+  // Picked for the pattern count when the scanner is created.
+  ScanKernel scan = nullptr;
+
+  // Prefilter facts per pattern, from the pattern bundle or pattern_analyze.
+  uint8_t* anchors = nullptr;
+  uint8_t* literal_lengths = nullptr;
+  // Compiled regex per pattern, published once its cache entry is; nullptr
+  // while hibernated, and until first reached by a search in a lazy scanner.
+  std::atomic<regex_t*>* regexes = nullptr;
+  // Shared cache entries owning regexes, kept to release them.
+  std::atomic<CachedPattern*>* patterns = nullptr;
+  char (*literals)[PATTERN_LITERAL_MAX] = nullptr;
+  // Pattern sources, kept so a hibernated scanner can be recompiled on
+  // demand: source i spans [source_offsets[i], source_offsets[i + 1]).
+  uint32_t* source_offsets = nullptr;
+  char* source_bytes = nullptr;
 };
 
-inline size_t estimate_pattern_memory(const char* pattern, const regex_t* regex) {
-  return strlen(pattern) + 1024;
+inline std::string_view scanner_source(const OnigContext* context, int index) {
+  const OnigContextImpl* impl = context->impl;
+  return std::string_view(
+    impl->source_bytes + impl->source_offsets[index],
+    impl->source_offsets[index + 1] - impl->source_offsets[index]
+  );
 }
 
+/** Drops the scanner's compiled patterns, keeping its sources. The next search
+ *  recompiles them. Caller holds impl->lock exclusively. */
+void scanner_hibernate_locked(OnigContext* context);
+
 #endif  // ONIG_CONTEXT_HPP
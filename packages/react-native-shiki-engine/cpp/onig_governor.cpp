@@ -0,0 +1,117 @@
+#include "onig_governor.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "onig_clock.hpp"
+#include "onig_context.hpp"
+
+struct GovernorState {
+  std::mutex mutex;
+  std::unordered_set<OnigContext*> scanners;
+  std::atomic<size_t> budget{CACHE_MEMORY_LIMIT};
+  unsigned long long hibernations = 0;
+};
+
+/** Intentionally leaked, like the pattern cache, so late frees stay valid. */
+static GovernorState& governor_state() {
+  static GovernorState* state = new GovernorState();
+  return *state;
+}
+
+/** Hibernates candidates oldest first until should_stop() holds. Scanners in
+ *  the middle of a search are skipped rather than waited on. */
+template <typename ShouldStop>
+static void hibernate_lru_locked(
+  GovernorState& state,
+  OnigContext* active,
+  int64_t idle_before,
+  ShouldStop should_stop
+) {
+  std::vector<std::pair<int64_t, OnigContext*>> candidates;
+  candidates.reserve(state.scanners.size());
+  for (OnigContext* context : state.scanners) {
+    const int64_t last_used = context->impl->last_used.load(std::memory_order_relaxed);
+    if (context != active && !context->impl->hibernated.load(std::memory_order_relaxed) && last_used < idle_before) {
+      candidates.emplace_back(last_used, context);
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  for (const auto& candidate : candidates) {
+    if (should_stop()) {
+      break;
+    }
+
+    OnigContextImpl* impl = candidate.second->impl;
+    std::unique_lock<std::shared_mutex> lock(impl->lock, std::try_to_lock);
+    if (lock.owns_lock() && !impl->hibernated.load(std::memory_order_relaxed)) {
+      scanner_hibernate_locked(candidate.second);
+      state.hibernations++;
+    }
+  }
+}
+
+void governor_register(OnigContext* context) {
+  GovernorState& state = governor_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.scanners.insert(context);
+}
+
+void governor_unregister(OnigContext* context) {
+  GovernorState& state = governor_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.scanners.erase(context);
+}
+
+void governor_enforce(OnigContext* active) {
+  GovernorState& state = governor_state();
+  if (pattern_cache_memory_usage() <= state.budget.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(state.mutex);
+  hibernate_lru_locked(state, active, INT64_MAX, [&state] {
+    return pattern_cache_memory_usage() <= state.budget.load(std::memory_order_relaxed);
+  });
+}
+
+size_t governor_trim(int level) {
+  GovernorState& state = governor_state();
+  const size_t before = pattern_cache_memory_usage();
+
+  if (level >= ONIG_TRIM_IDLE_SCANNERS) {
+    const int64_t idle_before = level >= ONIG_TRIM_ALL ? INT64_MAX : coarse_monotonic_seconds() - SCANNER_IDLE_SECONDS;
+    std::lock_guard<std::mutex> lock(state.mutex);
+    hibernate_lru_locked(state, nullptr, idle_before, [] { return false; });
+  }
+  pattern_cache_trim();
+
+  const size_t after = pattern_cache_memory_usage();
+  return before > after ? before - after : 0;
+}
+
+void governor_set_budget(size_t bytes) {
+  governor_state().budget.store(bytes, std::memory_order_relaxed);
+  pattern_cache_set_memory_limit(bytes);
+  governor_enforce(nullptr);
+}
+
+void governor_get_stats(OnigCacheStats* stats) {
+  GovernorState& state = governor_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  stats->memory_budget = state.budget.load(std::memory_order_relaxed);
+  stats->scanners = state.scanners.size();
+  stats->hibernated_scanners = 0;
+  for (OnigContext* context : state.scanners) {
+    if (context->impl->hibernated.load(std::memory_order_relaxed)) {
+      stats->hibernated_scanners++;
+    }
+  }
+  stats->hibernations = state.hibernations;
+}
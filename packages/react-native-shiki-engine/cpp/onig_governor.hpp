@@ -0,0 +1,26 @@
+#ifndef ONIG_GOVERNOR_HPP
+#define ONIG_GOVERNOR_HPP
+
+#include <cstddef>
+
+#include "onig_regex.h"
+
+// Process-wide memory budget across every live scanner. Compiled patterns no
+// scanner uses are evicted by the pattern cache first; when referenced
+// patterns alone exceed the budget, the least recently used scanners are
+// hibernated until usage fits again.
+
+void governor_register(OnigContext* context);
+void governor_unregister(OnigContext* context);
+
+/** Brings compiled-pattern memory back under budget. Never hibernates active. */
+void governor_enforce(OnigContext* active);
+
+/** Frees memory according to level (OnigTrimLevel). Returns bytes released. */
+size_t governor_trim(int level);
+
+void governor_set_budget(size_t bytes);
+
+void governor_get_stats(OnigCacheStats* stats);
+
+#endif  // ONIG_GOVERNOR_HPP
@@ -0,0 +1,696 @@
+#include "onig_grammar.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "onig_scanner_store.hpp"
+
+// Stands for the end (or while) pattern in a rule's scanner.
+static constexpr int END_RULE_ID = -1;
+// Scanners for resolved back-references kept before they are all released.
+static constexpr size_t MAX_RESOLVED_SCANNERS = 64;
+// U+FFFF, which never occurs in text; replaces a missing end pattern and
+// anchors that can't match at the current position, as vscode-textmate does.
+static const char* const NEVER_MATCHES = "\xEF\xBF\xBF";
+
+enum GrammarRuleKind {
+  RULE_INCLUDE_ONLY,
+  RULE_MATCH,
+  RULE_BEGIN_END,
+  RULE_BEGIN_WHILE,
+};
+
+// Scope IDs for each capture group, empty for groups without a name.
+using CaptureScopes = std::vector<std::vector<int>>;
+
+struct GrammarRule {
+  GrammarRuleKind kind = RULE_INCLUDE_ONLY;
+  std::vector<int> name;
+  std::vector<int> content_name;
+  // match, or begin.
+  std::string match;
+  // end, or while.
+  std::string end;
+  bool end_has_back_references = false;
+  bool apply_end_pattern_last = false;
+  // captures, or beginCaptures.
+  CaptureScopes captures;
+  // endCaptures, or whileCaptures.
+  CaptureScopes end_captures;
+  std::vector<int> patterns;
+  // Some of patterns were dropped, e.g. includes of other grammars.
+  bool has_missing_patterns = false;
+
+  // The scanner for the patterns that can match inside this rule, built on
+  // first use under Grammar::mutex_: its sources and the rule each one
+  // belongs to. Both are fixed once collected is set.
+  bool collected = false;
+  std::vector<std::string> scanner_sources;
+  std::vector<int> scanner_rules;
+  // Indexed by [allow_a][allow_g]. Published with release ordering after
+  // scanner_rules, so a thread that sees a scanner can read its rules.
+  std::atomic<OnigContext*> scanners[2][2] = {};
+  std::atomic<OnigContext*> while_scanners[2][2] = {};
+};
+
+struct GrammarScope {
+  std::shared_ptr<const GrammarScope> parent;
+  int id;
+};
+
+using ScopePath = std::shared_ptr<const GrammarScope>;
+
+struct GrammarStateFrame {
+  GrammarState parent;
+  int rule_id;
+  // Only meaningful on the line that pushed the frame; see enter_pos.
+  int enter_pos;
+  int anchor_pos;
+  uint64_t line_serial;
+  bool begin_captured_eol;
+  // The end or while pattern with the begin match's back-references filled
+  // in, for rules whose pattern has them.
+  bool has_resolved_end;
+  std::string resolved_end;
+  ScopePath name_scopes;
+  ScopePath content_scopes;
+};
+
+struct Grammar::RepositoryScope {
+  const std::vector<GrammarRuleSource>* rules;
+  const RepositoryScope* parent;
+};
+
+static int enter_pos(const GrammarStateFrame& frame, uint64_t line_serial) {
+  return frame.line_serial == line_serial ? frame.enter_pos : -1;
+}
+
+static int anchor_pos(const GrammarStateFrame& frame, uint64_t line_serial) {
+  return frame.line_serial == line_serial ? frame.anchor_pos : -1;
+}
+
+static ScopePath push_scopes(ScopePath path, const std::vector<int>& ids) {
+  for (const int id : ids) {
+    path = std::make_shared<const GrammarScope>(GrammarScope{std::move(path), id});
+  }
+  return path;
+}
+
+static GrammarState with_content_scopes(const GrammarState& frame, ScopePath content_scopes) {
+  auto copy = std::make_shared<GrammarStateFrame>(*frame);
+  copy->content_scopes = std::move(content_scopes);
+  return copy;
+}
+
+/** True if frame's rule was already entered at the same position, i.e. pushing
+ *  it again would loop without consuming input. */
+static bool has_same_rule(const GrammarState& stack, const GrammarStateFrame& frame, uint64_t line_serial) {
+  const int position = enter_pos(frame, line_serial);
+  for (const GrammarStateFrame* f = stack.get(); f && enter_pos(*f, line_serial) == position; f = f->parent.get()) {
+    if (f->rule_id == frame.rule_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool has_back_references(const std::string& source) {
+  for (size_t i = 0; i + 1 < source.size(); i++) {
+    if (source[i] == '\\' && source[i + 1] >= '0' && source[i + 1] <= '9') {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void append_escaped(std::string* out, const std::string& text) {
+  for (const char c : text) {
+    if (strchr("-\\{}*+?|^$.,[]()# \t\n\r\f\v", c) && c != '\0') {
+      *out += '\\';
+    }
+    *out += c;
+  }
+}
+
+// Replaces \N in an end or while pattern with the text group N of the begin
+// match captured, escaped.
+static std::string
+resolve_back_references(const std::string& source, const std::string& text, const OnigResult& begin) {
+  std::string resolved;
+  for (size_t i = 0; i < source.size(); i++) {
+    if (source[i] != '\\' || i + 1 >= source.size() || source[i + 1] < '0' || source[i + 1] > '9') {
+      resolved += source[i];
+      continue;
+    }
+
+    int group = 0;
+    size_t j = i + 1;
+    for (; j < source.size() && source[j] >= '0' && source[j] <= '9'; j++) {
+      group = group * 10 + (source[j] - '0');
+    }
+    if (group < begin.capture_count && begin.capture_indices[group * 2] >= 0) {
+      const int start = begin.capture_indices[group * 2];
+      append_escaped(&resolved, text.substr(start, begin.capture_indices[group * 2 + 1] - start));
+    }
+    i = j - 1;
+  }
+  return resolved;
+}
+
+// Disables \A and \G where they can't match: \A past the first line, \G away
+// from the end of the last begin or while match.
+static std::string with_anchors(const std::string& source, bool allow_a, bool allow_g) {
+  std::string out;
+  out.reserve(source.size());
+  for (size_t i = 0; i < source.size(); i++) {
+    if (source[i] == '\\' && i + 1 < source.size()) {
+      const char next = source[i + 1];
+      if ((next == 'A' && !allow_a) || (next == 'G' && !allow_g)) {
+        out += NEVER_MATCHES;
+      } else {
+        out += source[i];
+        out += next;
+      }
+      i++;
+      continue;
+    }
+    out += source[i];
+  }
+  return out;
+}
+
+/** Holds a scanner for sources, with \A and \G disabled as the flags say.
+ *  nullptr when there are no sources or the scanner can't be created. */
+static OnigContext* acquire_scanner(const std::vector<std::string>& sources, bool allow_a, bool allow_g) {
+  if (sources.empty()) {
+    return nullptr;
+  }
+  std::vector<std::string> anchored;
+  anchored.reserve(sources.size());
+  for (const auto& source : sources) {
+    anchored.push_back(with_anchors(source, allow_a, allow_g));
+  }
+  // Lazy, so a grammar pattern Oniguruma rejects only ever fails to match.
+  return scanner_store_acquire(anchored, MAX_CACHE_SIZE, ONIG_SCANNER_LAZY);
+}
+
+using MatchPtr = std::unique_ptr<OnigResult, void (*)(OnigResult*)>;
+
+static MatchPtr search(const std::shared_ptr<OnigContext>& scanner, const std::string& text, int position) {
+  return MatchPtr(scanner ? find_next_match(scanner.get(), text.c_str(), position) : nullptr, free_result);
+}
+
+/** A ScannerRef that doesn't own scanner. */
+static std::shared_ptr<OnigContext> borrowed(OnigContext* scanner) {
+  return std::shared_ptr<OnigContext>(std::shared_ptr<OnigContext>(), scanner);
+}
+
+/** A ScannerRef that releases scanner's store handle with its last copy. */
+static std::shared_ptr<OnigContext> owned(OnigContext* scanner) {
+  if (!scanner) {
+    return nullptr;
+  }
+  return std::shared_ptr<OnigContext>(scanner, [](OnigContext* context) { scanner_store_release(context); });
+}
+
+// Collects a line's tokens, each running from the end of the previous one.
+class LineTokens {
+ public:
+  explicit LineTokens(std::vector<GrammarToken>* tokens) : tokens_(tokens) {
+    tokens_->clear();
+  }
+
+  void produce(const ScopePath& scopes, int end) {
+    if (last_end_ >= end) {
+      return;
+    }
+    GrammarToken token{last_end_, end, {}};
+    for (const GrammarScope* scope = scopes.get(); scope; scope = scope->parent.get()) {
+      token.scopes.push_back(scope->id);
+    }
+    std::reverse(token.scopes.begin(), token.scopes.end());
+    tokens_->push_back(std::move(token));
+    last_end_ = end;
+  }
+
+  void finish(const ScopePath& scopes, int length) {
+    // The token covering just the appended "\n" is dropped.
+    if (!tokens_->empty() && tokens_->back().start == length - 1) {
+      tokens_->pop_back();
+    }
+    if (tokens_->empty()) {
+      last_end_ = -1;
+      produce(scopes, length);
+      tokens_->back().start = 0;
+    }
+  }
+
+ private:
+  std::vector<GrammarToken>* tokens_;
+  int last_end_ = 0;
+};
+
+// Emits tokens for a match's named capture groups, nesting groups that lie
+// inside earlier ones.
+static void handle_captures(
+  const ScopePath& scopes,
+  const CaptureScopes& captures,
+  const OnigResult& match,
+  LineTokens* tokens
+) {
+  if (captures.empty()) {
+    return;
+  }
+
+  const int* indices = match.capture_indices;
+  const int max_end = indices[1];
+  // Groups still open, innermost last, with where each ends.
+  std::vector<std::pair<ScopePath, int>> open;
+  const int count = std::min(static_cast<int>(captures.size()), match.capture_count);
+  for (int i = 0; i < count; i++) {
+    const int start = indices[i * 2];
+    const int end = indices[i * 2 + 1];
+    if (captures[i].empty() || end - start == 0) {
+      continue;
+    }
+    if (start > max_end) {
+      break;
+    }
+
+    while (!open.empty() && open.back().second <= start) {
+      tokens->produce(open.back().first, open.back().second);
+      open.pop_back();
+    }
+    const ScopePath& base = open.empty() ? scopes : open.back().first;
+    tokens->produce(base, start);
+    open.emplace_back(push_scopes(base, captures[i]), end);
+  }
+
+  while (!open.empty()) {
+    tokens->produce(open.back().first, open.back().second);
+    open.pop_back();
+  }
+}
+
+Grammar::Grammar(const GrammarSource& source) {
+  // The root rule is $self: the grammar's top-level patterns, named after
+  // its scope.
+  rules_.push_back(std::make_unique<GrammarRule>());
+  root_scopes_ = push_scopes(nullptr, intern_scopes(source.scope_name));
+
+  const RepositoryScope repository{&source.repository, nullptr};
+  std::vector<int> patterns;
+  compile_patterns(source.patterns, &repository, &patterns);
+  rules_[root_rule_]->patterns = std::move(patterns);
+  rule_ids_.clear();
+}
+
+Grammar::~Grammar() {
+  for (const auto& rule : rules_) {
+    for (int a = 0; a < 2; a++) {
+      for (int g = 0; g < 2; g++) {
+        if (OnigContext* scanner = rule->scanners[a][g].load()) {
+          scanner_store_release(scanner);
+        }
+        if (OnigContext* scanner = rule->while_scanners[a][g].load()) {
+          scanner_store_release(scanner);
+        }
+      }
+    }
+  }
+}
+
+std::vector<int> Grammar::intern_scopes(const std::string& name) {
+  // "a.b c.d" pushes two scopes.
+  std::vector<int> ids;
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t end = name.find(' ', start);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    if (end > start) {
+      const std::string scope = name.substr(start, end - start);
+      auto it = scope_ids_.find(scope);
+      if (it == scope_ids_.end()) {
+        it = scope_ids_.emplace(scope, static_cast<int>(scope_names_.size())).first;
+        scope_names_.push_back(scope);
+      }
+      ids.push_back(it->second);
+    }
+    start = end + 1;
+  }
+  return ids;
+}
+
+CaptureScopes Grammar::compile_captures(const std::vector<GrammarCaptureSource>& captures) {
+  CaptureScopes scopes;
+  for (const auto& capture : captures) {
+    if (capture.index < 0) {
+      continue;
+    }
+    if (static_cast<size_t>(capture.index) >= scopes.size()) {
+      scopes.resize(capture.index + 1);
+    }
+    scopes[capture.index] = intern_scopes(capture.name);
+  }
+  return scopes;
+}
+
+int Grammar::compile_rule(const GrammarRuleSource& source, const RepositoryScope* repository) {
+  auto it = rule_ids_.find(&source);
+  if (it != rule_ids_.end()) {
+    return it->second;
+  }
+
+  // The ID is taken before compiling patterns, which may include this rule.
+  const int id = static_cast<int>(rules_.size());
+  rules_.push_back(std::make_unique<GrammarRule>());
+  rule_ids_.emplace(&source, id);
+  GrammarRule* rule = rules_[id].get();
+
+  const RepositoryScope scope{&source.repository, repository};
+  if (!source.repository.empty()) {
+    repository = &scope;
+  }
+
+  rule->name = intern_scopes(source.name);
+  rule->content_name = intern_scopes(source.content_name);
+  const auto& captures = source.captures;
+  if (!source.match.empty()) {
+    rule->kind = RULE_MATCH;
+    rule->match = source.match;
+    rule->captures = compile_captures(captures);
+    return id;
+  }
+
+  if (source.begin.empty()) {
+    rule->kind = RULE_INCLUDE_ONLY;
+    std::vector<int> patterns;
+    if (source.patterns.empty() && !source.include.empty()) {
+      // A repository entry that is just an include.
+      GrammarRuleSource include;
+      include.include = source.include;
+      rule->has_missing_patterns = compile_patterns({include}, repository, &patterns);
+    } else {
+      rule->has_missing_patterns = compile_patterns(source.patterns, repository, &patterns);
+    }
+    rule->patterns = std::move(patterns);
+    return id;
+  }
+
+  rule->match = source.begin;
+  rule->captures = compile_captures(source.begin_captures.empty() ? captures : source.begin_captures);
+  if (!source.while_.empty()) {
+    rule->kind = RULE_BEGIN_WHILE;
+    rule->end = source.while_;
+    rule->end_captures = compile_captures(source.while_captures.empty() ? captures : source.while_captures);
+  } else {
+    rule->kind = RULE_BEGIN_END;
+    rule->end = source.end.empty() ? NEVER_MATCHES : source.end;
+    rule->end_captures = compile_captures(source.end_captures.empty() ? captures : source.end_captures);
+    rule->apply_end_pattern_last = source.apply_end_pattern_last;
+  }
+  rule->end_has_back_references = has_back_references(rule->end);
+
+  std::vector<int> patterns;
+  rule->has_missing_patterns = compile_patterns(source.patterns, repository, &patterns);
+  rule->patterns = std::move(patterns);
+  return id;
+}
+
+bool Grammar::compile_patterns(
+  const std::vector<GrammarRuleSource>& patterns,
+  const RepositoryScope* repository,
+  std::vector<int>* rule_ids
+) {
+  const size_t first = rule_ids->size();
+  for (const auto& pattern : patterns) {
+    int rule_id = -1;
+    if (pattern.include.empty()) {
+      rule_id = compile_rule(pattern, repository);
+    } else if (pattern.include == "$self" || pattern.include == "$base") {
+      rule_id = root_rule_;
+    } else if (pattern.include[0] == '#') {
+      // Inner repositories shadow outer ones.
+      const std::string key = pattern.include.substr(1);
+      for (const RepositoryScope* scope = repository; scope && rule_id < 0; scope = scope->parent) {
+        auto it = std::find_if(scope->rules->begin(), scope->rules->end(), [&](const GrammarRuleSource& rule) {
+          return rule.key == key;
+        });
+        if (it != scope->rules->end()) {
+          rule_id = compile_rule(*it, repository);
+        }
+      }
+    }
+    // Otherwise another grammar, which this tokenizer can't reach.
+    if (rule_id < 0) {
+      continue;
+    }
+
+    // Like vscode-textmate, drop a rule that is left with no patterns because
+    // all of its own were missing, e.g. a fenced code block of an embedded
+    // language that isn't loaded. A rule still being compiled (a cycle) has
+    // no patterns yet but isn't missing any, so it stays.
+    const GrammarRule& rule = *rules_[rule_id];
+    if (rule.kind != RULE_MATCH && rule.has_missing_patterns && rule.patterns.empty()) {
+      continue;
+    }
+    rule_ids->push_back(rule_id);
+  }
+  return rule_ids->size() - first != patterns.size();
+}
+
+void Grammar::collect_patterns(int rule_id, GrammarRule* scanner_rule, std::vector<bool>* visited) const {
+  const GrammarRule& rule = *rules_[rule_id];
+  if (rule.kind != RULE_INCLUDE_ONLY) {
+    scanner_rule->scanner_sources.push_back(rule.match);
+    scanner_rule->scanner_rules.push_back(rule_id);
+    return;
+  }
+
+  // Include-only rules are flattened into their patterns. One reached twice
+  // adds nothing, as its first copy always wins, and cycles end here.
+  if ((*visited)[rule_id]) {
+    return;
+  }
+  (*visited)[rule_id] = true;
+  for (const int pattern : rule.patterns) {
+    collect_patterns(pattern, scanner_rule, visited);
+  }
+}
+
+Grammar::ScannerRef
+Grammar::resolved_scanner_locked(const std::vector<std::string>& sources, bool allow_a, bool allow_g) {
+  std::string key;
+  key += allow_a ? 'A' : '-';
+  key += allow_g ? 'G' : '-';
+  for (const auto& source : sources) {
+    key += '\0';
+    key += source;
+  }
+
+  auto it = resolved_scanners_.find(key);
+  if (it != resolved_scanners_.end()) {
+    return it->second;
+  }
+  if (resolved_scanners_.size() >= MAX_RESOLVED_SCANNERS) {
+    // Searches still using one keep their own reference.
+    resolved_scanners_.clear();
+  }
+  ScannerRef scanner = owned(acquire_scanner(sources, allow_a, allow_g));
+  resolved_scanners_.emplace(std::move(key), scanner);
+  return scanner;
+}
+
+Grammar::ScannerRef Grammar::scanner_for(const GrammarStateFrame& frame, bool allow_a, bool allow_g) {
+  GrammarRule& rule = *rules_[frame.rule_id];
+  const bool resolved = frame.has_resolved_end && rule.kind == RULE_BEGIN_END;
+  if (!resolved) {
+    if (OnigContext* scanner = rule.scanners[allow_a][allow_g].load(std::memory_order_acquire)) {
+      return borrowed(scanner);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!rule.collected) {
+    const bool has_end = rule.kind == RULE_BEGIN_END;
+    if (has_end && !rule.apply_end_pattern_last) {
+      rule.scanner_sources.push_back(rule.end);
+      rule.scanner_rules.push_back(END_RULE_ID);
+    }
+    std::vector<bool> visited(rules_.size());
+    for (const int pattern : rule.patterns) {
+      collect_patterns(pattern, &rule, &visited);
+    }
+    if (has_end && rule.apply_end_pattern_last) {
+      rule.scanner_sources.push_back(rule.end);
+      rule.scanner_rules.push_back(END_RULE_ID);
+    }
+    rule.collected = true;
+  }
+
+  if (resolved) {
+    std::vector<std::string> sources = rule.scanner_sources;
+    const auto end = std::find(rule.scanner_rules.begin(), rule.scanner_rules.end(), END_RULE_ID);
+    sources[end - rule.scanner_rules.begin()] = frame.resolved_end;
+    return resolved_scanner_locked(sources, allow_a, allow_g);
+  }
+
+  // Another thread may have built it since the check above.
+  OnigContext* scanner = rule.scanners[allow_a][allow_g].load(std::memory_order_relaxed);
+  if (!scanner) {
+    scanner = acquire_scanner(rule.scanner_sources, allow_a, allow_g);
+    rule.scanners[allow_a][allow_g].store(scanner, std::memory_order_release);
+  }
+  return borrowed(scanner);
+}
+
+Grammar::ScannerRef Grammar::while_scanner_for(const GrammarStateFrame& frame, bool allow_a, bool allow_g) {
+  GrammarRule& rule = *rules_[frame.rule_id];
+  if (!frame.has_resolved_end) {
+    if (OnigContext* scanner = rule.while_scanners[allow_a][allow_g].load(std::memory_order_acquire)) {
+      return borrowed(scanner);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (frame.has_resolved_end) {
+    return resolved_scanner_locked({frame.resolved_end}, allow_a, allow_g);
+  }
+  OnigContext* scanner = rule.while_scanners[allow_a][allow_g].load(std::memory_order_relaxed);
+  if (!scanner) {
+    scanner = acquire_scanner({rule.end}, allow_a, allow_g);
+    rule.while_scanners[allow_a][allow_g].store(scanner, std::memory_order_release);
+  }
+  return borrowed(scanner);
+}
+
+GrammarState
+Grammar::tokenize_line(const std::string& line, const GrammarState& state, std::vector<GrammarToken>* tokens) {
+  const uint64_t serial = ++line_serial_;
+  const std::string text = line + "\n";
+  const int length = static_cast<int>(text.size());
+  LineTokens out(tokens);
+
+  GrammarState stack = state;
+  // Frames index rules_, so a state some other grammar produced would read
+  // past it; start the document over instead.
+  for (GrammarState frame = stack; frame; frame = frame->parent) {
+    if (frame->rule_id < 0 || frame->rule_id >= static_cast<int>(rules_.size())) {
+      stack = nullptr;
+      break;
+    }
+  }
+  bool first_line = !stack;
+  if (!stack) {
+    stack = std::make_shared<const GrammarStateFrame>(
+      GrammarStateFrame{nullptr, root_rule_, -1, -1, serial, false, false, {}, root_scopes_, root_scopes_}
+    );
+  }
+  int position = 0;
+  int anchor = stack->begin_captured_eol ? 0 : -1;
+
+  // Begin/while rules last only while their while pattern keeps matching at
+  // the start of each line, checked outermost first.
+  std::vector<GrammarState> while_frames;
+  for (GrammarState frame = stack; frame; frame = frame->parent) {
+    if (rules_[frame->rule_id]->kind == RULE_BEGIN_WHILE) {
+      while_frames.push_back(frame);
+    }
+  }
+  for (auto it = while_frames.rbegin(); it != while_frames.rend(); ++it) {
+    const GrammarState& frame = *it;
+    MatchPtr match = search(while_scanner_for(*frame, first_line, position == anchor), text, position);
+    if (!match) {
+      stack = frame->parent;
+      break;
+    }
+
+    const int end = match->capture_indices[1];
+    out.produce(frame->content_scopes, match->capture_indices[0]);
+    handle_captures(frame->content_scopes, rules_[frame->rule_id]->end_captures, *match, &out);
+    out.produce(frame->content_scopes, end);
+    anchor = end;
+    if (end > position) {
+      position = end;
+      first_line = false;
+    }
+  }
+
+  for (;;) {
+    MatchPtr match = search(scanner_for(*stack, first_line, position == anchor), text, position);
+    if (!match) {
+      out.produce(stack->content_scopes, length);
+      break;
+    }
+
+    const int start = match->capture_indices[0];
+    const int end = match->capture_indices[1];
+    const bool advanced = end > position;
+    const int matched = rules_[stack->rule_id]->scanner_rules[match->pattern_index];
+
+    if (matched == END_RULE_ID) {
+      out.produce(stack->content_scopes, start);
+      const GrammarState popped = with_content_scopes(stack, stack->name_scopes);
+      handle_captures(popped->content_scopes, rules_[popped->rule_id]->end_captures, *match, &out);
+      out.produce(popped->content_scopes, end);
+      stack = popped->parent;
+      anchor = anchor_pos(*popped, serial);
+
+      // The rule was entered and left without consuming anything.
+      if (!advanced && enter_pos(*popped, serial) == position) {
+        stack = popped;
+        out.produce(stack->content_scopes, length);
+        break;
+      }
+    } else {
+      const GrammarRule& rule = *rules_[matched];
+      out.produce(stack->content_scopes, start);
+      const ScopePath name_scopes = push_scopes(stack->content_scopes, rule.name);
+      handle_captures(name_scopes, rule.captures, *match, &out);
+      out.produce(name_scopes, end);
+
+      if (rule.kind == RULE_MATCH) {
+        // A match that consumes nothing would repeat forever.
+        if (!advanced) {
+          if (stack->parent) {
+            stack = stack->parent;
+          }
+          out.produce(stack->content_scopes, length);
+          break;
+        }
+      } else {
+        const bool resolve = rule.end_has_back_references;
+        auto frame = std::make_shared<const GrammarStateFrame>(GrammarStateFrame{
+          stack,
+          matched,
+          position,
+          anchor,
+          serial,
+          end == length,
+          resolve,
+          resolve ? resolve_back_references(rule.end, text, *match) : std::string(),
+          name_scopes,
+          push_scopes(name_scopes, rule.content_name),
+        });
+        anchor = end;
+
+        // Entering a rule already entered here without consuming anything.
+        if (!advanced && has_same_rule(stack, *frame, serial)) {
+          out.produce(stack->content_scopes, length);
+          break;
+        }
+        stack = std::move(frame);
+      }
+    }
+
+    if (end > position) {
+      position = end;
+      first_line = false;
+    }
+  }
+
+  out.finish(stack->content_scopes, length);
+  return stack;
+}
@@ -0,0 +1,135 @@
+#ifndef ONIG_GRAMMAR_HPP
+#define ONIG_GRAMMAR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "onig_regex.h"
+
+// Native TextMate tokenizer. Runs vscode-textmate's line state machine over a
+// grammar's begin/end, begin/while and match rules, searching with the rule
+// scanners directly instead of crossing to JS for every match.
+//
+// Supported: repository includes (#name, $self, $base), nested repositories,
+// captures/beginCaptures/endCaptures/whileCaptures, contentName,
+// applyEndPatternLast, back-references in end and while patterns, and the \A
+// and \G anchor rules. Not supported: includes of other grammars, injections,
+// patterns nested in captures, and $n references in scope names, which are
+// kept as written. Includes of other grammars are dropped the way
+// vscode-textmate drops them when the other grammar isn't loaded, along with
+// any rule left with no patterns by it.
+
+// A rule as it appears in the grammar JSON.
+struct GrammarCaptureSource {
+  int index = 0;
+  std::string name;
+};
+
+struct GrammarRuleSource {
+  // Name in the enclosing repository, for repository entries.
+  std::string key;
+  std::string include;
+  std::string name;
+  std::string content_name;
+  std::string match;
+  std::string begin;
+  std::string end;
+  std::string while_;
+  bool apply_end_pattern_last = false;
+  std::vector<GrammarCaptureSource> captures;
+  std::vector<GrammarCaptureSource> begin_captures;
+  std::vector<GrammarCaptureSource> end_captures;
+  std::vector<GrammarCaptureSource> while_captures;
+  std::vector<GrammarRuleSource> patterns;
+  std::vector<GrammarRuleSource> repository;
+};
+
+struct GrammarSource {
+  std::string scope_name;
+  std::vector<GrammarRuleSource> patterns;
+  std::vector<GrammarRuleSource> repository;
+};
+
+struct GrammarRule;
+struct GrammarScope;
+struct GrammarStateFrame;
+
+// The rule stack at the end of a line, passed back in to tokenize the next
+// one. Immutable, so lines can share their common frames.
+using GrammarState = std::shared_ptr<const GrammarStateFrame>;
+
+struct GrammarToken {
+  // Byte offsets into the line.
+  int start;
+  int end;
+  // Scope IDs, outermost first.
+  std::vector<int> scopes;
+};
+
+class Grammar {
+ public:
+  explicit Grammar(const GrammarSource& source);
+  ~Grammar();
+
+  Grammar(const Grammar&) = delete;
+  Grammar& operator=(const Grammar&) = delete;
+
+  /** Tokenizes one UTF-8 line without its line break, continuing from state,
+   *  or from the start of the document when state is null. Token offsets run
+   *  up to line.size() + 1, as the tokenizer searches the line with a "\n"
+   *  appended. Returns the state at the end of the line. A state whose rules
+   *  don't exist in this grammar is treated as null. Safe to call from several
+   *  threads at once, e.g. to tokenize different documents in parallel. */
+  GrammarState tokenize_line(const std::string& line, const GrammarState& state, std::vector<GrammarToken>* tokens);
+
+  /** Every scope name a token can carry, indexed by scope ID. */
+  const std::vector<std::string>& scope_names() const {
+    return scope_names_;
+  }
+
+ private:
+  struct RepositoryScope;
+
+  int compile_rule(const GrammarRuleSource& source, const RepositoryScope* repository);
+  // Returns true if any of patterns was dropped.
+  bool compile_patterns(
+    const std::vector<GrammarRuleSource>& patterns,
+    const RepositoryScope* repository,
+    std::vector<int>* rule_ids
+  );
+  std::vector<int> intern_scopes(const std::string& name);
+  std::vector<std::vector<int>> compile_captures(const std::vector<GrammarCaptureSource>& captures);
+
+  // A scanner for one search. Owns a handle only for resolved scanners, which
+  // another thread may evict meanwhile; rule scanners live as long as the grammar.
+  using ScannerRef = std::shared_ptr<OnigContext>;
+
+  void collect_patterns(int rule_id, GrammarRule* scanner_rule, std::vector<bool>* visited) const;
+  ScannerRef scanner_for(const GrammarStateFrame& frame, bool allow_a, bool allow_g);
+  ScannerRef while_scanner_for(const GrammarStateFrame& frame, bool allow_a, bool allow_g);
+  ScannerRef resolved_scanner_locked(const std::vector<std::string>& sources, bool allow_a, bool allow_g);
+
+  std::vector<std::unique_ptr<GrammarRule>> rules_;
+  // Source rule -> rule ID, while the constructor compiles the grammar.
+  std::unordered_map<const GrammarRuleSource*, int> rule_ids_;
+  int root_rule_ = 0;
+
+  std::vector<std::string> scope_names_;
+  std::unordered_map<std::string, int> scope_ids_;
+  std::shared_ptr<const GrammarScope> root_scopes_;
+
+  // Guards building rule scanners and resolved_scanners_.
+  std::mutex mutex_;
+  // Scanners for end and while patterns with back-references, resolved per
+  // begin match; keyed by the anchor variant and the resolved sources.
+  std::unordered_map<std::string, ScannerRef> resolved_scanners_;
+  // Tells frames pushed by the current tokenize_line call from older ones.
+  std::atomic<uint64_t> line_serial_{0};
+};
+
+#endif  // ONIG_GRAMMAR_HPP
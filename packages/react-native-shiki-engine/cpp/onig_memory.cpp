@@ -0,0 +1,481 @@
+#include "onig_memory.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "onig_alloc_hooks.h"
+
+#if __has_include(<onig_build_config.h>)
+#  include <onig_build_config.h>
+#endif
+
+// Accounts live in fixed slots that are never freed, so an allocation that
+// outlives its account (e.g. a table Oniguruma creates lazily during a compile)
+// can still be released safely. Handles pack (slot index, generation); a stale
+// generation means the account was retired and the bytes are simply dropped.
+static constexpr uint32_t kSlotsPerChunk = 256;
+static constexpr uint32_t kMaxChunks = 256;
+
+struct AccountSlot {
+  std::atomic<uint32_t> generation{1};
+  std::atomic<int64_t> bytes{0};
+};
+
+struct AccountRegistry {
+  std::mutex mutex;
+  std::atomic<AccountSlot*> chunks[kMaxChunks] = {};
+  uint32_t slot_count = 0;
+  std::vector<uint32_t> free_slots;
+  std::atomic<int64_t> unowned_bytes{0};
+};
+
+static AccountRegistry& registry() {
+  static AccountRegistry* instance = new AccountRegistry();
+  return *instance;
+}
+
+static bool g_tracking_enabled = false;
+static thread_local MemoryAccount t_current_account = 0;
+static thread_local MemoryArena* t_current_arena = nullptr;
+
+static AccountSlot* slot_for(uint32_t index) {
+  AccountSlot* chunk = registry().chunks[index / kSlotsPerChunk].load(std::memory_order_acquire);
+  return chunk ? &chunk[index % kSlotsPerChunk] : nullptr;
+}
+
+/** Counter to charge for an account, or nullptr if it has been retired. */
+static std::atomic<int64_t>* counter_for(MemoryAccount account) {
+  if (account == 0) {
+    return &registry().unowned_bytes;
+  }
+  AccountSlot* slot = slot_for(static_cast<uint32_t>(account >> 32));
+  if (!slot || slot->generation.load(std::memory_order_acquire) != static_cast<uint32_t>(account)) {
+    return nullptr;
+  }
+  return &slot->bytes;
+}
+
+#ifdef ONIG_BUILT_WITH_ALLOC_HOOKS
+
+enum class BlockKind : uint8_t { System, Pooled, Arena };
+
+// Every hooked allocation is prefixed with its owner and size so frees and
+// reallocs from any thread settle against whoever handed the block out.
+struct alignas(alignof(std::max_align_t)) AllocHeader {
+  MemoryAccount account;
+  MemoryArena* arena;
+  size_t size;
+  BlockKind kind;
+  uint8_t size_class;
+};
+
+static void charge(MemoryAccount account, int64_t delta) {
+  if (auto* counter = counter_for(account)) {
+    counter->fetch_add(delta, std::memory_order_relaxed);
+  }
+}
+
+static constexpr size_t align_up(size_t size) {
+  return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+}
+
+// ---- Arenas: compiled pattern data ----
+//
+// onig_new makes many small allocations that all live exactly as long as the
+// regex. They are bump-allocated from a few chunks owned by the cache entry and
+// charged to its account chunk by chunk. Frees only drop a live-block count;
+// the chunks go back to the system in one sweep once the regex has been freed
+// and the owner has released the arena.
+
+static constexpr size_t kArenaFirstChunk = 4 * 1024;
+static constexpr size_t kArenaMaxChunk = 64 * 1024;
+
+struct alignas(alignof(std::max_align_t)) ArenaChunk {
+  ArenaChunk* next;
+  size_t capacity;
+  size_t used;
+};
+
+struct MemoryArena {
+  MemoryAccount account;
+  ArenaChunk* chunks = nullptr;  // Head is the chunk currently bumped from.
+  size_t next_chunk_size = kArenaFirstChunk;
+  // Live blocks plus one reference held by the owner until memory_arena_release.
+  std::atomic<size_t> references{1};
+};
+
+static unsigned char* chunk_data(ArenaChunk* chunk) {
+  return reinterpret_cast<unsigned char*>(chunk + 1);
+}
+
+static void arena_destroy(MemoryArena* arena) {
+  ArenaChunk* chunk = arena->chunks;
+  while (chunk) {
+    ArenaChunk* next = chunk->next;
+    charge(arena->account, -static_cast<int64_t>(sizeof(ArenaChunk) + chunk->capacity));
+    std::free(chunk);
+    chunk = next;
+  }
+  delete arena;
+}
+
+static void arena_unref(MemoryArena* arena) {
+  if (arena->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    arena_destroy(arena);
+  }
+}
+
+static ArenaChunk* arena_new_chunk(MemoryArena* arena, size_t capacity) {
+  auto* chunk = static_cast<ArenaChunk*>(std::malloc(sizeof(ArenaChunk) + capacity));
+  if (!chunk) {
+    return nullptr;
+  }
+  chunk->capacity = capacity;
+  chunk->used = 0;
+  charge(arena->account, static_cast<int64_t>(sizeof(ArenaChunk) + capacity));
+  return chunk;
+}
+
+static AllocHeader* arena_alloc(MemoryArena* arena, size_t size) {
+  const size_t needed = sizeof(AllocHeader) + align_up(size);
+  ArenaChunk* chunk = arena->chunks;
+
+  if (!chunk || chunk->capacity - chunk->used < needed) {
+    if (needed > kArenaMaxChunk / 2) {
+      // Oversized block: give it its own chunk behind the head so the head
+      // keeps serving small allocations.
+      ArenaChunk* large = arena_new_chunk(arena, needed);
+      if (!large) {
+        return nullptr;
+      }
+      large->used = needed;
+      ArenaChunk** link = chunk ? &chunk->next : &arena->chunks;
+      large->next = *link;
+      *link = large;
+      arena->references.fetch_add(1, std::memory_order_relaxed);
+      return reinterpret_cast<AllocHeader*>(chunk_data(large));
+    }
+
+    chunk = arena_new_chunk(arena, arena->next_chunk_size);
+    if (!chunk) {
+      return nullptr;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->next_chunk_size = std::min(arena->next_chunk_size * 2, kArenaMaxChunk);
+  }
+
+  auto* header = reinterpret_cast<AllocHeader*>(chunk_data(chunk) + chunk->used);
+  chunk->used += needed;
+  arena->references.fetch_add(1, std::memory_order_relaxed);
+  return header;
+}
+
+/** Grows the most recent allocation of the head chunk in place, if it fits. */
+static bool arena_try_grow(MemoryArena* arena, AllocHeader* header, size_t size) {
+  ArenaChunk* chunk = arena->chunks;
+  if (!chunk || t_current_arena != arena) {
+    return false;
+  }
+  unsigned char* end = reinterpret_cast<unsigned char*>(header + 1) + align_up(header->size);
+  if (end != chunk_data(chunk) + chunk->used) {
+    return false;
+  }
+  const size_t extra = align_up(size) - align_up(header->size);
+  if (chunk->capacity - chunk->used < extra) {
+    return false;
+  }
+  chunk->used += extra;
+  return true;
+}
+
+// ---- Thread-local size-class pools: search-time memory ----
+//
+// Match stacks and region arrays are allocated and freed on every search.
+// Freed blocks are cached per thread by size class and handed straight back,
+// so steady-state searching never touches the shared system heap. Each block
+// is its own system allocation, so any thread may cache or free any block.
+
+static constexpr size_t kSizeClasses[] = {32, 64, 128, 256, 512, 1024, 2048, 4096};
+static constexpr size_t kSizeClassCount = sizeof(kSizeClasses) / sizeof(kSizeClasses[0]);
+static constexpr uint16_t kMaxCachedPerClass = 32;
+
+// Trivially destructible so it stays usable while other thread_locals are
+// torn down; the reaper drains it and marks it dead at thread exit.
+struct ThreadPool {
+  AllocHeader* free_lists[kSizeClassCount];
+  uint16_t counts[kSizeClassCount];
+  bool dead;
+};
+
+static thread_local ThreadPool t_pool = {};
+
+struct ThreadPoolReaper {
+  ~ThreadPoolReaper() {
+    for (size_t i = 0; i < kSizeClassCount; i++) {
+      while (AllocHeader* block = t_pool.free_lists[i]) {
+        t_pool.free_lists[i] = *reinterpret_cast<AllocHeader**>(block + 1);
+        std::free(block);
+      }
+      t_pool.counts[i] = 0;
+    }
+    t_pool.dead = true;
+  }
+};
+
+static int size_class_for(size_t size) {
+  for (size_t i = 0; i < kSizeClassCount; i++) {
+    if (size <= kSizeClasses[i]) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+static AllocHeader* pool_alloc(size_t size) {
+  const int size_class = size_class_for(size);
+  if (size_class < 0 || t_pool.dead) {
+    auto* header = static_cast<AllocHeader*>(std::malloc(sizeof(AllocHeader) + size));
+    if (header) {
+      header->kind = BlockKind::System;
+    }
+    return header;
+  }
+
+  thread_local ThreadPoolReaper reaper;
+  (void)reaper;
+
+  AllocHeader* header = t_pool.free_lists[size_class];
+  if (header) {
+    t_pool.free_lists[size_class] = *reinterpret_cast<AllocHeader**>(header + 1);
+    t_pool.counts[size_class]--;
+  } else {
+    header = static_cast<AllocHeader*>(std::malloc(sizeof(AllocHeader) + kSizeClasses[size_class]));
+    if (!header) {
+      return nullptr;
+    }
+  }
+  header->kind = BlockKind::Pooled;
+  header->size_class = static_cast<uint8_t>(size_class);
+  return header;
+}
+
+static void pool_free(AllocHeader* header) {
+  const uint8_t size_class = header->size_class;
+  if (header->kind == BlockKind::Pooled && !t_pool.dead && t_pool.counts[size_class] < kMaxCachedPerClass) {
+    *reinterpret_cast<AllocHeader**>(header + 1) = t_pool.free_lists[size_class];
+    t_pool.free_lists[size_class] = header;
+    t_pool.counts[size_class]++;
+    return;
+  }
+  std::free(header);
+}
+
+// ---- Hook entry points ----
+
+static void* tracked_malloc(size_t size) {
+  if (size > SIZE_MAX / 2) {
+    return nullptr;
+  }
+
+  AllocHeader* header;
+  if (MemoryArena* arena = t_current_arena) {
+    header = arena_alloc(arena, size);
+    if (!header) {
+      return nullptr;
+    }
+    header->kind = BlockKind::Arena;
+    header->arena = arena;
+    header->account = arena->account;
+  } else {
+    header = pool_alloc(size);
+    if (!header) {
+      return nullptr;
+    }
+    header->arena = nullptr;
+    header->account = t_current_account;
+    charge(header->account, static_cast<int64_t>(size));
+  }
+  header->size = size;
+  return header + 1;
+}
+
+static void tracked_free(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+  auto* header = static_cast<AllocHeader*>(ptr) - 1;
+  if (header->kind == BlockKind::Arena) {
+    arena_unref(header->arena);
+    return;
+  }
+  charge(header->account, -static_cast<int64_t>(header->size));
+  pool_free(header);
+}
+
+static void* tracked_realloc(void* ptr, size_t size) {
+  if (!ptr) {
+    return tracked_malloc(size);
+  }
+  if (size > SIZE_MAX / 2) {
+    return nullptr;
+  }
+
+  auto* header = static_cast<AllocHeader*>(ptr) - 1;
+  const size_t old_size = header->size;
+
+  switch (header->kind) {
+    case BlockKind::Arena:
+      if (size <= old_size || arena_try_grow(header->arena, header, size)) {
+        header->size = std::max(size, old_size);
+        return ptr;
+      }
+      break;
+    case BlockKind::Pooled:
+      if (size <= kSizeClasses[header->size_class]) {
+        header->size = size;
+        charge(header->account, static_cast<int64_t>(size) - static_cast<int64_t>(old_size));
+        return ptr;
+      }
+      break;
+    case BlockKind::System: {
+      auto* resized = static_cast<AllocHeader*>(std::realloc(header, sizeof(AllocHeader) + size));
+      if (!resized) {
+        return nullptr;
+      }
+      resized->size = size;
+      charge(resized->account, static_cast<int64_t>(size) - static_cast<int64_t>(old_size));
+      return resized + 1;
+    }
+  }
+
+  void* moved = tracked_malloc(size);
+  if (!moved) {
+    return nullptr;
+  }
+  memcpy(moved, ptr, std::min(size, old_size));
+  tracked_free(ptr);
+  return moved;
+}
+
+static void* tracked_calloc(size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    return nullptr;
+  }
+  void* ptr = tracked_malloc(count * size);
+  if (ptr) {
+    memset(ptr, 0, count * size);
+  }
+  return ptr;
+}
+
+#endif  // ONIG_BUILT_WITH_ALLOC_HOOKS
+
+void memory_install_hooks() {
+#ifdef ONIG_BUILT_WITH_ALLOC_HOOKS
+  static const OnigAllocHooks hooks = {tracked_malloc, tracked_realloc, tracked_calloc, tracked_free};
+  shiki_onig_set_alloc_hooks(&hooks);
+  g_tracking_enabled = true;
+#endif
+}
+
+bool memory_tracking_enabled() {
+  return g_tracking_enabled;
+}
+
+MemoryAccount memory_account_create() {
+  if (!g_tracking_enabled) {
+    return 0;
+  }
+
+  AccountRegistry& reg = registry();
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  uint32_t index;
+  if (!reg.free_slots.empty()) {
+    index = reg.free_slots.back();
+    reg.free_slots.pop_back();
+  } else {
+    if (reg.slot_count == kSlotsPerChunk * kMaxChunks) {
+      return 0;
+    }
+    index = reg.slot_count++;
+    auto& chunk = reg.chunks[index / kSlotsPerChunk];
+    if (!chunk.load(std::memory_order_relaxed)) {
+      chunk.store(new AccountSlot[kSlotsPerChunk], std::memory_order_release);
+    }
+  }
+
+  AccountSlot* slot = slot_for(index);
+  slot->bytes.store(0, std::memory_order_relaxed);
+  return (static_cast<MemoryAccount>(index) << 32) | slot->generation.load(std::memory_order_relaxed);
+}
+
+void memory_account_retire(MemoryAccount account) {
+  if (account == 0) {
+    return;
+  }
+
+  AccountRegistry& reg = registry();
+  const uint32_t index = static_cast<uint32_t>(account >> 32);
+  AccountSlot* slot = slot_for(index);
+  std::lock_guard<std::mutex> lock(reg.mutex);
+  if (slot && slot->generation.load(std::memory_order_relaxed) == static_cast<uint32_t>(account)) {
+    // Skip 0 on wrap-around so a retired handle never matches again.
+    uint32_t next = static_cast<uint32_t>(account) + 1;
+    slot->generation.store(next == 0 ? 1 : next, std::memory_order_release);
+    reg.free_slots.push_back(index);
+  }
+}
+
+size_t memory_account_bytes(MemoryAccount account) {
+  auto* counter = counter_for(account);
+  int64_t bytes = counter ? counter->load(std::memory_order_relaxed) : 0;
+  return bytes > 0 ? static_cast<size_t>(bytes) : 0;
+}
+
+size_t memory_unowned_bytes() {
+  return memory_account_bytes(0);
+}
+
+MemoryArena* memory_arena_create(MemoryAccount account) {
+#ifdef ONIG_BUILT_WITH_ALLOC_HOOKS
+  if (g_tracking_enabled) {
+    auto* arena = new (std::nothrow) MemoryArena();
+    if (arena) {
+      arena->account = account;
+    }
+    return arena;
+  }
+#else
+  (void)account;
+#endif
+  return nullptr;
+}
+
+void memory_arena_release(MemoryArena* arena) {
+#ifdef ONIG_BUILT_WITH_ALLOC_HOOKS
+  if (arena) {
+    arena_unref(arena);
+  }
+#else
+  (void)arena;
+#endif
+}
+
+ScopedMemoryAccount::ScopedMemoryAccount(MemoryAccount account, MemoryArena* arena)
+  : previous_(t_current_account), previous_arena_(t_current_arena) {
+  t_current_account = account;
+  t_current_arena = arena;
+}
+
+ScopedMemoryAccount::~ScopedMemoryAccount() {
+  t_current_account = previous_;
+  t_current_arena = previous_arena_;
+}
@@ -0,0 +1,56 @@
+#ifndef ONIG_MEMORY_HPP
+#define ONIG_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/** Opaque handle to a byte counter that Oniguruma allocations are charged to.
+ *  0 means "unowned": search stacks, match regions and library tables. */
+using MemoryAccount = uint64_t;
+
+/** Bump allocator for data that lives and dies together (one compiled regex). */
+struct MemoryArena;
+
+/** Installs the tracking allocator into Oniguruma when the bundled library
+ *  was built with allocation hooks. Must run before onig_initialize. */
+void memory_install_hooks();
+
+/** True when byte counts are exact rather than estimated. */
+bool memory_tracking_enabled();
+
+/** New empty account, or 0 when tracking is disabled or no slot is free. */
+MemoryAccount memory_account_create();
+
+/** Retires an account. Its remaining allocations are no longer counted anywhere. */
+void memory_account_retire(MemoryAccount account);
+
+size_t memory_account_bytes(MemoryAccount account);
+
+/** Bytes Oniguruma currently holds that belong to no account. */
+size_t memory_unowned_bytes();
+
+/** New arena whose chunks are charged to account, or nullptr when tracking is
+ *  disabled (allocations then fall through to the default allocator). */
+MemoryArena* memory_arena_create(MemoryAccount account);
+
+/** Drops the owner's reference. Chunks are returned to the system in one
+ *  sweep once every block allocated from the arena has also been freed. */
+void memory_arena_release(MemoryArena* arena);
+
+/** Charges Oniguruma allocations made on this thread to account for the
+ *  scope's lifetime, carving them from arena when one is given. Without an
+ *  arena, blocks come from thread-local size-class pools. */
+class ScopedMemoryAccount {
+ public:
+  explicit ScopedMemoryAccount(MemoryAccount account, MemoryArena* arena = nullptr);
+  ~ScopedMemoryAccount();
+
+  ScopedMemoryAccount(const ScopedMemoryAccount&) = delete;
+  ScopedMemoryAccount& operator=(const ScopedMemoryAccount&) = delete;
+
+ private:
+  MemoryAccount previous_;
+  MemoryArena* previous_arena_;
+};
+
+#endif  // ONIG_MEMORY_HPP
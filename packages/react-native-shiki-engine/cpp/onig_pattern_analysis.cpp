@@ -0,0 +1,225 @@
+#include "onig_pattern_analysis.hpp"
+
+#include <cstring>
+#include <string_view>
+
+uint64_t pattern_source_hash(std::string_view source) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (unsigned char c : source) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// True for a (?...) option group that turns on extended mode, where
+// whitespace and # comments stop being literal.
+static bool has_extended_option(std::string_view source) {
+  for (size_t i = source.find("(?"); i != std::string_view::npos; i = source.find("(?", i + 2)) {
+    for (size_t j = i + 2; j < source.size(); j++) {
+      const char c = source[j];
+      if (c == 'x') {
+        return true;
+      }
+      if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-')) {
+        break;
+      }
+    }
+  }
+  return false;
+}
+
+// True if every top-level branch must start where the pattern does: no '|'
+// outside groups and character classes, and the nesting is well formed.
+static bool is_single_branch(std::string_view source) {
+  int group_depth = 0;
+  int class_depth = 0;
+  bool class_start = false;
+  for (size_t i = 0; i < source.size(); i++) {
+    const char c = source[i];
+    if (c == '\\') {
+      i++;
+      class_start = false;
+      continue;
+    }
+
+    if (class_depth > 0) {
+      if (c == '^' && class_start && source[i - 1] == '[') {
+        continue;
+      }
+      if (c == '[') {
+        class_depth++;
+        class_start = true;
+        continue;
+      }
+      // A ']' first in a class is a literal.
+      if (c == ']' && !class_start) {
+        class_depth--;
+      }
+      class_start = false;
+      continue;
+    }
+
+    switch (c) {
+      case '[':
+        class_depth = 1;
+        class_start = true;
+        break;
+      case '(':
+        group_depth++;
+        break;
+      case ')':
+        if (--group_depth < 0) {
+          return false;
+        }
+        break;
+      case '|':
+        if (group_depth == 0) {
+          return false;
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  return group_depth == 0 && class_depth == 0;
+}
+
+static size_t utf8_sequence_length(unsigned char lead) {
+  if (lead < 0x80) {
+    return 1;
+  }
+  if ((lead & 0xE0) == 0xC0) {
+    return 2;
+  }
+  if ((lead & 0xF0) == 0xE0) {
+    return 3;
+  }
+  if ((lead & 0xF8) == 0xF0) {
+    return 4;
+  }
+  return 0;
+}
+
+/** Reads the anchor and literal prefix that every match of a single-branch
+ *  pattern starts with. Stops at the first construct that isn't a plain or
+ *  escaped literal character; a character followed by ?, * or {n,m} may be
+ *  absent from the match, so it is dropped. */
+PatternAnalysis pattern_analyze(std::string_view source) {
+  PatternAnalysis analysis{};
+  analysis.hash = pattern_source_hash(source);
+  analysis.source_length = static_cast<uint32_t>(source.size());
+
+  if (source.find("(?#") != std::string_view::npos || has_extended_option(source) || !is_single_branch(source)) {
+    return analysis;
+  }
+
+  size_t pos = 0;
+  if (source.substr(0, 2) == "\\G") {
+    analysis.anchor = PATTERN_ANCHOR_SEARCH_START;
+    pos = 2;
+  } else if (source.substr(0, 1) == "^") {
+    analysis.anchor = PATTERN_ANCHOR_LINE_START;
+    pos = 1;
+  } else if (source.substr(0, 2) == "\\A") {
+    analysis.anchor = PATTERN_ANCHOR_LINE_START;
+    pos = 2;
+  }
+
+  while (pos < source.size()) {
+    const unsigned char c = static_cast<unsigned char>(source[pos]);
+    size_t char_start = pos;
+    size_t char_length = 0;
+
+    if (c == '\\') {
+      // Escaped punctuation is literal; escaped letters and digits are
+      // classes, anchors, backreferences or code points.
+      if (pos + 1 >= source.size()) {
+        break;
+      }
+      const unsigned char escaped = static_cast<unsigned char>(source[pos + 1]);
+      if (escaped >= 0x80 || std::strchr("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789", escaped)) {
+        break;
+      }
+      char_start = pos + 1;
+      char_length = 1;
+      pos += 2;
+    } else if (c != '\0' && std::strchr(".[](){}|?*+^$", c)) {
+      break;
+    } else {
+      char_length = utf8_sequence_length(c);
+      if (char_length == 0 || pos + char_length > source.size()) {
+        break;
+      }
+      pos += char_length;
+    }
+
+    const char next = pos < source.size() ? source[pos] : '\0';
+    if (next == '?' || next == '*' || next == '{') {
+      break;
+    }
+    if (analysis.literal_length + char_length > PATTERN_LITERAL_MAX) {
+      break;
+    }
+    std::memcpy(analysis.literal + analysis.literal_length, source.data() + char_start, char_length);
+    analysis.literal_length += static_cast<uint8_t>(char_length);
+    if (next == '+') {
+      break;
+    }
+  }
+
+  return analysis;
+}
+
+bool pattern_may_match_before(
+  uint8_t anchor,
+  std::string_view literal,
+  const char* text,
+  int text_length,
+  int start_pos,
+  int limit
+) {
+  if (limit <= start_pos) {
+    return false;
+  }
+  if (start_pos > text_length) {
+    return true;
+  }
+
+  const std::string_view haystack(text, static_cast<size_t>(text_length));
+  auto literal_at = [&](size_t pos) { return haystack.substr(pos, literal.size()) == literal; };
+
+  switch (anchor) {
+    case PATTERN_ANCHOR_SEARCH_START:
+      return literal_at(static_cast<size_t>(start_pos));
+
+    case PATTERN_ANCHOR_LINE_START: {
+      // Oniguruma's UTF-8 encoding only treats '\n' as a line terminator.
+      size_t pos = static_cast<size_t>(start_pos);
+      if (pos > 0 && haystack[pos - 1] != '\n') {
+        pos = haystack.find('\n', pos);
+        pos = pos == std::string_view::npos ? haystack.size() + 1 : pos + 1;
+      }
+      while (pos < static_cast<size_t>(limit) && pos <= haystack.size()) {
+        if (literal_at(pos)) {
+          return true;
+        }
+        pos = haystack.find('\n', pos);
+        if (pos == std::string_view::npos) {
+          break;
+        }
+        pos++;
+      }
+      return false;
+    }
+
+    default: {
+      if (literal.empty()) {
+        return true;
+      }
+      // Only occurrences starting before limit matter.
+      const size_t end = static_cast<size_t>(limit) - 1 + literal.size();
+      const size_t found = haystack.substr(0, end < haystack.size() ? end : haystack.size()).find(literal, start_pos);
+      return found != std::string_view::npos;
+    }
+  }
+}
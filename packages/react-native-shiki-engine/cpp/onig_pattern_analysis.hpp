@@ -0,0 +1,57 @@
+#ifndef ONIG_PATTERN_ANALYSIS_HPP
+#define ONIG_PATTERN_ANALYSIS_HPP
+
+#include <cstdint>
+#include <string_view>
+
+// Facts about a pattern that let a search skip it without running the regex,
+// derived from the source text alone so they can also be precomputed off the
+// device (see onig_pattern_bundle.hpp). The analysis is conservative: a
+// pattern it doesn't fully understand simply gets no facts.
+
+/** Bump whenever pattern_analyze could produce different facts, so bundles
+ *  generated by an older tool are rejected instead of trusted. */
+#define PATTERN_ANALYSIS_VERSION 1
+
+/** Longest literal prefix recorded per pattern. */
+#define PATTERN_LITERAL_MAX 16
+
+enum PatternAnchor : uint8_t {
+  PATTERN_ANCHOR_NONE = 0,
+  // \G: matches only where the search starts.
+  PATTERN_ANCHOR_SEARCH_START = 1,
+  // ^ or \A: matches only at the start of a line.
+  PATTERN_ANCHOR_LINE_START = 2,
+};
+
+// Plain data; bundles store these records as-is.
+struct PatternAnalysis {
+  // pattern_source_hash of the source, plus its length as a collision guard.
+  uint64_t hash;
+  uint32_t source_length;
+  uint8_t anchor;
+  // Every match starts with these bytes.
+  uint8_t literal_length;
+  uint8_t reserved[2];
+  char literal[PATTERN_LITERAL_MAX];
+};
+
+static_assert(sizeof(PatternAnalysis) == 32, "PatternAnalysis is a bundle record");
+
+/** FNV-1a of the source: stable across launches and builds, unlike std::hash. */
+uint64_t pattern_source_hash(std::string_view source);
+
+PatternAnalysis pattern_analyze(std::string_view source);
+
+/** False when a pattern with this anchor and literal prefix provably has no
+ *  match starting in [start_pos, limit) of text, so the search can skip it. */
+bool pattern_may_match_before(
+  uint8_t anchor,
+  std::string_view literal,
+  const char* text,
+  int text_length,
+  int start_pos,
+  int limit
+);
+
+#endif  // ONIG_PATTERN_ANALYSIS_HPP
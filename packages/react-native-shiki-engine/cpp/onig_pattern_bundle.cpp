@@ -0,0 +1,170 @@
+#include "onig_pattern_bundle.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <shared_mutex>
+#include <tuple>
+
+// File layout, native byte order (every supported host and device is
+// little-endian; a byte-swapped magic is rejected):
+//   u32 magic, u32 version, u32 analysis_version, u32 record_count
+//   PatternAnalysis records[record_count], sorted by (hash, source_length)
+static constexpr uint32_t kBundleMagic = 0x424b4853;  // "SHKB"
+static constexpr uint32_t kBundleVersion = 1;
+
+struct BundleHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t analysis_version;
+  uint32_t record_count;
+};
+
+struct MappedBundle {
+  void* data = nullptr;
+  size_t size = 0;
+  const PatternAnalysis* records = nullptr;
+  size_t record_count = 0;
+};
+
+struct PatternBundleState {
+  // Lookups hold this shared; opening a new bundle holds it exclusively to
+  // unmap the old one.
+  std::shared_mutex lock;
+  MappedBundle bundle;
+  std::atomic<unsigned long long> hits{0};
+};
+
+/** Intentionally leaked, like the pattern cache. */
+static PatternBundleState& bundle_state() {
+  static PatternBundleState* state = new PatternBundleState();
+  return *state;
+}
+
+static bool record_less(const PatternAnalysis& a, const PatternAnalysis& b) {
+  return std::tie(a.hash, a.source_length) < std::tie(b.hash, b.source_length);
+}
+
+bool pattern_bundle_open(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(BundleHeader)) {
+    close(fd);
+    return false;
+  }
+
+  const size_t size = static_cast<size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  const auto* header = static_cast<const BundleHeader*>(data);
+  const size_t record_bytes = size - sizeof(BundleHeader);
+  if (header->magic != kBundleMagic || header->version != kBundleVersion ||
+      header->analysis_version != PATTERN_ANALYSIS_VERSION ||
+      record_bytes / sizeof(PatternAnalysis) != header->record_count ||
+      record_bytes % sizeof(PatternAnalysis) != 0) {
+    munmap(data, size);
+    return false;
+  }
+
+  MappedBundle bundle;
+  bundle.data = data;
+  bundle.size = size;
+  bundle.records = reinterpret_cast<const PatternAnalysis*>(static_cast<const char*>(data) + sizeof(BundleHeader));
+  bundle.record_count = header->record_count;
+
+  PatternBundleState& state = bundle_state();
+  std::unique_lock<std::shared_mutex> lock(state.lock);
+  if (state.bundle.data) {
+    munmap(state.bundle.data, state.bundle.size);
+  }
+  state.bundle = bundle;
+  return true;
+}
+
+bool pattern_bundle_find(std::string_view source, PatternAnalysis* analysis) {
+  PatternBundleState& state = bundle_state();
+  std::shared_lock<std::shared_mutex> lock(state.lock);
+  if (!state.bundle.records) {
+    return false;
+  }
+
+  PatternAnalysis key{};
+  key.hash = pattern_source_hash(source);
+  key.source_length = static_cast<uint32_t>(source.size());
+  const PatternAnalysis* end = state.bundle.records + state.bundle.record_count;
+  const PatternAnalysis* found = std::lower_bound(state.bundle.records, end, key, record_less);
+  if (found == end || found->hash != key.hash || found->source_length != key.source_length) {
+    return false;
+  }
+
+  *analysis = *found;
+  state.hits.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool pattern_bundle_write(const std::string& path, const std::vector<std::string>& sources) {
+  std::vector<std::string> unique_sources(sources);
+  std::sort(unique_sources.begin(), unique_sources.end());
+  unique_sources.erase(std::unique(unique_sources.begin(), unique_sources.end()), unique_sources.end());
+
+  std::vector<PatternAnalysis> analyzed;
+  analyzed.reserve(unique_sources.size());
+  for (const std::string& source : unique_sources) {
+    analyzed.push_back(pattern_analyze(source));
+  }
+  std::sort(analyzed.begin(), analyzed.end(), record_less);
+
+  // Distinct sources sharing a key would be indistinguishable at lookup;
+  // leave them out and let the device analyze them.
+  std::vector<PatternAnalysis> records;
+  records.reserve(analyzed.size());
+  for (size_t i = 0; i < analyzed.size();) {
+    size_t run = i + 1;
+    while (run < analyzed.size() && !record_less(analyzed[i], analyzed[run])) {
+      run++;
+    }
+    if (run == i + 1) {
+      records.push_back(analyzed[i]);
+    }
+    i = run;
+  }
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    return false;
+  }
+
+  const BundleHeader header{
+    kBundleMagic,
+    kBundleVersion,
+    PATTERN_ANALYSIS_VERSION,
+    static_cast<uint32_t>(records.size()),
+  };
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+  if (ok && !records.empty()) {
+    ok = fwrite(records.data(), sizeof(PatternAnalysis), records.size(), file) == records.size();
+  }
+  return fclose(file) == 0 && ok;
+}
+
+void pattern_bundle_get_stats(OnigCacheStats* stats) {
+  PatternBundleState& state = bundle_state();
+  std::shared_lock<std::shared_mutex> lock(state.lock);
+  stats->bundle_patterns = state.bundle.record_count;
+  stats->bundle_hits = state.hits.load(std::memory_order_relaxed);
+}
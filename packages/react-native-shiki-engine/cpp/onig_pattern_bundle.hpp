@@ -0,0 +1,30 @@
+#ifndef ONIG_PATTERN_BUNDLE_HPP
+#define ONIG_PATTERN_BUNDLE_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "onig_pattern_analysis.hpp"
+#include "onig_regex.h"
+
+// Precomputed PatternAnalysis records for known grammars, generated on the
+// host by scripts/build-pattern-bundle.sh and memory-mapped at runtime, so
+// scanners for bundled patterns skip analysis entirely. Oniguruma can't
+// serialize compiled regexes, so compilation itself still happens on device.
+
+/** Maps the bundle at path; scanners created afterwards look their patterns
+ *  up in it. Replaces any bundle opened earlier. False if the file is missing
+ *  or was written by an incompatible generator. */
+bool pattern_bundle_open(const std::string& path);
+
+/** Copies the bundled analysis for source into analysis. False if the open
+ *  bundle doesn't have it, or none is open. */
+bool pattern_bundle_find(std::string_view source, PatternAnalysis* analysis);
+
+/** Analyzes sources and writes them as a bundle. Used by the generator. */
+bool pattern_bundle_write(const std::string& path, const std::vector<std::string>& sources);
+
+void pattern_bundle_get_stats(OnigCacheStats* stats);
+
+#endif  // ONIG_PATTERN_BUNDLE_HPP
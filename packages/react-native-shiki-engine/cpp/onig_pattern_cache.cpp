@@ -0,0 +1,241 @@
+#include "onig_pattern_cache.hpp"
+
+#include <functional>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+
+#include "onig_clock.hpp"
+
+/** Transparent hash so lookups by string_view don't build a std::string. */
+struct PatternHash {
+  using is_transparent = void;
+
+  size_t operator()(std::string_view pattern) const noexcept {
+    return std::hash<std::string_view>{}(pattern);
+  }
+};
+
+struct PatternCacheState {
+  std::mutex mutex;
+  std::unordered_map<std::string, CachedPattern, PatternHash, std::equal_to<>> entries;
+  CachedPattern* lru_head = nullptr;
+  CachedPattern* lru_tail = nullptr;
+  size_t max_entries = MAX_CACHE_SIZE;
+  size_t memory_limit = CACHE_MEMORY_LIMIT;
+  size_t idle_entries = 0;
+  size_t memory_usage = 0;
+  unsigned long long hits = 0;
+  unsigned long long misses = 0;
+  unsigned long long evictions = 0;
+  std::chrono::nanoseconds compile_time{0};
+  std::chrono::nanoseconds compile_time_saved{0};
+};
+
+/** Process-wide cache state. Intentionally leaked so scanners released during
+ *  static destruction never touch a destroyed map. */
+static PatternCacheState& cache_state() {
+  static PatternCacheState* state = new PatternCacheState();
+  return *state;
+}
+
+/** Estimated footprint of a compiled pattern when the allocator isn't tracked:
+ *  compiled code grows with source length, and every capture group adds
+ *  region slots on each search. */
+static size_t estimate_pattern_memory(std::string_view pattern, regex_t* regex) {
+  const size_t captures = static_cast<size_t>(onig_number_of_captures(regex)) + 1;
+  return 512 + pattern.size() * 8 + captures * 2 * sizeof(int);
+}
+
+/** Compiles a pattern with vscode-oniguruma's options. nullptr on syntax
+ *  error, described in error when given. */
+static regex_t* compile_pattern(std::string_view pattern, std::string* error) {
+  regex_t* regex = nullptr;
+  OnigErrorInfo einfo;
+  int result = onig_new(
+    &regex,
+    (const OnigUChar*)pattern.data(),
+    (const OnigUChar*)(pattern.data() + pattern.size()),
+    // ONIG_OPTION_CAPTURE_GROUP matches vscode-oniguruma: without it,
+    // oniguruma disables numbered captures in any pattern that also
+    // contains named groups, silently breaking TextMate `captures`
+    // scope assignment (tokens lose their colors).
+    ONIG_OPTION_CAPTURE_GROUP,
+    ONIG_ENCODING_UTF8,
+    ONIG_SYNTAX_DEFAULT,
+    &einfo
+  );
+  if (result != ONIG_NORMAL) {
+    if (error) {
+      OnigUChar message[ONIG_MAX_ERROR_MESSAGE_LEN];
+      onig_error_code_to_str(message, result, &einfo);
+      error->assign(reinterpret_cast<const char*>(message));
+    }
+    return nullptr;
+  }
+  return regex;
+}
+
+static void lru_unlink_locked(PatternCacheState& state, CachedPattern* entry) {
+  (entry->lru_prev ? entry->lru_prev->lru_next : state.lru_head) = entry->lru_next;
+  (entry->lru_next ? entry->lru_next->lru_prev : state.lru_tail) = entry->lru_prev;
+  entry->lru_prev = nullptr;
+  entry->lru_next = nullptr;
+  state.idle_entries--;
+}
+
+static void lru_push_front_locked(PatternCacheState& state, CachedPattern* entry) {
+  entry->lru_prev = nullptr;
+  entry->lru_next = state.lru_head;
+  (state.lru_head ? state.lru_head->lru_prev : state.lru_tail) = entry;
+  state.lru_head = entry;
+  state.idle_entries++;
+}
+
+static void retain_locked(PatternCacheState& state, CachedPattern* entry) {
+  if (entry->refcount++ == 0) {
+    lru_unlink_locked(state, entry);
+  }
+}
+
+/** Drops the least recently used idle entry. */
+static void evict_tail_locked(PatternCacheState& state) {
+  CachedPattern* entry = state.lru_tail;
+  lru_unlink_locked(state, entry);
+  state.memory_usage -= entry->memory_size;
+  state.evictions++;
+  onig_free(entry->regex);
+  memory_arena_release(entry->arena);
+  memory_account_retire(entry->memory_account);
+  state.entries.erase(state.entries.find(entry->key));
+}
+
+/** Evicts idle entries from the LRU tail: expired ones always, then more while
+ *  over the entry cap or memory limit. Each eviction is O(1). */
+static void evict_locked(PatternCacheState& state, int64_t now) {
+  while (state.lru_tail && now - state.lru_tail->idle_since > CACHE_EXPIRY_SECONDS) {
+    evict_tail_locked(state);
+  }
+  while (state.lru_tail && (state.entries.size() > state.max_entries || state.memory_usage > state.memory_limit)) {
+    evict_tail_locked(state);
+  }
+}
+
+CachedPattern* pattern_cache_acquire(std::string_view pattern, std::string* error) {
+  PatternCacheState& state = cache_state();
+
+  try {
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      auto it = state.entries.find(pattern);
+      if (it != state.entries.end()) {
+        retain_locked(state, &it->second);
+        state.hits++;
+        state.compile_time_saved += it->second.compile_time;
+        return &it->second;
+      }
+      state.misses++;
+    }
+
+    // Compile outside the lock so one slow pattern doesn't stall other scanners.
+    MemoryAccount account = memory_account_create();
+    MemoryArena* arena = memory_arena_create(account);
+    auto start = std::chrono::steady_clock::now();
+    regex_t* regex;
+    {
+      ScopedMemoryAccount scope(account, arena);
+      regex = compile_pattern(pattern, error);
+    }
+    auto compile_time = std::chrono::steady_clock::now() - start;
+    if (!regex) {
+      memory_arena_release(arena);
+      memory_account_retire(account);
+      return nullptr;
+    }
+    size_t memory_size =
+      memory_tracking_enabled() ? memory_account_bytes(account) : estimate_pattern_memory(pattern, regex);
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto [it, inserted] = state.entries.try_emplace(std::string(pattern));
+    CachedPattern* entry = &it->second;
+    if (inserted) {
+      *entry = CachedPattern{regex, 1, memory_size, account, arena, compile_time, nullptr, nullptr, 0, it->first};
+      state.memory_usage += memory_size;
+      state.compile_time += compile_time;
+      evict_locked(state, coarse_monotonic_seconds());
+    } else {
+      // Another thread compiled the same source first; keep the shared copy.
+      onig_free(regex);
+      memory_arena_release(arena);
+      memory_account_retire(account);
+      retain_locked(state, entry);
+    }
+    return entry;
+  } catch (const std::bad_alloc&) {
+    if (error) {
+      *error = "out of memory";
+    }
+    return nullptr;
+  }
+}
+
+void pattern_cache_release(CachedPattern* entry) {
+  if (!entry) {
+    return;
+  }
+
+  PatternCacheState& state = cache_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  if (--entry->refcount == 0) {
+    const int64_t now = coarse_monotonic_seconds();
+    entry->idle_since = now;
+    lru_push_front_locked(state, entry);
+    evict_locked(state, now);
+  }
+}
+
+void pattern_cache_set_max_entries(size_t max_entries) {
+  PatternCacheState& state = cache_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  if (state.max_entries != max_entries) {
+    state.max_entries = max_entries;
+    evict_locked(state, coarse_monotonic_seconds());
+  }
+}
+
+void pattern_cache_set_memory_limit(size_t bytes) {
+  PatternCacheState& state = cache_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.memory_limit = bytes;
+  evict_locked(state, coarse_monotonic_seconds());
+}
+
+size_t pattern_cache_memory_usage() {
+  PatternCacheState& state = cache_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  return state.memory_usage;
+}
+
+void pattern_cache_trim() {
+  PatternCacheState& state = cache_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  while (state.lru_tail) {
+    evict_tail_locked(state);
+  }
+}
+
+void pattern_cache_get_stats(OnigCacheStats* stats) {
+  PatternCacheState& state = cache_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  stats->entries = state.entries.size();
+  stats->idle_entries = state.idle_entries;
+  stats->memory_usage = state.memory_usage;
+  stats->unowned_memory_usage = memory_unowned_bytes();
+  stats->exact_memory = memory_tracking_enabled() ? 1 : 0;
+  stats->hits = state.hits;
+  stats->misses = state.misses;
+  stats->evictions = state.evictions;
+  stats->compile_time_ms = std::chrono::duration<double, std::milli>(state.compile_time).count();
+  stats->compile_time_saved_ms = std::chrono::duration<double, std::milli>(state.compile_time_saved).count();
+}
@@ -0,0 +1,54 @@
+#ifndef ONIG_PATTERN_CACHE_HPP
+#define ONIG_PATTERN_CACHE_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "onig_memory.hpp"
+#include "onig_regex.h"
+#include "oniguruma.h"
+
+/** Compiled pattern shared by every scanner in the process using the same source. */
+struct CachedPattern {
+  regex_t* regex;
+  size_t refcount;
+  // Exact bytes charged to memory_account when tracking is enabled, else an estimate.
+  size_t memory_size;
+  MemoryAccount memory_account;
+  MemoryArena* arena;
+  std::chrono::nanoseconds compile_time;
+
+  // Idle LRU links, only meaningful while refcount == 0. Head is most recent.
+  CachedPattern* lru_prev;
+  CachedPattern* lru_next;
+  int64_t idle_since;
+
+  // Points at the owning map key, which is stable for the entry's lifetime.
+  std::string_view key;
+};
+
+/** Returns the shared entry for pattern, compiling it on a miss, with one
+ *  reference held for the caller. nullptr if the pattern fails to compile,
+ *  with Oniguruma's message in error when given. Safe to call concurrently. */
+CachedPattern* pattern_cache_acquire(std::string_view pattern, std::string* error = nullptr);
+
+/** Drops a reference. Unreferenced entries stay compiled for reuse until evicted. */
+void pattern_cache_release(CachedPattern* entry);
+
+/** Caps how many compiled patterns are kept; entries still referenced are never evicted. */
+void pattern_cache_set_max_entries(size_t max_entries);
+
+/** Caps memory held by compiled patterns; entries still referenced are never evicted. */
+void pattern_cache_set_memory_limit(size_t bytes);
+
+size_t pattern_cache_memory_usage();
+
+/** Evicts every unreferenced entry. */
+void pattern_cache_trim();
+
+void pattern_cache_get_stats(OnigCacheStats* stats);
+
+#endif  // ONIG_PATTERN_CACHE_HPP
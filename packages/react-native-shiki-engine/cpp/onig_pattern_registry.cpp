@@ -0,0 +1,89 @@
+#include "onig_pattern_registry.hpp"
+
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+struct PatternRegistryState {
+  std::shared_mutex lock;
+  // Deque so interned strings never move; ids keys view into them.
+  std::deque<std::string> sources;
+  std::unordered_map<std::string_view, PatternId> ids;
+};
+
+/** Intentionally leaked, like the pattern cache. */
+static PatternRegistryState& registry_state() {
+  static PatternRegistryState* state = new PatternRegistryState();
+  return *state;
+}
+
+static PatternId intern_locked(PatternRegistryState& state, std::string_view source) {
+  auto it = state.ids.find(source);
+  if (it != state.ids.end()) {
+    return it->second;
+  }
+
+  const auto id = static_cast<PatternId>(state.sources.size());
+  state.ids.emplace(state.sources.emplace_back(source), id);
+  return id;
+}
+
+PatternId pattern_registry_intern(std::string_view source) {
+  PatternRegistryState& state = registry_state();
+  {
+    std::shared_lock<std::shared_mutex> lock(state.lock);
+    auto it = state.ids.find(source);
+    if (it != state.ids.end()) {
+      return it->second;
+    }
+  }
+
+  std::unique_lock<std::shared_mutex> lock(state.lock);
+  return intern_locked(state, source);
+}
+
+std::vector<PatternId> pattern_registry_intern_all(const std::vector<std::string_view>& sources) {
+  PatternRegistryState& state = registry_state();
+  std::vector<PatternId> ids;
+  ids.reserve(sources.size());
+
+  // Grammars are mostly re-registered, so try without the exclusive lock.
+  {
+    std::shared_lock<std::shared_mutex> lock(state.lock);
+    for (std::string_view source : sources) {
+      auto it = state.ids.find(source);
+      if (it == state.ids.end()) {
+        break;
+      }
+      ids.push_back(it->second);
+    }
+  }
+
+  if (ids.size() < sources.size()) {
+    std::unique_lock<std::shared_mutex> lock(state.lock);
+    for (size_t i = ids.size(); i < sources.size(); i++) {
+      ids.push_back(intern_locked(state, sources[i]));
+    }
+  }
+  return ids;
+}
+
+bool pattern_registry_resolve(const std::vector<PatternId>& ids, std::vector<const std::string*>* sources) {
+  PatternRegistryState& state = registry_state();
+  std::shared_lock<std::shared_mutex> lock(state.lock);
+  sources->reserve(sources->size() + ids.size());
+  for (PatternId id : ids) {
+    if (id >= state.sources.size()) {
+      return false;
+    }
+    sources->push_back(&state.sources[id]);
+  }
+  return true;
+}
+
+size_t pattern_registry_size() {
+  PatternRegistryState& state = registry_state();
+  std::shared_lock<std::shared_mutex> lock(state.lock);
+  return state.sources.size();
+}
@@ -0,0 +1,30 @@
+#ifndef ONIG_PATTERN_REGISTRY_HPP
+#define ONIG_PATTERN_REGISTRY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Process-wide interned pattern sources. Each distinct source gets a small
+// integer ID that stays valid for the life of the process, across JS reloads,
+// so callers can name patterns without shipping or hashing the strings again.
+// Sources are never removed, so only explicit registrations add them (the
+// registerPatterns API), never scanner creation.
+
+using PatternId = uint32_t;
+
+/** Returns the ID for source, registering it on first sight. */
+PatternId pattern_registry_intern(std::string_view source);
+
+/** Interns every source, in order. */
+std::vector<PatternId> pattern_registry_intern_all(const std::vector<std::string_view>& sources);
+
+/** Appends the sources for ids to sources. False if any ID was never
+ *  registered. The strings live as long as the process. */
+bool pattern_registry_resolve(const std::vector<PatternId>& ids, std::vector<const std::string*>* sources);
+
+size_t pattern_registry_size();
+
+#endif  // ONIG_PATTERN_REGISTRY_HPP
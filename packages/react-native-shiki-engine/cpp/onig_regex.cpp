@@ -1,253 +1,588 @@
 #include "onig_regex.h"
 
-#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <mutex>
 #include <new>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "onig_clock.hpp"
 #include "onig_context.hpp"
-
-/** Rough estimate of regex pattern memory usage. Base + pattern size. */
-static size_t estimate_pattern_memory(const char* pattern, regex_t* regex) {
-  return strlen(pattern) + 1024;
+#include "onig_governor.hpp"
+#include "onig_memory.hpp"
+#include "onig_pattern_bundle.hpp"
+#include "onig_scanner_store.hpp"
+#include "onig_thread_pool.hpp"
+#include "onig_usage_profile.hpp"
+
+/** One-time Oniguruma setup; safe when first scanners are created concurrently. */
+static void ensure_onig_initialized() {
+  static const bool initialized = [] {
+    memory_install_hooks();
+    OnigEncodingType* encodings[] = {ONIG_ENCODING_UTF8};
+    onig_initialize(encodings, 1);
+    return true;
+  }();
+  (void)initialized;
 }
 
-/** Evicts cached patterns when memory limit exceeded, oldest first. */
-static void check_memory_pressure(OnigContext* context) {
-  if (context->current_memory_usage > CACHE_MEMORY_LIMIT) {
-    std::vector<std::pair<std::string, time_t>> patterns;
-    for (const auto& entry : context->impl->pattern_cache) {
-      patterns.push_back({entry.first, entry.second.last_used});
+/** Per-thread match regions, reused across searches on any scanner. Regions
+ *  hold search output only, so sharing compiled regexes across threads is safe
+ *  as long as each thread has its own. A scan searches into one and swaps it
+ *  with the other on a better match, so captures are copied out only once. */
+struct SearchRegions {
+  OnigRegion* search = onig_region_new();
+  OnigRegion* best = onig_region_new();
+  ~SearchRegions() {
+    if (search) {
+      onig_region_free(search, 1);
+    }
+    if (best) {
+      onig_region_free(best, 1);
     }
+  }
+};
 
-    std::sort(patterns.begin(), patterns.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+static SearchRegions* thread_regions() {
+  thread_local SearchRegions regions;
+  return regions.search && regions.best ? &regions : nullptr;
+}
 
-    for (const auto& pattern : patterns) {
-      if (context->current_memory_usage <= CACHE_MEMORY_LIMIT) {
-        break;
+/** Marks a lazy pattern that failed to compile so it is skipped, not retried. */
+static CachedPattern* failed_pattern() {
+  static CachedPattern failed{};
+  return &failed;
+}
+
+static std::atomic<unsigned long long> g_lazy_compiles{0};
+
+/** Releases every compiled pattern and clears the slots. Caller holds
+ *  impl->lock exclusively, or owns the context outright. */
+static void scanner_release_patterns_locked(OnigContext* context) {
+  OnigContextImpl* impl = context->impl;
+  for (int i = 0; i < context->pattern_count; i++) {
+    impl->regexes[i].store(nullptr, std::memory_order_relaxed);
+    CachedPattern* entry = impl->patterns[i].exchange(nullptr, std::memory_order_relaxed);
+    if (entry && entry != failed_pattern()) {
+      pattern_cache_release(entry);
+    }
+  }
+  impl->compiled_patterns.store(0, std::memory_order_relaxed);
+}
+
+/** Why the last scanner creation on this thread failed, for scanner_last_error. */
+static thread_local std::string t_last_error;
+
+/** Acquires compiled patterns for every source; lazy scanners defer each one
+ *  to its first search. Large sets compile on the thread pool. On failure
+ *  nothing is held and t_last_error names the lowest failing index, whatever
+ *  order the workers finished in. Caller holds impl->lock exclusively, or owns
+ *  the context outright. */
+static bool scanner_acquire_patterns_locked(OnigContext* context) {
+  OnigContextImpl* impl = context->impl;
+
+  if (!impl->lazy) {
+    const size_t count = static_cast<size_t>(context->pattern_count);
+    std::vector<std::string> errors(count);
+    auto acquire = [context, impl, &errors](size_t i) {
+      CachedPattern* entry = pattern_cache_acquire(scanner_source(context, static_cast<int>(i)), &errors[i]);
+      impl->patterns[i].store(entry, std::memory_order_relaxed);
+      impl->regexes[i].store(entry ? entry->regex : nullptr, std::memory_order_relaxed);
+    };
+    if (count >= PARALLEL_COMPILE_MIN_PATTERNS) {
+      thread_pool_parallel_for(count, acquire);
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        acquire(i);
       }
+    }
 
-      auto it = context->impl->pattern_cache.find(pattern.first);
-      if (it != context->impl->pattern_cache.end()) {
-        context->current_memory_usage -= it->second.memory_size;
-        onig_free(it->second.regex);
-        context->impl->pattern_cache.erase(it);
+    for (size_t i = 0; i < count; i++) {
+      if (!impl->patterns[i].load(std::memory_order_relaxed)) {
+        t_last_error = "Invalid pattern at index " + std::to_string(i) + ": " + errors[i];
+        scanner_hibernate_locked(context);
+        return false;
       }
     }
+    impl->compiled_patterns.store(context->pattern_count, std::memory_order_relaxed);
   }
+
+  impl->hibernated.store(false, std::memory_order_relaxed);
+  return true;
 }
 
-/** Removes expired patterns based on last access time. */
-static void cleanup_cache(OnigContext* context) {
-  time_t current_time = time(nullptr);
-  auto it = context->impl->pattern_cache.begin();
+void scanner_hibernate_locked(OnigContext* context) {
+  scanner_release_patterns_locked(context);
+  context->impl->hibernated.store(true, std::memory_order_relaxed);
+}
 
-  while (it != context->impl->pattern_cache.end()) {
-    if (current_time - it->second.last_used > CACHE_EXPIRY_SECONDS) {
-      context->current_memory_usage -= it->second.memory_size;
-      onig_free(it->second.regex);
-      it = context->impl->pattern_cache.erase(it);
-    } else {
-      ++it;
+/** Compiles pattern index of a lazy scanner on first use. Caller holds
+ *  impl->lock shared. Threads reaching the same pattern at once share one
+ *  compile through the pattern cache; the first to publish keeps its reference. */
+static CachedPattern* scanner_compile_pattern(OnigContext* context, int index) {
+  OnigContextImpl* impl = context->impl;
+  CachedPattern* entry = pattern_cache_acquire(scanner_source(context, index));
+  if (!entry) {
+    entry = failed_pattern();
+  }
+
+  CachedPattern* expected = nullptr;
+  if (!impl->patterns[index].compare_exchange_strong(expected, entry, std::memory_order_acq_rel)) {
+    if (entry != failed_pattern()) {
+      pattern_cache_release(entry);
     }
+    return expected;
   }
-}
 
-/** Retrieves cached pattern, updates LRU timestamp if found. */
-static regex_t* get_cached_pattern(OnigContext* context, const char* pattern) {
-  auto it = context->impl->pattern_cache.find(pattern);
-  if (it != context->impl->pattern_cache.end()) {
-    it->second.last_used = time(nullptr);
-    return it->second.regex;
+  if (entry != failed_pattern()) {
+    impl->regexes[index].store(entry->regex, std::memory_order_release);
+    impl->compiled_patterns.fetch_add(1, std::memory_order_relaxed);
+    g_lazy_compiles.fetch_add(1, std::memory_order_relaxed);
   }
-  return nullptr;
+  return entry;
 }
 
-/** LRU pattern caching with memory limit enforcement. */
-static void cache_pattern(OnigContext* context, const char* pattern, regex_t* regex) {
-  if (context->impl->pattern_cache.size() >= context->max_cache_size) {
-    cleanup_cache(context);
+/** Searches pattern i and records it if it beats the best match so far. Returns
+ *  false once nothing later can win, ending the scan. */
+static inline bool scan_pattern(
+  OnigContext* context,
+  int i,
+  const char* text,
+  int text_length,
+  int start_pos,
+  SearchRegions* regions,
+  int* best_index,
+  int* best_match_pos,
+  bool* compiled
+) {
+  OnigContextImpl* impl = context->impl;
+
+  // Skip patterns that can't match before the best match so far; for lazy
+  // scanners that also defers compiling them.
+  if (impl->anchors[i] != PATTERN_ANCHOR_NONE || impl->literal_lengths[i] != 0) {
+    const int limit = *best_match_pos < 0 ? text_length + 1 : *best_match_pos;
+    const std::string_view literal(impl->literals[i], impl->literal_lengths[i]);
+    if (!pattern_may_match_before(impl->anchors[i], literal, text, text_length, start_pos, limit)) {
+      return true;
+    }
+  }
 
-    if (context->impl->pattern_cache.size() >= context->max_cache_size) {
-      time_t oldest_time = time(nullptr);
-      std::string oldest_pattern;
+  regex_t* regex = impl->regexes[i].load(std::memory_order_acquire);
+  if (!regex) {
+    CachedPattern* entry = impl->patterns[i].load(std::memory_order_acquire);
+    if (!entry) {
+      entry = scanner_compile_pattern(context, i);
+      *compiled = true;
+    }
+    if (entry == failed_pattern()) {
+      return true;
+    }
+    regex = entry->regex;
+  }
 
-      for (const auto& entry : context->impl->pattern_cache) {
-        if (entry.second.last_used < oldest_time) {
-          oldest_time = entry.second.last_used;
-          oldest_pattern = entry.first;
-        }
-      }
+  int match_pos = onig_search(
+    regex,
+    (OnigUChar*)text,
+    (OnigUChar*)(text + text_length),
+    (OnigUChar*)(text + start_pos),
+    (OnigUChar*)(text + text_length),
+    regions->search,
+    ONIG_OPTION_NONE
+  );
+
+  // vscode-oniguruma contract: pick the LEFTMOST match; ties (same
+  // position) are won by the LOWEST pattern index — TextMate rule
+  // order is rule priority. Never tie-break by match length: that
+  // lets later rules steal matches and assigns wrong scopes.
+  if (match_pos >= 0 && (*best_match_pos < 0 || match_pos < *best_match_pos)) {
+    *best_match_pos = match_pos;
+    *best_index = i;
+    std::swap(regions->search, regions->best);
+
+    // Nothing can match earlier than start_pos; later patterns could
+    // only tie and ties keep the current (earlier) pattern.
+    return match_pos != start_pos;
+  }
+  return true;
+}
 
-      auto it = context->impl->pattern_cache.find(oldest_pattern);
-      if (it != context->impl->pattern_cache.end()) {
-        context->current_memory_usage -= it->second.memory_size;
-        onig_free(it->second.regex);
-        context->impl->pattern_cache.erase(it);
-      }
+/** Scan loop for kPatternCount patterns, fully unrolled at compile time;
+ *  0 loops over however many the scanner has. */
+template <int kPatternCount>
+static int scan_patterns(
+  OnigContext* context,
+  const char* text,
+  int text_length,
+  int start_pos,
+  SearchRegions* regions,
+  bool* compiled
+) {
+  int best_index = -1;
+  int best_match_pos = -1;
+  auto scan = [&](int i) {
+    return scan_pattern(context, i, text, text_length, start_pos, regions, &best_index, &best_match_pos, compiled);
+  };
+
+  if constexpr (kPatternCount > 0) {
+    [&]<int... kIndex>(std::integer_sequence<int, kIndex...>) {
+      (scan(kIndex) && ...);
+    }(std::make_integer_sequence<int, kPatternCount>());
+  } else {
+    for (int i = 0; i < context->pattern_count && scan(i); i++) {
     }
   }
+  return best_index;
+}
 
-  size_t memory_size = estimate_pattern_memory(pattern, regex);
-  check_memory_pressure(context);
+/** Most scanners vscode-textmate creates hold a rule's end pattern plus a few
+ *  nested rules, so counts up to SMALL_SCANNER_MAX_PATTERNS get their own
+ *  unrolled loop. */
+static ScanKernel select_scan_kernel(int pattern_count) {
+  static_assert(SMALL_SCANNER_MAX_PATTERNS == 4, "update the kernels below");
+  switch (pattern_count) {
+    case 1:
+      return scan_patterns<1>;
+    case 2:
+      return scan_patterns<2>;
+    case 3:
+      return scan_patterns<3>;
+    case 4:
+      return scan_patterns<4>;
+    default:
+      return scan_patterns<0>;
+  }
+}
 
-  CachedPattern cached_pattern{regex, time(nullptr), memory_size};
+// Scanner allocations start on a cache line, so the per-pattern arrays a
+// search walks share as few lines as possible with unrelated data.
+static constexpr size_t kScannerAlignment = 64;
 
-  context->impl->pattern_cache[pattern] = cached_pattern;
-  context->current_memory_usage += memory_size;
+static size_t align_up(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) & ~(alignment - 1);
 }
 
-/** Creates UTF-8 regex scanner with LRU pattern cache. nullptr on failure. */
-OnigContext* create_scanner(const char** patterns, int pattern_count, size_t max_cache_size) {
-  static bool initialized = false;
-  if (!initialized) {
-    OnigEncodingType* encodings[] = {ONIG_ENCODING_UTF8};
-    onig_initialize(encodings, 1);
-    initialized = true;
+/** Byte offsets of each part of a scanner's single allocation. */
+struct ScannerLayout {
+  size_t impl;
+  size_t anchors;
+  size_t literal_lengths;
+  size_t regexes;
+  size_t patterns;
+  size_t literals;
+  size_t source_offsets;
+  size_t source_bytes;
+  size_t size;
+};
+
+static ScannerLayout scanner_layout(size_t pattern_count, size_t source_bytes) {
+  ScannerLayout layout;
+  layout.impl = align_up(sizeof(OnigContext), alignof(OnigContextImpl));
+  layout.anchors = layout.impl + sizeof(OnigContextImpl);
+  layout.literal_lengths = layout.anchors + pattern_count;
+  layout.regexes = align_up(layout.literal_lengths + pattern_count, alignof(std::atomic<regex_t*>));
+  layout.patterns = layout.regexes + pattern_count * sizeof(std::atomic<regex_t*>);
+  layout.literals = layout.patterns + pattern_count * sizeof(std::atomic<CachedPattern*>);
+  layout.source_offsets = align_up(layout.literals + pattern_count * PATTERN_LITERAL_MAX, alignof(uint32_t));
+  layout.source_bytes = layout.source_offsets + (pattern_count + 1) * sizeof(uint32_t);
+  layout.size = layout.source_bytes + source_bytes;
+  return layout;
+}
+
+/** Allocates a scanner and fills in its sources and prefilter facts; patterns
+ *  are left uncompiled. Throws std::bad_alloc. */
+static OnigContext* scanner_allocate(const char** patterns, int pattern_count) {
+  const size_t count = static_cast<size_t>(pattern_count);
+  size_t source_bytes = 0;
+  for (size_t i = 0; i < count; i++) {
+    source_bytes += strlen(patterns[i]);
   }
 
+  const ScannerLayout layout = scanner_layout(count, source_bytes);
+  char* block = static_cast<char*>(::operator new(layout.size, std::align_val_t(kScannerAlignment)));
+  OnigContext* context = new (block) OnigContext();
+  OnigContextImpl* impl = new (block + layout.impl) OnigContextImpl();
+  context->impl = impl;
+  context->pattern_count = pattern_count;
+  impl->scan = select_scan_kernel(pattern_count);
+  impl->anchors = reinterpret_cast<uint8_t*>(block + layout.anchors);
+  impl->literal_lengths = reinterpret_cast<uint8_t*>(block + layout.literal_lengths);
+  impl->regexes = reinterpret_cast<std::atomic<regex_t*>*>(block + layout.regexes);
+  impl->patterns = reinterpret_cast<std::atomic<CachedPattern*>*>(block + layout.patterns);
+  impl->literals = reinterpret_cast<char (*)[PATTERN_LITERAL_MAX]>(block + layout.literals);
+  impl->source_offsets = reinterpret_cast<uint32_t*>(block + layout.source_offsets);
+  impl->source_bytes = block + layout.source_bytes;
+
+  uint32_t offset = 0;
+  for (size_t i = 0; i < count; i++) {
+    new (&impl->regexes[i]) std::atomic<regex_t*>(nullptr);
+    new (&impl->patterns[i]) std::atomic<CachedPattern*>(nullptr);
+
+    const std::string_view source(patterns[i]);
+    memcpy(impl->source_bytes + offset, source.data(), source.size());
+    impl->source_offsets[i] = offset;
+    offset += static_cast<uint32_t>(source.size());
+
+    PatternAnalysis analysis;
+    if (!pattern_bundle_find(source, &analysis)) {
+      analysis = pattern_analyze(source);
+    }
+    impl->anchors[i] = analysis.anchor;
+    impl->literal_lengths[i] = analysis.literal_length;
+    memcpy(impl->literals[i], analysis.literal, PATTERN_LITERAL_MAX);
+  }
+  impl->source_offsets[count] = offset;
+  return context;
+}
+
+/** Creates UTF-8 regex scanner backed by the shared pattern cache. nullptr on failure. */
+OnigContext* create_scanner(const char** patterns, int pattern_count, size_t max_cache_size) {
+  return create_scanner_with_flags(patterns, pattern_count, max_cache_size, ONIG_SCANNER_DEFAULT);
+}
+
+/** create_scanner with OnigScannerFlags. nullptr on failure. */
+OnigContext* create_scanner_with_flags(const char** patterns, int pattern_count, size_t max_cache_size, int flags) {
+  ensure_onig_initialized();
+  t_last_error.clear();
+
+  OnigContext* context = nullptr;
   try {
-    OnigContext* context = new OnigContext();
-    context->impl = new OnigContextImpl();
-    context->pattern_count = pattern_count;
+    context = scanner_allocate(patterns, pattern_count);
     context->max_cache_size = max_cache_size;
-    context->current_memory_usage = 0;
-    context->regexes = new regex_t*[static_cast<size_t>(pattern_count)];
-    context->region = onig_region_new();
-
-    for (int i = 0; i < pattern_count; i++) {
-      regex_t* regex = get_cached_pattern(context, patterns[i]);
-
-      if (!regex) {
-        OnigErrorInfo einfo;
-        int result = onig_new(
-          &regex,
-          (const OnigUChar*)patterns[i],
-          (const OnigUChar*)(patterns[i] + strlen(patterns[i])),
-          // ONIG_OPTION_CAPTURE_GROUP matches vscode-oniguruma: without it,
-          // oniguruma disables numbered captures in any pattern that also
-          // contains named groups, silently breaking TextMate `captures`
-          // scope assignment (tokens lose their colors).
-          ONIG_OPTION_CAPTURE_GROUP,
-          ONIG_ENCODING_UTF8,
-          ONIG_SYNTAX_DEFAULT,
-          &einfo
-        );
-
-        if (result != ONIG_NORMAL) {
-          onig_region_free(context->region, 1);
-          delete[] context->regexes;
-          delete context->impl;
-          delete context;
-          return nullptr;
-        }
-
-        cache_pattern(context, patterns[i], regex);
-      }
+    context->impl->lazy = (flags & ONIG_SCANNER_LAZY) != 0;
+    context->impl->last_used.store(coarse_monotonic_seconds(), std::memory_order_relaxed);
 
-      context->regexes[i] = regex;
-      context->impl->active_regexes.insert(regex);
+    if (!scanner_acquire_patterns_locked(context)) {
+      free_scanner(context);
+      return nullptr;
     }
-
-    return context;
   } catch (const std::bad_alloc&) {
+    t_last_error = "out of memory";
+    free_scanner(context);
     return nullptr;
   }
+
+  governor_register(context);
+  governor_enforce(context);
+  return context;
+}
+
+const char* scanner_last_error(void) {
+  return t_last_error.c_str();
+}
+
+/** Holds the scanner's lock shared for a search, recompiling its patterns
+ *  first if the governor hibernated it. False if recompilation failed. */
+static bool lock_for_search(OnigContext* context, std::shared_lock<std::shared_mutex>& lock) {
+  OnigContextImpl* impl = context->impl;
+  lock = std::shared_lock<std::shared_mutex>(impl->lock);
+
+  while (impl->hibernated.load(std::memory_order_relaxed)) {
+    lock.unlock();
+    {
+      std::unique_lock<std::shared_mutex> exclusive(impl->lock);
+      if (impl->hibernated.load(std::memory_order_relaxed) && !scanner_acquire_patterns_locked(context)) {
+        return false;
+      }
+    }
+    governor_enforce(context);
+    lock.lock();
+  }
+
+  impl->last_used.store(coarse_monotonic_seconds(), std::memory_order_relaxed);
+  return true;
 }
 
 /** Finds the leftmost match after start_pos across all patterns;
- *  position ties are won by the lowest pattern index (TextMate priority). */
+ *  position ties are won by the lowest pattern index (TextMate priority).
+ *  Thread-safe: concurrent calls on the same context only read its regexes.
+ *  A hibernated scanner is transparently recompiled before searching, and a
+ *  lazy scanner compiles each pattern when the scan first reaches it. */
 OnigResult* find_next_match(OnigContext* context, const char* text, int start_pos) {
   if (!context || !text || start_pos < 0) {
     return nullptr;
   }
 
+  SearchRegions* regions = thread_regions();
+  if (!regions) {
+    return nullptr;
+  }
+
+  std::shared_lock<std::shared_mutex> lock;
+  if (!lock_for_search(context, lock)) {
+    return nullptr;
+  }
+
   try {
-    OnigResult* result = new OnigResult();
-    result->pattern_index = -1;
-    result->capture_indices = nullptr;
-    result->capture_count = 0;
-    result->match_start = -1;
-    result->match_end = -1;
-
-    int text_length = strlen(text);
-    int best_match_pos = -1;
-
-    for (int i = 0; i < context->pattern_count; i++) {
-      onig_region_clear(context->region);
-
-      int match_pos = onig_search(
-        context->regexes[i],
-        (OnigUChar*)text,
-        (OnigUChar*)(text + text_length),
-        (OnigUChar*)(text + start_pos),
-        (OnigUChar*)(text + text_length),
-        context->region,
-        ONIG_OPTION_NONE
-      );
-
-      if (match_pos >= 0) {
-        // vscode-oniguruma contract: pick the LEFTMOST match; ties (same
-        // position) are won by the LOWEST pattern index — TextMate rule
-        // order is rule priority. Never tie-break by match length: that
-        // lets later rules steal matches and assigns wrong scopes.
-        if (best_match_pos < 0 || match_pos < best_match_pos) {
-          best_match_pos = match_pos;
-          result->pattern_index = i;
-          result->match_start = context->region->beg[0];
-          result->match_end = context->region->end[0];
-
-          delete[] result->capture_indices;
-          // capture_count is the number of capture groups; indices store start/end pairs.
-          result->capture_count = context->region->num_regs;
-          result->capture_indices = new int[result->capture_count * 2];
-
-          for (int j = 0; j < context->region->num_regs; j++) {
-            result->capture_indices[j * 2] = context->region->beg[j];
-            result->capture_indices[j * 2 + 1] = context->region->end[j];
-          }
-
-          // Nothing can match earlier than start_pos; later patterns could
-          // only tie and ties keep the current (earlier) pattern.
-          if (best_match_pos == start_pos) {
-            break;
-          }
-        }
-      }
+    bool compiled = false;
+    const int text_length = static_cast<int>(strlen(text));
+    const int pattern_index = context->impl->scan(context, text, text_length, start_pos, regions, &compiled);
+
+    if (compiled) {
+      governor_enforce(context);
     }
 
-    if (result->pattern_index >= 0) {
-      return result;
+    if (pattern_index < 0) {
+      return nullptr;
     }
 
-    delete result;
-    return nullptr;
+    // The result and its capture pairs share one allocation; free_result
+    // releases both.
+    const OnigRegion* region = regions->best;
+    const size_t capture_bytes = static_cast<size_t>(region->num_regs) * 2 * sizeof(int);
+    OnigResult* result = new (::operator new(sizeof(OnigResult) + capture_bytes)) OnigResult();
+    result->pattern_index = pattern_index;
+    result->match_start = region->beg[0];
+    result->match_end = region->end[0];
+    // capture_count is the number of capture groups; indices store start/end pairs.
+    result->capture_count = region->num_regs;
+    result->capture_indices = reinterpret_cast<int*>(result + 1);
+    for (int j = 0; j < region->num_regs; j++) {
+      result->capture_indices[j * 2] = region->beg[j];
+      result->capture_indices[j * 2 + 1] = region->end[j];
+    }
+    return result;
   } catch (const std::bad_alloc&) {
     return nullptr;
   }
 }
 
-/** Safe cleanup of match result and capture indices. */
+/** Compiles every pattern a lazy scanner hasn't reached yet, on the thread
+ *  pool for large sets. Meant for a background thread: searches running
+ *  meanwhile compile just the pattern they need, or pick up this one's. */
+int warm_scanner(OnigContext* context) {
+  t_last_error.clear();
+  if (!context) {
+    return -1;
+  }
+
+  std::shared_lock<std::shared_mutex> lock;
+  if (!lock_for_search(context, lock)) {
+    return -1;
+  }
+
+  OnigContextImpl* impl = context->impl;
+  const size_t count = static_cast<size_t>(context->pattern_count);
+  auto compile = [context, impl](size_t i) {
+    if (!impl->patterns[i].load(std::memory_order_acquire)) {
+      scanner_compile_pattern(context, static_cast<int>(i));
+    }
+  };
+  if (count >= PARALLEL_COMPILE_MIN_PATTERNS) {
+    thread_pool_parallel_for(count, compile);
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      compile(i);
+    }
+  }
+
+  int result = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (impl->patterns[i].load(std::memory_order_acquire) == failed_pattern()) {
+      std::string error;
+      pattern_cache_acquire(scanner_source(context, static_cast<int>(i)), &error);
+      t_last_error = "Invalid pattern at index " + std::to_string(i) + ": " + error;
+      result = -1;
+      break;
+    }
+  }
+
+  lock.unlock();
+  governor_enforce(context);
+  return result;
+}
+
+/** Compiles patterns into the shared cache without creating a scanner, so a
+ *  later create_scanner for them is only cache lookups. The compiled patterns
+ *  stay cached as idle entries, subject to normal eviction. Returns how many
+ *  failed to compile. */
+int preload_patterns(const char** patterns, int pattern_count, double* compile_time_ms) {
+  ensure_onig_initialized();
+
+  auto start = std::chrono::steady_clock::now();
+  int failed = 0;
+  for (int i = 0; i < pattern_count; i++) {
+    CachedPattern* entry = pattern_cache_acquire(patterns[i]);
+    if (entry) {
+      pattern_cache_release(entry);
+    } else {
+      failed++;
+    }
+  }
+
+  if (compile_time_ms) {
+    *compile_time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+  return failed;
+}
+
+/** Frees a match result together with its capture indices. */
 void free_result(OnigResult* result) {
   if (result) {
-    delete[] result->capture_indices;
-    delete result;
+    ::operator delete(result);
   }
 }
 
-/** RAII cleanup of scanner context and all cached patterns. */
+/** Releases the scanner and its references to shared cached patterns. */
 void free_scanner(OnigContext* context) {
   if (context) {
-    if (context->region) {
-      onig_region_free(context->region, 1);
-    }
+    governor_unregister(context);
+    scanner_release_patterns_locked(context);
+    context->impl->~OnigContextImpl();
+    ::operator delete(context, std::align_val_t(kScannerAlignment));
+  }
+}
 
-    for (auto regex : context->impl->active_regexes) {
-      onig_free(regex);
-    }
+void get_cache_stats(OnigCacheStats* stats) {
+  if (stats) {
+    pattern_cache_get_stats(stats);
+    governor_get_stats(stats);
+    scanner_store_get_stats(stats);
+    stats->lazy_compiles = g_lazy_compiles.load(std::memory_order_relaxed);
+    usage_profile_get_stats(stats);
+    pattern_bundle_get_stats(stats);
+  }
+}
 
-    delete[] context->regexes;
-    delete context->impl;
-    delete context;
+/** Bytes held by the scanner's compiled patterns. Patterns shared with other
+ *  scanners count towards each of them. */
+void get_scanner_stats(OnigContext* context, OnigScannerStats* stats) {
+  if (!context || !stats) {
+    return;
+  }
+
+  OnigContextImpl* impl = context->impl;
+  std::shared_lock<std::shared_mutex> lock(impl->lock);
+  stats->pattern_count = context->pattern_count;
+  stats->compiled_patterns = impl->compiled_patterns.load(std::memory_order_relaxed);
+  stats->lazy = impl->lazy ? 1 : 0;
+  stats->memory_usage = 0;
+  for (int i = 0; i < context->pattern_count; i++) {
+    const CachedPattern* entry = impl->patterns[i].load(std::memory_order_acquire);
+    if (entry && entry != failed_pattern()) {
+      stats->memory_usage += entry->memory_size;
+    }
   }
+  stats->exact_memory = memory_tracking_enabled() ? 1 : 0;
+  stats->hibernated = context->impl->hibernated.load(std::memory_order_relaxed) ? 1 : 0;
+  stats->handles = scanner_store_handles(context);
+}
+
+/** Sets the process-wide budget for compiled patterns across all scanners. */
+void set_memory_budget(size_t bytes) {
+  governor_set_budget(bytes);
+}
+
+/** Sets the process-wide cap on cached compiled patterns. */
+void set_cache_max_entries(size_t entries) {
+  pattern_cache_set_max_entries(entries);
+}
+
+/** Releases memory in response to OS pressure; see OnigTrimLevel. */
+size_t trim_memory(int level) {
+  return governor_trim(level);
 }
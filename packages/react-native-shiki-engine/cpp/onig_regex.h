@@ -9,19 +9,43 @@
 extern "C" {
 #endif
 
+/* Limits for the process-wide compiled pattern cache shared by all scanners. */
 #define MAX_CACHE_SIZE       1000
 #define CACHE_EXPIRY_SECONDS 3600
 #define CACHE_MEMORY_LIMIT   (50 * 1024 * 1024)
+/* Scanners unused this long are hibernated by ONIG_TRIM_IDLE_SCANNERS. */
+#define SCANNER_IDLE_SECONDS 30
+/* Eager scanners with at least this many patterns compile on the thread pool. */
+#define PARALLEL_COMPILE_MIN_PATTERNS 8
+/* Scanners with up to this many patterns search with an unrolled loop. */
+#define SMALL_SCANNER_MAX_PATTERNS 4
+
+/* Escalating responses to OS memory pressure, for trim_memory. */
+typedef enum OnigTrimLevel {
+  ONIG_TRIM_CACHE = 0,         /* drop compiled patterns no scanner uses */
+  ONIG_TRIM_IDLE_SCANNERS = 1, /* also hibernate scanners idle for SCANNER_IDLE_SECONDS */
+  ONIG_TRIM_ALL = 2,           /* hibernate every scanner not currently searching */
+} OnigTrimLevel;
+
+/* Flags for create_scanner_with_flags. */
+typedef enum OnigScannerFlags {
+  ONIG_SCANNER_DEFAULT = 0,
+  /* Compile each pattern the first time a search reaches it instead of up
+   * front. A pattern that fails to compile never matches rather than failing
+   * scanner creation. */
+  ONIG_SCANNER_LAZY = 1,
+} OnigScannerFlags;
 
 struct OnigContextImpl;
 
+/* Compiled patterns are shared read-only once compiled, so one context may be
+ * searched from several threads at once. Match state (region, result buffer)
+ * is per call/thread and never stored here. Compiled patterns live in impl and
+ * are dropped while the scanner is hibernated by the memory governor. */
 typedef struct OnigContext {
   struct OnigContextImpl* impl;
-  regex_t** regexes;
-  OnigRegion* region;
   int pattern_count;
   size_t max_cache_size;
-  size_t current_memory_usage;
 } OnigContext;
 
 typedef struct OnigResult {
@@ -32,10 +56,63 @@ typedef struct OnigResult {
   int match_end;
 } OnigResult;
 
+/* Memory figures are exact bytes held by Oniguruma when exact_memory is set
+ * (library built with allocation hooks), otherwise estimates. */
+typedef struct OnigCacheStats {
+  size_t entries;
+  size_t idle_entries;
+  size_t memory_usage;
+  size_t unowned_memory_usage;
+  int exact_memory;
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long evictions;
+  double compile_time_ms;
+  double compile_time_saved_ms;
+  size_t memory_budget;
+  size_t scanners;
+  size_t hibernated_scanners;
+  unsigned long long hibernations;
+  size_t scanner_handles;
+  unsigned long long scanner_dedup_hits;
+  unsigned long long lazy_compiles;
+  size_t profile_sets;
+  size_t profile_prewarmed_sets;
+  size_t bundle_patterns;
+  unsigned long long bundle_hits;
+} OnigCacheStats;
+
+typedef struct OnigScannerStats {
+  int pattern_count;
+  int compiled_patterns;
+  int lazy;
+  size_t memory_usage;
+  int exact_memory;
+  int hibernated;
+  size_t handles;
+} OnigScannerStats;
+
+/* max_cache_size is recorded on the context only; the shared cache's cap is
+ * process-wide and set with set_cache_max_entries. */
 OnigContext* create_scanner(const char** patterns, int pattern_count, size_t max_cache_size);
+OnigContext* create_scanner_with_flags(const char** patterns, int pattern_count, size_t max_cache_size, int flags);
 OnigResult* find_next_match(OnigContext* context, const char* text, int start_pos);
+/* Compiles patterns into the shared cache ahead of create_scanner. Returns the
+ * number that failed to compile; compile_time_ms receives the wall time. */
+int preload_patterns(const char** patterns, int pattern_count, double* compile_time_ms);
+/* Compiles every pattern a lazy scanner hasn't compiled yet. Returns 0, or -1
+ * with scanner_last_error() naming the lowest invalid pattern. */
+int warm_scanner(OnigContext* context);
+/* Why the last create_scanner or warm_scanner call on this thread failed. */
+const char* scanner_last_error(void);
 void free_result(OnigResult* result);
 void free_scanner(OnigContext* context);
+void get_cache_stats(OnigCacheStats* stats);
+void get_scanner_stats(OnigContext* context, OnigScannerStats* stats);
+void set_memory_budget(size_t bytes);
+/* Caps the compiled patterns the shared cache keeps, MAX_CACHE_SIZE by default. */
+void set_cache_max_entries(size_t entries);
+size_t trim_memory(int level);
 
 #ifdef __cplusplus
 }
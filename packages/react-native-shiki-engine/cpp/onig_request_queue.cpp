@@ -0,0 +1,152 @@
+#include "onig_request_queue.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "onig_thread_pool.hpp"
+
+static_assert((REQUEST_QUEUE_CAPACITY & (REQUEST_QUEUE_CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+// Bounded multi-producer multi-consumer ring (Vyukov). Each cell's sequence
+// says whose turn it is: pos when free for the producer claiming position
+// pos, pos + 1 once filled for the consumer claiming pos.
+struct RequestCell {
+  std::atomic<size_t> sequence{0};
+  std::function<void()> task;
+};
+
+struct RequestRing {
+  RequestRing() {
+    for (size_t i = 0; i < REQUEST_QUEUE_CAPACITY; i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  RequestCell cells[REQUEST_QUEUE_CAPACITY];
+  // Kept on separate cache lines so producers and consumers don't contend.
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
+
+struct RequestQueueState {
+  RequestRing rings[REQUEST_PRIORITY_COUNT];
+  // Workers currently draining the rings.
+  alignas(64) std::atomic<size_t> drainers{0};
+};
+
+/** Intentionally leaked, like the thread pool it feeds. */
+static RequestQueueState& queue_state() {
+  static RequestQueueState* state = new RequestQueueState();
+  return *state;
+}
+
+static bool try_push(RequestRing& ring, std::function<void()>& task) {
+  size_t pos = ring.enqueue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    RequestCell& cell = ring.cells[pos & (REQUEST_QUEUE_CAPACITY - 1)];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      // seq_cst, not relaxed: request_queue_post reads drainers next, and a
+      // drainer leaving at the same time must either be seen or see this.
+      if (ring.enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        cell.task = std::move(task);
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = ring.enqueue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+static bool try_pop(RequestRing& ring, std::function<void()>* task) {
+  size_t pos = ring.dequeue_pos.load(std::memory_order_relaxed);
+  for (;;) {
+    RequestCell& cell = ring.cells[pos & (REQUEST_QUEUE_CAPACITY - 1)];
+    const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+    if (diff == 0) {
+      if (ring.dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        *task = std::move(cell.task);
+        cell.task = nullptr;
+        cell.sequence.store(pos + REQUEST_QUEUE_CAPACITY, std::memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;
+    } else {
+      pos = ring.dequeue_pos.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+static bool has_pending(RequestRing& ring) {
+  return ring.enqueue_pos.load() != ring.dequeue_pos.load();
+}
+
+static bool has_pending_before(RequestQueueState& state, int priority) {
+  for (int i = 0; i < priority; i++) {
+    if (has_pending(state.rings[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Pops the most urgent task. */
+static bool try_pop_any(RequestQueueState& state, std::function<void()>* task) {
+  for (RequestRing& ring : state.rings) {
+    if (try_pop(ring, task)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/** Claims a drainer slot, if one is free. */
+static bool try_add_drainer(RequestQueueState& state) {
+  size_t drainers = state.drainers.load();
+  while (drainers < thread_pool_size()) {
+    if (state.drainers.compare_exchange_weak(drainers, drainers + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void drain(RequestQueueState& state) {
+  std::function<void()> task;
+  for (;;) {
+    while (try_pop_any(state, &task)) {
+      task();
+      task = nullptr;
+    }
+    state.drainers.fetch_sub(1);
+    // A producer that saw every slot taken before the decrement relies on
+    // this check to get its request run. The decrement and the loads are
+    // seq_cst, as is the producer's push, so one of the two sees the other.
+    if (!has_pending_before(state, REQUEST_PRIORITY_COUNT) || !try_add_drainer(state)) {
+      return;
+    }
+  }
+}
+
+void request_queue_post(std::function<void()> task, int priority) {
+  RequestQueueState& state = queue_state();
+  priority = priority < 0 ? 0 : (priority >= REQUEST_PRIORITY_COUNT ? REQUEST_PRIORITY_COUNT - 1 : priority);
+  if (!try_push(state.rings[priority], task)) {
+    thread_pool_post(std::move(task));
+    return;
+  }
+  if (try_add_drainer(state)) {
+    thread_pool_post([&state] { drain(state); });
+  }
+}
+
+bool request_queue_has_pending_before(int priority) {
+  return has_pending_before(queue_state(), priority);
+}
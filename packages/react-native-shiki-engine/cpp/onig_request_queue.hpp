@@ -0,0 +1,33 @@
+#ifndef ONIG_REQUEST_QUEUE_HPP
+#define ONIG_REQUEST_QUEUE_HPP
+
+#include <functional>
+
+// Feeds search requests from JS to the thread pool without taking a lock.
+// Requests go into bounded lock-free rings, one per priority, that up to
+// thread_pool_size() workers drain most urgent first, so a stream of small
+// requests neither contends on the pool's mutex nor wakes a worker each. When
+// a ring is full, requests are posted to the pool directly.
+
+#define REQUEST_QUEUE_CAPACITY 512
+
+enum RequestPriority : int {
+  // Lines on screen.
+  REQUEST_PRIORITY_VISIBLE = 0,
+  // Lines likely to scroll into view next.
+  REQUEST_PRIORITY_NEAR_VIEWPORT = 1,
+  // Everything else, e.g. the rest of a long document.
+  REQUEST_PRIORITY_BACKGROUND = 2,
+};
+
+#define REQUEST_PRIORITY_COUNT 3
+
+/** Queues task to run on a worker thread, ahead of any queued task of lower
+ *  priority. Tasks may run concurrently and, within a priority, out of order.
+ *  task must not throw. */
+void request_queue_post(std::function<void()> task, int priority);
+
+/** True if a task more urgent than priority is waiting for a worker. */
+bool request_queue_has_pending_before(int priority);
+
+#endif  // ONIG_REQUEST_QUEUE_HPP
@@ -0,0 +1,164 @@
+#include "onig_scanner_store.hpp"
+
+#include <mutex>
+#include <unordered_map>
+
+#include "onig_usage_profile.hpp"
+
+struct StoredScanner {
+  OnigContext* context;
+  size_t handles;
+  // Owning entry in ScannerStoreState::by_patterns, erased with the scanner.
+  const std::string* key;
+};
+
+struct ScannerStoreState {
+  std::mutex mutex;
+  std::unordered_map<std::string, StoredScanner*> by_patterns;
+  std::unordered_map<OnigContext*, StoredScanner*> by_context;
+  size_t handles = 0;
+  unsigned long long dedup_hits = 0;
+};
+
+/** Intentionally leaked, like the pattern cache, so late releases stay valid. */
+static ScannerStoreState& store_state() {
+  static ScannerStoreState* state = new ScannerStoreState();
+  return *state;
+}
+
+/** Flags followed by every source, length-prefixed so no two lists share a
+ *  key. Keyed by content rather than registry IDs, so scanners built from
+ *  plain strings never have to intern them. Flags lead the key since lazy
+ *  and eager scanners report compile errors differently. */
+static std::string pattern_list_key(const std::vector<const std::string*>& sources, int flags) {
+  size_t size = sizeof(int);
+  for (const std::string* source : sources) {
+    size += sizeof(size_t) + source->size();
+  }
+  std::string key;
+  key.reserve(size);
+  key.append(reinterpret_cast<const char*>(&flags), sizeof(int));
+  for (const std::string* source : sources) {
+    const size_t length = source->size();
+    key.append(reinterpret_cast<const char*>(&length), sizeof(size_t));
+    key.append(*source);
+  }
+  return key;
+}
+
+/** Takes another handle on an existing scanner. Caller holds state.mutex. */
+static OnigContext* share_locked(ScannerStoreState& state, StoredScanner* stored) {
+  stored->handles++;
+  state.handles++;
+  state.dedup_hits++;
+  return stored->context;
+}
+
+static OnigContext* acquire_sources(const std::vector<const std::string*>& sources, size_t max_cache_size, int flags) {
+  ScannerStoreState& state = store_state();
+  usage_profile_record(sources);
+  std::string key = pattern_list_key(sources, flags);
+
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto it = state.by_patterns.find(key);
+    if (it != state.by_patterns.end()) {
+      return share_locked(state, it->second);
+    }
+  }
+
+  // Compile outside the lock so unrelated scanners can be created meanwhile.
+  std::vector<const char*> pattern_ptrs;
+  pattern_ptrs.reserve(sources.size());
+  for (const std::string* source : sources) {
+    pattern_ptrs.push_back(source->c_str());
+  }
+  OnigContext* context =
+    create_scanner_with_flags(pattern_ptrs.data(), static_cast<int>(pattern_ptrs.size()), max_cache_size, flags);
+  if (!context) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto [it, inserted] = state.by_patterns.try_emplace(std::move(key), nullptr);
+  if (!inserted) {
+    // Lost a race with an identical list; its patterns came from the shared
+    // cache, so dropping this copy only releases references.
+    free_scanner(context);
+    return share_locked(state, it->second);
+  }
+
+  it->second = new StoredScanner{context, 1, &it->first};
+  state.by_context.emplace(context, it->second);
+  state.handles++;
+  return context;
+}
+
+OnigContext* scanner_store_acquire(const std::vector<std::string>& patterns, size_t max_cache_size, int flags) {
+  std::vector<const std::string*> sources;
+  sources.reserve(patterns.size());
+  for (const std::string& pattern : patterns) {
+    sources.push_back(&pattern);
+  }
+  return acquire_sources(sources, max_cache_size, flags);
+}
+
+OnigContext* scanner_store_acquire_ids(const std::vector<PatternId>& ids, size_t max_cache_size, int flags) {
+  std::vector<const std::string*> sources;
+  if (!pattern_registry_resolve(ids, &sources)) {
+    return nullptr;
+  }
+  return acquire_sources(sources, max_cache_size, flags);
+}
+
+bool scanner_store_retain(OnigContext* context) {
+  ScannerStoreState& state = store_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto it = state.by_context.find(context);
+  if (it == state.by_context.end()) {
+    return false;
+  }
+
+  it->second->handles++;
+  state.handles++;
+  return true;
+}
+
+bool scanner_store_release(OnigContext* context) {
+  ScannerStoreState& state = store_state();
+  StoredScanner* stored = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto it = state.by_context.find(context);
+    if (it == state.by_context.end()) {
+      return false;
+    }
+
+    state.handles--;
+    if (--it->second->handles > 0) {
+      return true;
+    }
+
+    stored = it->second;
+    state.by_context.erase(it);
+    state.by_patterns.erase(state.by_patterns.find(*stored->key));
+  }
+
+  free_scanner(stored->context);
+  delete stored;
+  return true;
+}
+
+size_t scanner_store_handles(OnigContext* context) {
+  ScannerStoreState& state = store_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto it = state.by_context.find(context);
+  return it == state.by_context.end() ? 0 : it->second->handles;
+}
+
+void scanner_store_get_stats(OnigCacheStats* stats) {
+  ScannerStoreState& state = store_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  stats->scanner_handles = state.handles;
+  stats->scanner_dedup_hits = state.dedup_hits;
+}
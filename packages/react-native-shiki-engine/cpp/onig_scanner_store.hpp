@@ -0,0 +1,39 @@
+#ifndef ONIG_SCANNER_STORE_HPP
+#define ONIG_SCANNER_STORE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "onig_pattern_registry.hpp"
+#include "onig_regex.h"
+
+// Scanners keyed by their exact pattern list. vscode-textmate rebuilds rule
+// scanners with identical lists whenever a grammar is reloaded or shared
+// between highlighters, so every request for a known list returns the same
+// context with one more handle instead of a fresh copy. Lists are compared by
+// content, so a scanner built from strings and one built from registry IDs
+// for the same sources are shared too; the store never registers patterns.
+
+/** Returns a scanner for patterns and OnigScannerFlags, holding one handle
+ *  for the caller. nullptr if the scanner can't be created. */
+OnigContext* scanner_store_acquire(const std::vector<std::string>& patterns, size_t max_cache_size, int flags);
+
+/** scanner_store_acquire for patterns already in the pattern registry.
+ *  nullptr if an ID isn't registered or the scanner can't be created. */
+OnigContext* scanner_store_acquire_ids(const std::vector<PatternId>& ids, size_t max_cache_size, int flags);
+
+/** Takes another handle on a live scanner, e.g. to keep it alive while a
+ *  background task uses it. Returns false if context isn't in the store. */
+bool scanner_store_retain(OnigContext* context);
+
+/** Drops a handle, freeing the scanner with its last one. Returns false if
+ *  context isn't a live scanner from this store. */
+bool scanner_store_release(OnigContext* context);
+
+/** Number of handles held on context, 0 if it isn't in the store. */
+size_t scanner_store_handles(OnigContext* context);
+
+void scanner_store_get_stats(OnigCacheStats* stats);
+
+#endif  // ONIG_SCANNER_STORE_HPP
@@ -0,0 +1,53 @@
+#include "onig_scheduler.hpp"
+
+static void post(const std::shared_ptr<ScheduledWork>& work);
+
+static void run(const std::shared_ptr<ScheduledWork>& work, uint32_t generation) {
+  // Stale entries left in another ring by a priority change, and entries
+  // posted while a step was already running, drop out here.
+  if (work->generation.load() != generation || work->running.exchange(true)) {
+    return;
+  }
+  if (work->finished) {
+    work->running.store(false);
+    return;
+  }
+
+  if (work->step(*work)) {
+    work->finished = true;
+    // Drops whatever the step captured, e.g. a promise, now rather than when
+    // the last stale entry leaves the queue.
+    work->step = nullptr;
+    work->running.store(false);
+    return;
+  }
+
+  work->running.store(false);
+  post(work);
+}
+
+static void post(const std::shared_ptr<ScheduledWork>& work) {
+  const uint32_t generation = work->generation.fetch_add(1) + 1;
+  request_queue_post([work, generation] { run(work, generation); }, work->priority.load());
+}
+
+void scheduler_submit(const std::shared_ptr<ScheduledWork>& work) {
+  post(work);
+}
+
+void scheduler_set_priority(const std::shared_ptr<ScheduledWork>& work, int priority) {
+  work->priority.store(priority);
+  // A running step sees the new priority when it yields and is requeued.
+  if (!work->running.load()) {
+    post(work);
+  }
+}
+
+void scheduler_cancel(const std::shared_ptr<ScheduledWork>& work) {
+  work->cancelled.store(true);
+  scheduler_set_priority(work, REQUEST_PRIORITY_VISIBLE);
+}
+
+bool scheduler_should_yield(const ScheduledWork& work) {
+  return request_queue_has_pending_before(work.priority.load(std::memory_order_relaxed));
+}
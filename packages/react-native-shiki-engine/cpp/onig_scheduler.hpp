@@ -0,0 +1,45 @@
+#ifndef ONIG_SCHEDULER_HPP
+#define ONIG_SCHEDULER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "onig_request_queue.hpp"
+
+// Long-running work, such as searching every line of a document, split into
+// steps on the request queue. A step runs until the work is done or something
+// more urgent is waiting, then the work goes back in the queue at its current
+// priority. Priorities can change at any time, e.g. as lines scroll into view,
+// and take effect at the next step.
+
+struct ScheduledWork {
+  /** Runs a step; returns true once the work is finished. Steps should poll
+   *  scheduler_should_yield between units of work and return false when it
+   *  says so, and finish early once cancelled is set. Steps of one work never
+   *  run concurrently. */
+  std::function<bool(ScheduledWork& work)> step;
+  std::atomic<int> priority{REQUEST_PRIORITY_BACKGROUND};
+  std::atomic<bool> cancelled{false};
+
+  // Scheduler state. Every queued entry carries the generation it was posted
+  // with; only the latest one runs, so moving work between priorities
+  // doesn't have to take it out of its old ring.
+  std::atomic<uint32_t> generation{0};
+  std::atomic<bool> running{false};
+  bool finished = false;
+};
+
+void scheduler_submit(const std::shared_ptr<ScheduledWork>& work);
+
+void scheduler_set_priority(const std::shared_ptr<ScheduledWork>& work, int priority);
+
+/** Sets work->cancelled and moves the work to the front of the queue, so its
+ *  step can finish it without waiting behind other work. */
+void scheduler_cancel(const std::shared_ptr<ScheduledWork>& work);
+
+/** True if the running step should return to let more urgent work run. */
+bool scheduler_should_yield(const ScheduledWork& work);
+
+#endif  // ONIG_SCHEDULER_HPP
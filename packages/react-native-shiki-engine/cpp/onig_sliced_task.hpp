@@ -0,0 +1,108 @@
+#ifndef ONIG_SLICED_TASK_HPP
+#define ONIG_SLICED_TASK_HPP
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+// Coroutine for work that has to share a thread with a UI, e.g. searching on
+// the JS thread where no background threads are available. The body marks
+// where it may pause with `co_await SliceCheckpoint{}`; run_slice resumes it
+// until a checkpoint is reached after the slice's budget is used up, and the
+// task keeps its locals until the next run_slice picks up from there.
+//
+//   SlicedTask work(...) {
+//     for (...) {
+//       co_await SliceCheckpoint{};
+//       ...one unit of work...
+//     }
+//   }
+
+class SlicedTask {
+ public:
+  struct promise_type {
+    std::chrono::steady_clock::time_point slice_end;
+    std::exception_ptr exception;
+
+    SlicedTask get_return_object() {
+      return SlicedTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    // Nothing runs until the first slice.
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    // Kept suspended at the end so done() stays readable; the task frees it.
+    std::suspend_always final_suspend() noexcept {
+      return {};
+    }
+
+    void return_void() {}
+
+    void unhandled_exception() {
+      exception = std::current_exception();
+    }
+  };
+
+  SlicedTask(SlicedTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  SlicedTask& operator=(SlicedTask&& other) noexcept {
+    if (this != &other) {
+      destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+
+  ~SlicedTask() {
+    destroy();
+  }
+
+  /** Runs the task for about budget; returns true once it has finished.
+   *  Rethrows anything the body threw. */
+  bool run_slice(std::chrono::steady_clock::duration budget) {
+    if (done()) {
+      return true;
+    }
+    handle_.promise().slice_end = std::chrono::steady_clock::now() + budget;
+    handle_.resume();
+    if (handle_.promise().exception) {
+      std::rethrow_exception(std::exchange(handle_.promise().exception, nullptr));
+    }
+    return done();
+  }
+
+  bool done() const {
+    return !handle_ || handle_.done();
+  }
+
+ private:
+  explicit SlicedTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  void destroy() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/** Suspends the task if its slice is used up, and otherwise costs one clock
+ *  read. */
+struct SliceCheckpoint {
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  bool await_suspend(std::coroutine_handle<SlicedTask::promise_type> handle) const noexcept {
+    return std::chrono::steady_clock::now() >= handle.promise().slice_end;
+  }
+
+  void await_resume() const noexcept {}
+};
+
+#endif  // ONIG_SLICED_TASK_HPP
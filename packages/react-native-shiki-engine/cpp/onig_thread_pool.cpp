@@ -0,0 +1,202 @@
+#include "onig_thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__APPLE__)
+#  include <pthread.h>
+#  include <sys/qos.h>
+#elif defined(__linux__)
+#  include <sys/resource.h>
+#endif
+
+struct ThreadPoolState {
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<std::function<void()>> tasks;
+  size_t workers = 0;
+};
+
+static void worker_loop(ThreadPoolState* state, bool background) {
+  if (background) {
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#elif defined(__linux__)
+    // Linux (and Android) nice values are per thread; 0 means the caller.
+    setpriority(PRIO_PROCESS, 0, 10);
+#endif
+  }
+
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(state->mutex);
+      state->wake.wait(lock, [state] { return !state->tasks.empty(); });
+      task = std::move(state->tasks.front());
+      state->tasks.pop_front();
+    }
+    task();
+  }
+}
+
+/** Intentionally leaked with its detached workers, which idle on the
+ *  condition variable for the life of the process. */
+static ThreadPoolState& pool_state() {
+  static ThreadPoolState* state = [] {
+    auto* state = new ThreadPoolState();
+    const unsigned cores = std::thread::hardware_concurrency();
+    // Leave a core for the thread that's waiting on the results.
+    state->workers = std::clamp<size_t>(cores > 1 ? cores - 1 : 1, 1, THREAD_POOL_MAX_WORKERS);
+    for (size_t i = 0; i < state->workers; i++) {
+      std::thread(worker_loop, state, false).detach();
+    }
+    return state;
+  }();
+  return *state;
+}
+
+void thread_pool_post(std::function<void()> task) {
+  ThreadPoolState& state = pool_state();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.tasks.push_back(std::move(task));
+  }
+  state.wake.notify_one();
+}
+
+void thread_pool_post_background(std::function<void()> task) {
+  static ThreadPoolState* state = [] {
+    auto* state = new ThreadPoolState();
+    state->workers = 1;
+    std::thread(worker_loop, state, true).detach();
+    return state;
+  }();
+
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->tasks.push_back(std::move(task));
+  }
+  state->wake.notify_one();
+}
+
+size_t thread_pool_size() {
+  return pool_state().workers;
+}
+
+// A participant's share of a parallel_for: indices [begin, end), packed as
+// begin << 32 | end so the owner taking from the front and thieves taking
+// from the back agree through one compare-and-swap.
+struct alignas(64) StealableRange {
+  std::atomic<uint64_t> bounds{0};
+};
+
+static uint64_t pack_range(uint64_t begin, uint64_t end) {
+  return begin << 32 | end;
+}
+
+/** Work-stealing state shared with helper tasks. Indices start out split
+ *  evenly between the participants, so each mostly works through a
+ *  contiguous run of its own; one that runs dry steals the back half of
+ *  another's remaining run. Helpers that only get scheduled after every index
+ *  is taken touch nothing but the ranges, so the caller can return without
+ *  waiting for them. */
+struct ParallelForJob {
+  ParallelForJob(size_t count, size_t participants, const std::function<void(size_t)>* fn)
+    : ranges(new StealableRange[participants]), participants(participants), count(count), fn(fn) {
+    for (size_t i = 0; i < participants; i++) {
+      ranges[i].bounds.store(pack_range(count * i / participants, count * (i + 1) / participants));
+    }
+  }
+
+  std::unique_ptr<StealableRange[]> ranges;
+  const size_t participants;
+  const size_t count;
+  const std::function<void(size_t)>* fn;
+  // Slot 0 is the caller's; helpers claim the rest as they start.
+  std::atomic<size_t> next_slot{1};
+  std::mutex mutex;
+  std::condition_variable done;
+  size_t completed = 0;
+
+  bool take(size_t slot, size_t* index) {
+    uint64_t bounds = ranges[slot].bounds.load();
+    for (;;) {
+      const uint64_t begin = bounds >> 32;
+      const uint64_t end = bounds & 0xffffffff;
+      if (begin >= end) {
+        return false;
+      }
+      if (ranges[slot].bounds.compare_exchange_weak(bounds, pack_range(begin + 1, end))) {
+        *index = begin;
+        return true;
+      }
+    }
+  }
+
+  /** Moves the back half of another participant's range into slot's, which
+   *  is empty. Returns false once there is nothing left to steal. */
+  bool steal(size_t slot) {
+    for (size_t offset = 1; offset < participants; offset++) {
+      StealableRange& victim = ranges[(slot + offset) % participants];
+      uint64_t bounds = victim.bounds.load();
+      for (;;) {
+        const uint64_t begin = bounds >> 32;
+        const uint64_t end = bounds & 0xffffffff;
+        if (begin >= end) {
+          break;
+        }
+        const uint64_t mid = begin + (end - begin) / 2;
+        if (victim.bounds.compare_exchange_weak(bounds, pack_range(begin, mid))) {
+          ranges[slot].bounds.store(pack_range(mid, end));
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  void run(size_t slot) {
+    size_t ran = 0;
+    size_t index;
+    do {
+      while (take(slot, &index)) {
+        (*fn)(index);
+        ran++;
+      }
+    } while (steal(slot));
+
+    if (ran > 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      completed += ran;
+      if (completed == count) {
+        done.notify_all();
+      }
+    }
+  }
+};
+
+void thread_pool_parallel_for(size_t count, const std::function<void(size_t)>& fn) {
+  if (count == 0) {
+    return;
+  }
+  if (count == 1) {
+    fn(0);
+    return;
+  }
+
+  const size_t helpers = std::min(thread_pool_size(), count - 1);
+  auto job = std::make_shared<ParallelForJob>(count, helpers + 1, &fn);
+  for (size_t i = 0; i < helpers; i++) {
+    thread_pool_post([job] { job->run(job->next_slot.fetch_add(1)); });
+  }
+
+  job->run(0);
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->done.wait(lock, [&job] { return job->completed == job->count; });
+}
@@ -0,0 +1,32 @@
+#ifndef ONIG_THREAD_POOL_HPP
+#define ONIG_THREAD_POOL_HPP
+
+#include <cstddef>
+#include <functional>
+
+// Small process-wide worker pool for CPU-bound work such as compiling a
+// scanner's patterns. One worker fewer than the device's cores, capped at
+// THREAD_POOL_MAX_WORKERS, and started on first use. parallel_for therefore
+// runs on at most THREAD_POOL_MAX_WORKERS + 1 threads, counting the caller,
+// however many cores the device has.
+
+#define THREAD_POOL_MAX_WORKERS 4
+
+/** Runs fn(0) .. fn(count - 1) across the pool and returns once all have
+ *  finished. Each thread works through its own share of the indices in order
+ *  and steals from the others when it runs out, so uneven items balance out.
+ *  The calling thread takes a share too, so this makes progress even when
+ *  every worker is busy. fn must not throw. */
+void thread_pool_parallel_for(size_t count, const std::function<void(size_t)>& fn);
+
+/** Queues task to run on a worker thread. task must not throw. */
+void thread_pool_post(std::function<void()> task);
+
+/** Queues task on a single low-priority thread for speculative work, such as
+ *  warming caches at startup, that must not compete with the UI. Tasks run
+ *  one at a time in order. task must not throw. */
+void thread_pool_post_background(std::function<void()> task);
+
+size_t thread_pool_size();
+
+#endif  // ONIG_THREAD_POOL_HPP
@@ -0,0 +1,324 @@
+#include "onig_usage_profile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+#include "onig_thread_pool.hpp"
+
+// File layout, native byte order (the file never leaves the device):
+//   u32 magic, u32 version
+//   u32 pattern_count, then per pattern: u32 length, bytes
+//   u32 set_count, then per set: u64 hash, u32 hotness, u32 size, u32 pattern_index[size]
+static constexpr uint32_t kProfileMagic = 0x504b4853;  // "SHKP"
+static constexpr uint32_t kProfileVersion = 1;
+// Sanity limits so a corrupt file can't trigger huge allocations.
+static constexpr uint32_t kMaxProfileItems = 1u << 20;
+static constexpr uint32_t kMaxPatternLength = 1u << 20;
+
+struct ProfileSet {
+  uint32_t hotness = 0;
+  std::vector<uint32_t> patterns;
+};
+
+struct UsageProfileState {
+  std::mutex mutex;
+  std::atomic<bool> enabled{false};
+  std::string path;
+  std::vector<std::string> patterns;
+  std::unordered_map<std::string, uint32_t> pattern_ids;
+  std::unordered_map<uint64_t, ProfileSet> sets;
+  bool save_pending = false;
+  size_t prewarmed_sets = 0;
+};
+
+/** Intentionally leaked, like the pattern cache. */
+static UsageProfileState& profile_state() {
+  static UsageProfileState* state = new UsageProfileState();
+  return *state;
+}
+
+/** FNV-1a over length-prefixed patterns: stable across launches and builds,
+ *  unlike std::hash. */
+static uint64_t pattern_set_hash(const std::vector<const std::string*>& patterns) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&hash](const void* data, size_t size) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+  };
+  for (const std::string* pattern : patterns) {
+    const uint64_t size = pattern->size();
+    mix(&size, sizeof(size));
+    mix(pattern->data(), pattern->size());
+  }
+  return hash;
+}
+
+static uint32_t intern_pattern_locked(UsageProfileState& state, const std::string& pattern) {
+  auto [it, inserted] = state.pattern_ids.try_emplace(pattern, static_cast<uint32_t>(state.patterns.size()));
+  if (inserted) {
+    state.patterns.push_back(pattern);
+  }
+  return it->second;
+}
+
+template <typename T>
+static bool read_value(FILE* file, T* value) {
+  return fread(value, sizeof(T), 1, file) == 1;
+}
+
+template <typename T>
+static void write_value(FILE* file, T value) {
+  fwrite(&value, sizeof(T), 1, file);
+}
+
+struct LoadedProfile {
+  std::vector<std::string> patterns;
+  std::vector<std::pair<uint64_t, ProfileSet>> sets;
+};
+
+/** Reads a profile written by save_profile. Any inconsistency discards the
+ *  whole file; a profile is only an optimization. */
+static bool load_profile(FILE* file, LoadedProfile* profile) {
+  uint32_t magic = 0;
+  uint32_t version = 0;
+  uint32_t pattern_count = 0;
+  if (!read_value(file, &magic) || magic != kProfileMagic || !read_value(file, &version) ||
+      version != kProfileVersion || !read_value(file, &pattern_count) || pattern_count > kMaxProfileItems) {
+    return false;
+  }
+
+  profile->patterns.resize(pattern_count);
+  for (auto& pattern : profile->patterns) {
+    uint32_t length = 0;
+    if (!read_value(file, &length) || length > kMaxPatternLength) {
+      return false;
+    }
+    pattern.resize(length);
+    if (length > 0 && fread(pattern.data(), 1, length, file) != length) {
+      return false;
+    }
+  }
+
+  uint32_t set_count = 0;
+  if (!read_value(file, &set_count) || set_count > kMaxProfileItems) {
+    return false;
+  }
+  for (uint32_t i = 0; i < set_count; i++) {
+    uint64_t hash = 0;
+    ProfileSet set;
+    uint32_t size = 0;
+    if (!read_value(file, &hash) || !read_value(file, &set.hotness) || !read_value(file, &size) ||
+        size > pattern_count) {
+      return false;
+    }
+    set.patterns.resize(size);
+    for (auto& index : set.patterns) {
+      if (!read_value(file, &index) || index >= pattern_count) {
+        return false;
+      }
+    }
+    // Halve (rounding up) on every launch so sets the user stopped opening
+    // sink below current ones and eventually fall past USAGE_PROFILE_MAX_SETS.
+    set.hotness = set.hotness / 2 + set.hotness % 2;
+    profile->sets.emplace_back(hash, std::move(set));
+  }
+  return true;
+}
+
+/** Sets ordered hottest first. */
+static std::vector<std::pair<uint64_t, const ProfileSet*>> sets_by_hotness_locked(const UsageProfileState& state) {
+  std::vector<std::pair<uint64_t, const ProfileSet*>> sets;
+  sets.reserve(state.sets.size());
+  for (const auto& [hash, set] : state.sets) {
+    sets.emplace_back(hash, &set);
+  }
+  std::sort(sets.begin(), sets.end(), [](const auto& a, const auto& b) {
+    return a.second->hotness != b.second->hotness ? a.second->hotness > b.second->hotness : a.first < b.first;
+  });
+  return sets;
+}
+
+/** Keeps only the hottest USAGE_PROFILE_MAX_SETS sets and the patterns they
+ *  use, in memory as well as on disk, so a long session that compiles many
+ *  distinct sets doesn't grow the tables without bound. */
+static void trim_locked(UsageProfileState& state) {
+  auto sets = sets_by_hotness_locked(state);
+  if (sets.size() <= USAGE_PROFILE_MAX_SETS) {
+    return;
+  }
+  for (size_t i = USAGE_PROFILE_MAX_SETS; i < sets.size(); i++) {
+    state.sets.erase(sets[i].first);
+  }
+
+  std::unordered_map<uint32_t, uint32_t> remap;
+  std::vector<std::string> patterns;
+  for (auto& [hash, set] : state.sets) {
+    for (uint32_t& index : set.patterns) {
+      auto [it, inserted] = remap.try_emplace(index, static_cast<uint32_t>(patterns.size()));
+      if (inserted) {
+        patterns.push_back(std::move(state.patterns[index]));
+      }
+      index = it->second;
+    }
+  }
+  state.patterns = std::move(patterns);
+  state.pattern_ids.clear();
+  for (uint32_t i = 0; i < state.patterns.size(); i++) {
+    state.pattern_ids.emplace(state.patterns[i], i);
+  }
+}
+
+/** Trims the profile, then writes it next to its path and renames it into
+ *  place. */
+static void save_profile() {
+  UsageProfileState& state = profile_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.save_pending = false;
+  trim_locked(state);
+
+  const std::string temp_path = state.path + ".tmp";
+  FILE* file = fopen(temp_path.c_str(), "wb");
+  if (!file) {
+    return;
+  }
+
+  write_value(file, kProfileMagic);
+  write_value(file, kProfileVersion);
+  write_value(file, static_cast<uint32_t>(state.patterns.size()));
+  for (const std::string& pattern : state.patterns) {
+    write_value(file, static_cast<uint32_t>(pattern.size()));
+    fwrite(pattern.data(), 1, pattern.size(), file);
+  }
+  write_value(file, static_cast<uint32_t>(state.sets.size()));
+  for (const auto& [hash, set] : sets_by_hotness_locked(state)) {
+    write_value(file, hash);
+    write_value(file, set->hotness);
+    write_value(file, static_cast<uint32_t>(set->patterns.size()));
+    for (uint32_t index : set->patterns) {
+      write_value(file, index);
+    }
+  }
+
+  const bool ok = ferror(file) == 0;
+  if (fclose(file) == 0 && ok) {
+    std::rename(temp_path.c_str(), state.path.c_str());
+  } else {
+    std::remove(temp_path.c_str());
+  }
+}
+
+/** Merges the saved profile into this session's and prewarms its sets,
+ *  hottest first. Runs on the background lane, off the JS thread. */
+static void load_and_prewarm() {
+  UsageProfileState& state = profile_state();
+  std::string path;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    path = state.path;
+  }
+
+  LoadedProfile profile;
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file) {
+    return;
+  }
+  const bool loaded = load_profile(file, &profile);
+  fclose(file);
+  if (!loaded) {
+    return;
+  }
+
+  std::sort(profile.sets.begin(), profile.sets.end(), [](const auto& a, const auto& b) {
+    return a.second.hotness != b.second.hotness ? a.second.hotness > b.second.hotness : a.first < b.first;
+  });
+
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (const auto& [hash, loaded_set] : profile.sets) {
+      // Sets already used this session keep their patterns; add past heat.
+      ProfileSet& set = state.sets[hash];
+      if (set.patterns.empty()) {
+        for (uint32_t index : loaded_set.patterns) {
+          set.patterns.push_back(intern_pattern_locked(state, profile.patterns[index]));
+        }
+      }
+      set.hotness = loaded_set.hotness > UINT32_MAX - set.hotness ? UINT32_MAX : set.hotness + loaded_set.hotness;
+    }
+  }
+
+  // One task per set so saves and explicit preloads can interleave.
+  for (const auto& [hash, set] : profile.sets) {
+    std::vector<std::string> patterns;
+    patterns.reserve(set.patterns.size());
+    for (uint32_t index : set.patterns) {
+      patterns.push_back(profile.patterns[index]);
+    }
+
+    thread_pool_post_background([patterns = std::move(patterns)] {
+      std::vector<const char*> pattern_ptrs;
+      pattern_ptrs.reserve(patterns.size());
+      for (const auto& pattern : patterns) {
+        pattern_ptrs.push_back(pattern.c_str());
+      }
+      preload_patterns(pattern_ptrs.data(), static_cast<int>(pattern_ptrs.size()), nullptr);
+
+      UsageProfileState& state = profile_state();
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.prewarmed_sets++;
+    });
+  }
+}
+
+void usage_profile_open(const std::string& path) {
+  UsageProfileState& state = profile_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  if (state.enabled.load(std::memory_order_relaxed) || path.empty()) {
+    return;
+  }
+  state.path = path;
+  state.enabled.store(true, std::memory_order_release);
+
+  // Queued before any save can be, so the first save already includes the
+  // previous launches' sets.
+  thread_pool_post_background(load_and_prewarm);
+}
+
+void usage_profile_record(const std::vector<const std::string*>& patterns) {
+  UsageProfileState& state = profile_state();
+  if (!state.enabled.load(std::memory_order_acquire)) {
+    return;
+  }
+
+  const uint64_t hash = pattern_set_hash(patterns);
+  std::lock_guard<std::mutex> lock(state.mutex);
+  ProfileSet& set = state.sets[hash];
+  if (set.patterns.empty()) {
+    set.patterns.reserve(patterns.size());
+    for (const std::string* pattern : patterns) {
+      set.patterns.push_back(intern_pattern_locked(state, *pattern));
+    }
+  }
+  if (set.hotness < UINT32_MAX) {
+    set.hotness++;
+  }
+
+  // Coalesce bursts (a grammar creates many scanners at once) into one write.
+  if (!state.save_pending) {
+    state.save_pending = true;
+    thread_pool_post_background(save_profile);
+  }
+}
+
+void usage_profile_get_stats(OnigCacheStats* stats) {
+  UsageProfileState& state = profile_state();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  stats->profile_sets = state.sets.size();
+  stats->profile_prewarmed_sets = state.prewarmed_sets;
+}
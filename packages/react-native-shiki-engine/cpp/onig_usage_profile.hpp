@@ -0,0 +1,27 @@
+#ifndef ONIG_USAGE_PROFILE_HPP
+#define ONIG_USAGE_PROFILE_HPP
+
+#include <string>
+#include <vector>
+
+#include "onig_regex.h"
+
+// Remembers which pattern sets an app compiles and how often, in a file the
+// host owns, and compiles the hottest of them in the background on the next
+// launch. Sets are identified by a stable 64-bit hash; their patterns are
+// stored once in a shared string table, since a hash alone can't be compiled.
+
+/** Most sets kept in a profile; the coldest are dropped beyond this. */
+#define USAGE_PROFILE_MAX_SETS 256
+
+/** Records into the profile at path from now on, and in the background loads
+ *  what earlier launches saved there and prewarms those sets hottest first.
+ *  Later calls are ignored. */
+void usage_profile_open(const std::string& path);
+
+/** Counts one use of a pattern set. No-op until a profile is open. */
+void usage_profile_record(const std::vector<const std::string*>& patterns);
+
+void usage_profile_get_stats(OnigCacheStats* stats);
+
+#endif  // ONIG_USAGE_PROFILE_HPP
@@ -1,9 +1,70 @@
-import type { TurboModule } from 'react-native'
+import type { IOnigMatch } from '@shikijs/vscode-textmate'
+import type { CodegenTypes, TurboModule } from 'react-native'
 import { TurboModuleRegistry } from 'react-native'
 
+export interface CacheStats {
+  readonly entries: number
+  readonly idleEntries: number
+  readonly memoryUsage: number
+  readonly unownedMemoryUsage: number
+  readonly exactMemory: boolean
+  readonly hits: number
+  readonly misses: number
+  readonly hitRate: number
+  readonly evictions: number
+  readonly compileTimeMs: number
+  readonly compileTimeSavedMs: number
+  readonly memoryBudget: number
+  readonly scanners: number
+  readonly hibernatedScanners: number
+  readonly hibernations: number
+  readonly scannerHandles: number
+  readonly scannerDedupHits: number
+  readonly lazyCompiles: number
+  readonly profileSets: number
+  readonly profilePrewarmedSets: number
+  readonly bundlePatterns: number
+  readonly bundleHits: number
+}
+
+export interface ScannerStats {
+  readonly patternCount: number
+  readonly compiledPatterns: number
+  readonly lazy: boolean
+  readonly memoryUsage: number
+  readonly exactMemory: boolean
+  readonly hibernated: boolean
+  readonly handles: number
+}
+
+/**
+ * Scanner returned by createScannerObject. Its methods search the native
+ * scanner directly and may be called detached from it. The native scanner is
+ * freed on dispose(), or once the object and its methods are garbage collected.
+ */
+export interface NativeScanner {
+  readonly findNextMatchSync: (text: string, startPosition: number) => IOnigMatch | null
+  /** Like Spec.findNextMatchPacked, writing into the same match buffer. */
+  readonly findNextMatchPacked: (text: string, startPosition: number) => number
+  readonly dispose: () => void
+}
+
 export interface Spec extends TurboModule {
   readonly getConstants: () => {}
-  readonly createScanner: (patterns: readonly string[], maxCacheSize: number) => number
+  readonly createScanner: (patterns: readonly string[], maxCacheSize: number, lazy: boolean) => number
+  /** A NativeScanner, or null where the platform only supports scanner IDs. */
+  readonly createScannerObject: (
+    patterns: readonly string[],
+    maxCacheSize: number,
+    lazy: boolean,
+  ) => CodegenTypes.UnsafeObject | null
+  readonly registerPatterns: (patterns: string, endOffsets: readonly number[]) => number[]
+  readonly createScannerFromIds: (ids: readonly number[], maxCacheSize: number, lazy: boolean) => number
+  readonly createScannerAsync: (patterns: readonly string[], maxCacheSize: number) => Promise<number>
+  readonly preloadPatterns: (
+    patternSets: ReadonlyArray<readonly string[]>,
+    onProgress: (setIndex: number, compileTimeMs: number) => void,
+  ) => Promise<number[]>
   readonly findNextMatchSync: (
     scannerId: number,
     text: string,
@@ -16,7 +77,119 @@ export interface Spec extends TurboModule {
       readonly length: number
     }>
   } | null
+  /** Shared ArrayBuffer that findNextMatchPacked writes matches into, if supported. */
+  readonly getMatchBuffer: () => CodegenTypes.UnsafeObject | null
+  /**
+   * Writes the match into the match buffer as int32
+   * [index, start0, end0, start1, end1, ...] and returns its capture count:
+   * -1 for no match, -2 when the match has to be read with findNextMatchSync.
+   */
+  readonly findNextMatchPacked: (scannerId: number, text: string, startPosition: number) => number
+  /**
+   * Bulk regex probe: runs one search per line from its start position on a
+   * background thread, ahead of requests with a lower priority (0 = most
+   * urgent). This is not tokenization; see tokenizeLinesAsync. scanner is a
+   * NativeScanner or {id} for a scanner ID. Resolves with, per line,
+   * [captureCount, index, start0, end0, ...] or [-1] for no match, or rejects
+   * once cancelRequest(requestId) has stopped it.
+   */
+  readonly findNextMatchesAsync: (
+    requestId: number,
+    scanner: CodegenTypes.UnsafeObject,
+    lines: readonly string[],
+    startPositions: readonly number[],
+    priority: number,
+  ) => Promise<number[]>
+  readonly setRequestPriority: (requestId: number, priority: number) => void
+  /**
+   * Finds every match in each text with the scanner at the same index, the
+   * texts spread across the engine's worker pool, which is capped at four
+   * threads. A regex probe, not tokenization; see tokenizeSnippetsAsync.
+   * Resolves with, per text, the match count followed by each match as
+   * findNextMatchesAsync lays it out.
+   */
+  readonly findAllMatchesAsync: (
+    scanners: readonly CodegenTypes.UnsafeObject[],
+    texts: readonly string[],
+  ) => Promise<number[]>
+  /**
+   * findNextMatchesAsync on the JS thread, for runtimes without background
+   * threads: searches for up to sliceBudgetMs at a time, then lets other JS
+   * work run before continuing. A regex probe like findNextMatchesAsync; see
+   * tokenizeLinesSliced. Cancelled with cancelRequest(requestId).
+   */
+  readonly findNextMatchesSliced: (
+    requestId: number,
+    scanner: CodegenTypes.UnsafeObject,
+    lines: readonly string[],
+    startPositions: readonly number[],
+    sliceBudgetMs: number,
+  ) => Promise<number[]>
+  readonly cancelRequest: (requestId: number) => void
   readonly destroyScanner: (scannerId: number) => void
+  readonly getCacheStats: () => CacheStats
+  readonly getScannerStats: (scannerId: number) => ScannerStats
+  readonly setMemoryBudget: (bytes: number) => void
+  /** Caps the compiled patterns kept in the process-wide cache. */
+  readonly setCacheSize: (entries: number) => void
+  readonly trimMemory: (level: number) => number
+  readonly setUsageProfilePath: (path: string) => void
+  readonly loadPatternBundle: (path: string) => boolean
+  /**
+   * Compiles a TextMate grammar for tokenizeLine. Returns {grammar, scopeNames}:
+   * the compiled grammar and every scope name its tokens can carry, or null
+   * where the platform has no native tokenizer.
+   */
+  readonly loadGrammar: (grammar: CodegenTypes.UnsafeObject) => CodegenTypes.UnsafeObject | null
+  /**
+   * Tokenizes one line, continuing from the rule stack the previous line ended
+   * with (null for the first line). Returns {tokens, ruleStack}, with tokens as
+   * [startIndex, endIndex, scopeCount, ...scopeIndices] into scopeNames.
+   */
+  readonly tokenizeLine: (
+    grammar: CodegenTypes.UnsafeObject,
+    line: string,
+    ruleStack: CodegenTypes.UnsafeObject | null,
+  ) => CodegenTypes.UnsafeObject
+  /**
+   * Tokenizes lines on a background thread, continuing from ruleStack (null
+   * for the first line of a document), ahead of requests with a lower
+   * priority. Resolves with, per line, its value count followed by its tokens
+   * as tokenizeLine lays them out; the rule stack each line ended with is then
+   * available once from takeRuleStacks(requestId). Rejects once
+   * cancelRequest(requestId) has stopped it.
+   */
+  readonly tokenizeLinesAsync: (
+    requestId: number,
+    grammar: CodegenTypes.UnsafeObject,
+    lines: readonly string[],
+    ruleStack: CodegenTypes.UnsafeObject | null,
+    priority: number,
+  ) => Promise<number[]>
+  /**
+   * tokenizeLinesAsync on the JS thread: tokenizes for up to sliceBudgetMs at
+   * a time, then lets other JS work run before continuing. Cancelled with
+   * cancelRequest(requestId).
+   */
+  readonly tokenizeLinesSliced: (
+    requestId: number,
+    grammar: CodegenTypes.UnsafeObject,
+    lines: readonly string[],
+    ruleStack: CodegenTypes.UnsafeObject | null,
+    sliceBudgetMs: number,
+  ) => Promise<number[]>
+  /** The rule stacks of a finished tokenize request, one per line; empty after the first call. */
+  readonly takeRuleStacks: (requestId: number) => CodegenTypes.UnsafeObject[]
+  /**
+   * Tokenizes each text from the start of a document with the grammar at the
+   * same index, the texts spread across the engine's worker pool, which is
+   * capped at four threads. Resolves with, per text, its line count followed
+   * by each line as tokenizeLinesAsync lays it out.
+   */
+  readonly tokenizeSnippetsAsync: (
+    grammars: readonly CodegenTypes.UnsafeObject[],
+    texts: readonly string[],
+  ) => Promise<number[]>
 }
 
 export default TurboModuleRegistry.getEnforcing<Spec>('ShikiEngine')
@@ -1,62 +1,383 @@
 /* oxlint-disable no-undef */
 import type { PatternScanner, RegexEngine } from '@shikijs/types'
-import type { IOnigMatch, OnigString } from '@shikijs/vscode-textmate'
+import type { IOnigMatch, IRawGrammar, IToken, OnigString } from '@shikijs/vscode-textmate'
+import type { CacheStats, NativeScanner } from '../NativeShikiEngine'
 import { TurboModuleRegistry } from 'react-native'
 import ShikiEngine from '../NativeShikiEngine'
-import { convertToOnigMatch } from './utils'
+import {
+  unpackAllOnigMatches,
+  unpackOnigMatch,
+  unpackOnigMatches,
+  unpackTokenizedLines,
+  unpackTokenizedSnippets,
+  unpackTokens,
+} from './utils'
 
-export function createNativeEngine(options: { maxCacheSize?: number } = {}): RegexEngine {
-  const { maxCacheSize = 1000 } = options
+/**
+ * Escalating responses to OS memory pressure. Hibernated scanners keep working
+ * and recompile their patterns on next use.
+ */
+export const TrimMemoryLevel = {
+  /** Drop compiled patterns no scanner is using. */
+  Cache: 0,
+  /** Also hibernate scanners that have been idle for a while. */
+  IdleScanners: 1,
+  /** Hibernate every scanner that isn't searching right now. */
+  All: 2,
+} as const
+
+export type TrimMemoryLevel = typeof TrimMemoryLevel[keyof typeof TrimMemoryLevel]
+
+/**
+ * Scheduling classes for findNextMatchesAsync and tokenizeLinesAsync. Requests
+ * run most urgent first, and long requests step aside between lines when more
+ * urgent ones arrive.
+ */
+export const MatchPriority = {
+  /** Lines on screen. */
+  Visible: 0,
+  /** Lines likely to scroll into view next. */
+  NearViewport: 1,
+  /** Everything else, e.g. the rest of a long document. */
+  Background: 2,
+} as const
+
+export type MatchPriority = typeof MatchPriority[keyof typeof MatchPriority]
+
+export interface NativeEngineOptions {
+  /**
+   * Maximum number of compiled patterns kept in the cache shared by every
+   * scanner in the process. Engine-wide: the engine created last with this
+   * option sets it.
+   */
+  maxCacheSize?: number
+  /** Upper bound, in bytes, for compiled regex memory across all scanners. */
+  memoryBudget?: number
+  /**
+   * Compile each pattern the first time a search reaches it rather than when
+   * the scanner is created. Invalid patterns then never match instead of
+   * throwing from createScanner.
+   */
+  lazyCompilation?: boolean
+  /**
+   * Writable file where the engine remembers which pattern sets this app
+   * compiles. On later launches those sets are compiled in the background,
+   * most used first, before Shiki asks for them.
+   */
+  usageProfilePath?: string
+  /**
+   * Pattern bundle generated by `scripts/build-pattern-bundle.sh`. Scanners for
+   * the grammars it covers skip pattern analysis at startup.
+   */
+  patternBundlePath?: string
+  /**
+   * Return matches as native objects that build their captureIndices array
+   * only when it is read, instead of copying every capture out of the shared
+   * match buffer. Pays off for grammars whose patterns have many capture
+   * groups. Off by default.
+   */
+  lazyMatchResults?: boolean
+}
+
+export interface NativeRegexEngine extends RegexEngine {
+  /**
+   * Compiles the scanner's patterns on a background thread and resolves once
+   * they are ready, keeping large grammars from blocking the JS thread.
+   */
+  createScannerAsync: (patterns: (string | RegExp)[]) => Promise<PatternScanner>
+  /** Creates a scanner from IDs returned by registerPatterns. */
+  createScannerFromIds: (ids: readonly number[]) => PatternScanner
+  /**
+   * Bulk regex probe: runs one search per line on a background thread and
+   * resolves with its first match. It does not tokenize; to highlight lines
+   * off the JS thread use NativeGrammar.tokenizeLinesAsync. scanner must come
+   * from this engine.
+   */
+  findNextMatchesAsync: (
+    scanner: PatternScanner,
+    lines: (string | OnigString)[],
+    options?: MatchRequestOptions,
+  ) => MatchRequest
+  /**
+   * Like findNextMatchesAsync, but searches on the JS thread in slices of a few
+   * milliseconds so rendering never waits long. For environments where
+   * background threads aren't available. Also a regex probe; the tokenizing
+   * counterpart is NativeGrammar.tokenizeLinesSliced.
+   */
+  findNextMatchesSliced: (
+    scanner: PatternScanner,
+    lines: (string | OnigString)[],
+    options?: SlicedMatchRequestOptions,
+  ) => SlicedMatchRequest
+  /**
+   * Finds every match in many independent snippets at once, spread across the
+   * engine's worker pool of at most four threads. Resolves with each
+   * snippet's matches, in order. A regex probe; to highlight many snippets at
+   * once use tokenizeSnippetsAsync.
+   */
+  findAllMatchesAsync: (snippets: readonly MatchSnippet[]) => Promise<IOnigMatch[][]>
+}
+
+export interface MatchSnippet {
+  /** A scanner from this engine. */
+  readonly scanner: PatternScanner
+  readonly text: string | OnigString
+}
+
+export interface MatchRequestOptions {
+  /** Where to start searching each line; 0 for every line if omitted. */
+  startPositions?: number[]
+  /** Defaults to MatchPriority.Visible. */
+  priority?: MatchPriority
+}
+
+export interface SlicedMatchRequestOptions {
+  /** Where to start searching each line; 0 for every line if omitted. */
+  startPositions?: number[]
+  /** Longest stretch to search before yielding the JS thread. Defaults to 4. */
+  sliceBudgetMs?: number
+}
+
+export interface SlicedMatchRequest {
+  /** One match or null per line, in order. Rejects if the request is cancelled. */
+  readonly matches: Promise<(IOnigMatch | null)[]>
+  /** Stops the request; lines not yet searched are skipped. */
+  cancel: () => void
+}
+
+export interface MatchRequest extends SlicedMatchRequest {
+  /** Moves the request to another class, e.g. as its lines scroll into view. */
+  setPriority: (priority: MatchPriority) => void
+}
+
+function toPatternSources(patterns: (string | RegExp)[]): string[] {
+  if (!Array.isArray(patterns) || patterns.some(p => typeof p !== 'string' && !(p instanceof RegExp))) {
+    throw new TypeError('Patterns must be an array of strings or RegExp objects')
+  }
+
+  return patterns.map(p => typeof p === 'string' ? p : p.source)
+}
+
+const PACKED_NO_MATCH = -1
+const PACKED_DOES_NOT_FIT = -2
+
+// View over the native match buffer; null once the platform turns out not to
+// provide one, undefined until asked.
+let matchBuffer: Int32Array | null | undefined
+
+function getMatchBuffer(): Int32Array | null {
+  if (matchBuffer === undefined) {
+    const buffer = ShikiEngine.getMatchBuffer()
+    matchBuffer = buffer instanceof ArrayBuffer ? new Int32Array(buffer) : null
+  }
+  return matchBuffer
+}
+
+function findNextMatch(
+  scanner: NativeScanner,
+  content: string,
+  startPosition: number,
+  lazy: boolean,
+): IOnigMatch | null {
+  const values = lazy ? null : getMatchBuffer()
+  if (values) {
+    const captureCount = scanner.findNextMatchPacked(content, startPosition)
+    if (captureCount === PACKED_NO_MATCH)
+      return null
+    if (captureCount !== PACKED_DOES_NOT_FIT)
+      return unpackOnigMatch(values, captureCount)
+  }
+
+  // The C++ module returns a native object that builds captureIndices on
+  // first access. Lazy results hand it out as is; otherwise copy it, so every
+  // match callers see is a plain object, packed or not.
+  const match = scanner.findNextMatchSync(content, startPosition)
+  if (!match || lazy)
+    return match
+  return { index: match.index, captureIndices: match.captureIndices }
+}
+
+// Scanners the platform only knows by ID, seen through the NativeScanner shape.
+function scannerFromId(scannerId: number): NativeScanner {
+  if (typeof scannerId !== 'number') {
+    throw new TypeError('Failed to create native scanner')
+  }
+
+  return {
+    findNextMatchSync: (text, startPosition) =>
+      ShikiEngine.findNextMatchSync(scannerId, text, startPosition) as IOnigMatch | null,
+    findNextMatchPacked: (text, startPosition) => ShikiEngine.findNextMatchPacked(scannerId, text, startPosition),
+    dispose: () => ShikiEngine.destroyScanner(scannerId),
+  }
+}
+
+// What findNextMatchesAsync passes natively for each scanner: the scanner
+// object itself, or {id} for a scanner ID.
+const nativeScanners = new WeakMap<PatternScanner, object>()
+let nextRequestId = 1
+
+function getNativeScanner(scanner: PatternScanner): object {
+  const nativeScanner = nativeScanners.get(scanner)
+  if (!nativeScanner)
+    throw new TypeError('Scanner was not created by the native engine')
+  return nativeScanner
+}
+
+function toLineContents(lines: (string | OnigString)[]): string[] {
+  return lines.map(line => typeof line === 'string' ? line : line.content)
+}
+
+function wrapScannerId(scannerId: number, lazyMatchResults: boolean): PatternScanner {
+  return wrapScanner(scannerFromId(scannerId), { id: scannerId }, lazyMatchResults)
+}
+
+function wrapScanner(scanner: NativeScanner, nativeScanner: object, lazyMatchResults: boolean): PatternScanner {
+  // Every property read on a native scanner object creates a new function, so
+  // read its methods once.
+  const methods: NativeScanner = {
+    findNextMatchSync: scanner.findNextMatchSync,
+    findNextMatchPacked: scanner.findNextMatchPacked,
+    dispose: scanner.dispose,
+  }
+
+  const wrapped: PatternScanner = {
+    findNextMatchSync(string: string | OnigString, startPosition: number): IOnigMatch | null {
+      if (startPosition < 0)
+        throw new RangeError('Start position must be >= 0')
+
+      const stringContent = typeof string === 'string' ? string : string.content
+      if (typeof stringContent !== 'string')
+        throw new TypeError('Invalid input string')
+
+      try {
+        return findNextMatch(methods, stringContent, startPosition, lazyMatchResults)
+      }
+      catch (err) {
+        if (__DEV__)
+          console.error('Error in findNextMatchSync:', err)
+        throw err
+      }
+    },
+
+    dispose(): void {
+      try {
+        methods.dispose()
+      }
+      catch (err) {
+        if (__DEV__)
+          console.error('Error disposing scanner:', err)
+      }
+    },
+  }
+
+  nativeScanners.set(wrapped, nativeScanner)
+  return wrapped
+}
+
+// What scanners still pass as their own cache size, which the native side
+// ignores now that the cap is process-wide (setCacheSize).
+const DEFAULT_MAX_CACHE_SIZE = 1000
+
+export function createNativeEngine(options: NativeEngineOptions = {}): NativeRegexEngine {
+  const {
+    maxCacheSize,
+    memoryBudget,
+    lazyCompilation = false,
+    usageProfilePath,
+    patternBundlePath,
+    lazyMatchResults = false,
+  } = options
 
   if (!isNativeEngineAvailable()) {
     throw new Error('Native engine not available')
   }
 
+  if (maxCacheSize !== undefined)
+    ShikiEngine.setCacheSize(maxCacheSize)
+
+  if (memoryBudget !== undefined)
+    ShikiEngine.setMemoryBudget(memoryBudget)
+
+  if (usageProfilePath !== undefined)
+    ShikiEngine.setUsageProfilePath(usageProfilePath)
+
+  if (patternBundlePath !== undefined && !ShikiEngine.loadPatternBundle(patternBundlePath) && __DEV__)
+    console.warn(`Could not load pattern bundle at ${patternBundlePath}; patterns will be analyzed at runtime`)
+
   return {
     createScanner(patterns: (string | RegExp)[]): PatternScanner {
-      if (!Array.isArray(patterns) || patterns.some(p => typeof p !== 'string' && !(p instanceof RegExp))) {
-        throw new TypeError('Patterns must be an array of strings or RegExp objects')
-      }
+      const sources = toPatternSources(patterns)
+      // Scanner objects free themselves if never disposed; IDs need dispose().
+      const scanner = ShikiEngine.createScannerObject(
+        sources,
+        DEFAULT_MAX_CACHE_SIZE,
+        lazyCompilation,
+      ) as NativeScanner | null
+      return scanner
+        ? wrapScanner(scanner, scanner, lazyMatchResults)
+        : wrapScannerId(ShikiEngine.createScanner(sources, DEFAULT_MAX_CACHE_SIZE, lazyCompilation), lazyMatchResults)
+    },
+
+    async createScannerAsync(patterns: (string | RegExp)[]): Promise<PatternScanner> {
+      const scannerId = await ShikiEngine.createScannerAsync(toPatternSources(patterns), DEFAULT_MAX_CACHE_SIZE)
+      return wrapScannerId(scannerId, lazyMatchResults)
+    },
 
-      const stringPatterns = patterns.map(p => typeof p === 'string' ? p : p.source)
+    createScannerFromIds(ids: readonly number[]): PatternScanner {
+      const scannerId = ShikiEngine.createScannerFromIds(ids, DEFAULT_MAX_CACHE_SIZE, lazyCompilation)
+      return wrapScannerId(scannerId, lazyMatchResults)
+    },
+
+    findNextMatchesAsync(
+      scanner: PatternScanner,
+      lines: (string | OnigString)[],
+      { startPositions, priority = MatchPriority.Visible }: MatchRequestOptions = {},
+    ): MatchRequest {
+      const requestId = nextRequestId++
+      const contents = toLineContents(lines)
+      const matches = ShikiEngine.findNextMatchesAsync(
+        requestId,
+        getNativeScanner(scanner),
+        contents,
+        startPositions ?? contents.map(() => 0),
+        priority,
+      ).then(unpackOnigMatches)
 
-      const scannerId = ShikiEngine.createScanner(stringPatterns, maxCacheSize)
-      if (typeof scannerId !== 'number') {
-        throw new TypeError('Failed to create native scanner')
+      return {
+        matches,
+        setPriority: next => ShikiEngine.setRequestPriority(requestId, next),
+        cancel: () => ShikiEngine.cancelRequest(requestId),
       }
+    },
+
+    findNextMatchesSliced(
+      scanner: PatternScanner,
+      lines: (string | OnigString)[],
+      { startPositions, sliceBudgetMs = 4 }: SlicedMatchRequestOptions = {},
+    ): SlicedMatchRequest {
+      const requestId = nextRequestId++
+      const contents = toLineContents(lines)
+      const matches = ShikiEngine.findNextMatchesSliced(
+        requestId,
+        getNativeScanner(scanner),
+        contents,
+        startPositions ?? contents.map(() => 0),
+        sliceBudgetMs,
+      ).then(unpackOnigMatches)
 
       return {
-        findNextMatchSync(string: string | OnigString, startPosition: number): IOnigMatch | null {
-          if (startPosition < 0)
-            throw new RangeError('Start position must be >= 0')
-
-          const stringContent = typeof string === 'string' ? string : string.content
-          if (typeof stringContent !== 'string')
-            throw new TypeError('Invalid input string')
-
-          try {
-            const result = ShikiEngine.findNextMatchSync(scannerId, stringContent, startPosition)
-            return convertToOnigMatch(result)
-          }
-          catch (err) {
-            if (__DEV__)
-              console.error('Error in findNextMatchSync:', err)
-            throw err
-          }
-        },
-
-        dispose(): void {
-          try {
-            ShikiEngine.destroyScanner(scannerId)
-          }
-          catch (err) {
-            if (__DEV__)
-              console.error('Error disposing scanner:', err)
-          }
-        },
+        matches,
+        cancel: () => ShikiEngine.cancelRequest(requestId),
       }
     },
 
+    findAllMatchesAsync(snippets: readonly MatchSnippet[]): Promise<IOnigMatch[][]> {
+      return ShikiEngine.findAllMatchesAsync(
+        snippets.map(snippet => getNativeScanner(snippet.scanner)),
+        toLineContents(snippets.map(snippet => snippet.text)),
+      ).then(unpackAllOnigMatches)
+    },
+
     createString(s: string): OnigString {
       if (typeof s !== 'string')
         throw new TypeError('Input must be a string')
@@ -65,6 +386,219 @@ export function createNativeEngine(options: { maxCacheSize?: number } = {}): Reg
   }
 }
 
+/**
+ * Interns patterns in the native registry and returns a stable ID for each.
+ * IDs stay valid for the life of the process, so grammars can register their
+ * patterns once and create scanners from IDs without resending the sources.
+ */
+export function registerPatterns(patterns: (string | RegExp)[]): number[] {
+  const sources = toPatternSources(patterns)
+  const endOffsets: number[] = []
+  let offset = 0
+  for (const source of sources) {
+    offset += source.length
+    endOffsets.push(offset)
+  }
+
+  return ShikiEngine.registerPatterns(sources.join(''), endOffsets)
+}
+
+export interface PreloadProgress {
+  /** Index of the set that just finished. */
+  readonly setIndex: number
+  readonly completed: number
+  readonly total: number
+  /** Wall time spent compiling the set, or -1 if it contains invalid patterns. */
+  readonly compileTimeMs: number
+}
+
+/**
+ * Compiles pattern sets into the shared cache on a low-priority background
+ * thread, so the first createScanner for them is only cache lookups. Resolves
+ * with each set's compile time in milliseconds, -1 for sets with invalid
+ * patterns. Progress is reported per set where the platform supports it.
+ */
+export function preloadPatterns(
+  patternSets: (string | RegExp)[][],
+  onProgress?: (progress: PreloadProgress) => void,
+): Promise<number[]> {
+  const sources = patternSets.map(toPatternSources)
+  let completed = 0
+
+  return ShikiEngine.preloadPatterns(sources, (setIndex, compileTimeMs) => {
+    completed++
+    onProgress?.({ setIndex, completed, total: sources.length, compileTimeMs })
+  })
+}
+
+/** Where a line left the tokenizer; pass it in to tokenize the next line. */
+export interface NativeRuleStack {
+  readonly __nativeRuleStack: never
+}
+
+export interface NativeTokenizeLineResult {
+  readonly tokens: IToken[]
+  readonly ruleStack: NativeRuleStack
+}
+
+export interface TokenizeRequestOptions {
+  /** Defaults to MatchPriority.Visible. */
+  priority?: MatchPriority
+}
+
+export interface SlicedTokenizeRequestOptions {
+  /** Longest stretch to tokenize before yielding the JS thread. Defaults to 4. */
+  sliceBudgetMs?: number
+}
+
+export interface SlicedTokenizeRequest {
+  /** Each line's tokens and rule stack, in order. Rejects if the request is cancelled. */
+  readonly lines: Promise<NativeTokenizeLineResult[]>
+  /** Stops the request; lines not yet tokenized are skipped. */
+  cancel: () => void
+}
+
+export interface TokenizeRequest extends SlicedTokenizeRequest {
+  /** Moves the request to another class, e.g. as its lines scroll into view. */
+  setPriority: (priority: MatchPriority) => void
+}
+
+export interface NativeGrammar {
+  /**
+   * Tokenizes one line, continuing from the rule stack the previous line
+   * ended with, or null for the first line of a document.
+   */
+  tokenizeLine: (line: string, ruleStack: NativeRuleStack | null) => NativeTokenizeLineResult
+  /**
+   * Tokenizes consecutive lines on a background thread, continuing from
+   * ruleStack, scheduled by priority like findNextMatchesAsync.
+   */
+  tokenizeLinesAsync: (
+    lines: readonly string[],
+    ruleStack: NativeRuleStack | null,
+    options?: TokenizeRequestOptions,
+  ) => TokenizeRequest
+  /**
+   * Like tokenizeLinesAsync, but tokenizes on the JS thread in slices of a few
+   * milliseconds, for environments where background threads aren't available.
+   */
+  tokenizeLinesSliced: (
+    lines: readonly string[],
+    ruleStack: NativeRuleStack | null,
+    options?: SlicedTokenizeRequestOptions,
+  ) => SlicedTokenizeRequest
+}
+
+// What loadGrammar returns natively.
+interface LoadedGrammar {
+  readonly grammar: object
+  readonly scopeNames: string[]
+}
+
+// The native grammar behind each NativeGrammar, for tokenizeSnippetsAsync.
+const loadedGrammars = new WeakMap<NativeGrammar, LoadedGrammar>()
+
+// Pairs each line's tokens from a finished tokenize request with its rule stack.
+function toTokenizeLineResults(
+  requestId: number,
+  values: number[],
+  scopeNames: readonly string[],
+): NativeTokenizeLineResult[] {
+  const ruleStacks = ShikiEngine.takeRuleStacks(requestId) as NativeRuleStack[]
+  return unpackTokenizedLines(values, scopeNames).map((tokens, i) => ({ tokens, ruleStack: ruleStacks[i] }))
+}
+
+/**
+ * Compiles a TextMate grammar for tokenizing in native code, without a JS
+ * round trip per match. Returns null where the platform has no native
+ * tokenizer. Includes of other grammars and injections are not followed;
+ * grammars that rely on them should keep using vscode-textmate.
+ */
+export function loadGrammar(grammar: IRawGrammar): NativeGrammar | null {
+  const loaded = ShikiEngine.loadGrammar(grammar) as LoadedGrammar | null
+  if (!loaded)
+    return null
+
+  const { grammar: handle, scopeNames } = loaded
+  const nativeGrammar: NativeGrammar = {
+    tokenizeLine(line: string, ruleStack: NativeRuleStack | null): NativeTokenizeLineResult {
+      const result = ShikiEngine.tokenizeLine(handle, line, ruleStack) as {
+        tokens: number[]
+        ruleStack: NativeRuleStack
+      }
+      return { tokens: unpackTokens(result.tokens, scopeNames), ruleStack: result.ruleStack }
+    },
+
+    tokenizeLinesAsync(
+      lines: readonly string[],
+      ruleStack: NativeRuleStack | null,
+      { priority = MatchPriority.Visible }: TokenizeRequestOptions = {},
+    ): TokenizeRequest {
+      const requestId = nextRequestId++
+      const results = ShikiEngine.tokenizeLinesAsync(requestId, handle, lines, ruleStack, priority)
+        .then(values => toTokenizeLineResults(requestId, values, scopeNames))
+
+      return {
+        lines: results,
+        setPriority: next => ShikiEngine.setRequestPriority(requestId, next),
+        cancel: () => ShikiEngine.cancelRequest(requestId),
+      }
+    },
+
+    tokenizeLinesSliced(
+      lines: readonly string[],
+      ruleStack: NativeRuleStack | null,
+      { sliceBudgetMs = 4 }: SlicedTokenizeRequestOptions = {},
+    ): SlicedTokenizeRequest {
+      const requestId = nextRequestId++
+      const results = ShikiEngine.tokenizeLinesSliced(requestId, handle, lines, ruleStack, sliceBudgetMs)
+        .then(values => toTokenizeLineResults(requestId, values, scopeNames))
+
+      return {
+        lines: results,
+        cancel: () => ShikiEngine.cancelRequest(requestId),
+      }
+    },
+  }
+  loadedGrammars.set(nativeGrammar, loaded)
+  return nativeGrammar
+}
+
+export interface TokenizeSnippet {
+  /** A grammar from loadGrammar. */
+  readonly grammar: NativeGrammar
+  readonly code: string
+}
+
+/**
+ * Tokenizes many independent snippets, e.g. the code blocks of a long
+ * document, each from its first line, spread across the engine's worker pool
+ * of at most four threads. Resolves with each snippet's tokens per line, in
+ * order. Lines are split at "\n" and "\r\n".
+ */
+export function tokenizeSnippetsAsync(snippets: readonly TokenizeSnippet[]): Promise<IToken[][][]> {
+  const loaded = snippets.map(({ grammar }) => {
+    const entry = loadedGrammars.get(grammar)
+    if (!entry)
+      throw new TypeError('Grammar was not created by loadGrammar')
+    return entry
+  })
+
+  return ShikiEngine.tokenizeSnippetsAsync(
+    loaded.map(entry => entry.grammar),
+    snippets.map(snippet => snippet.code),
+  ).then(values => unpackTokenizedSnippets(values, loaded.map(entry => entry.scopeNames)))
+}
+
+export function getCacheStats(): CacheStats {
+  return ShikiEngine.getCacheStats()
+}
+
+/** Releases native memory; returns the number of bytes freed. */
+export function trimMemory(level: TrimMemoryLevel = TrimMemoryLevel.Cache): number {
+  return ShikiEngine.trimMemory(level)
+}
+
 export function isNativeEngineAvailable(): boolean {
   try {
     return TurboModuleRegistry.getEnforcing('ShikiEngine') != null
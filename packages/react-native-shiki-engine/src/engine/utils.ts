@@ -1,24 +1,117 @@
-import type { IOnigMatch } from '@shikijs/vscode-textmate'
-
-interface OnigResult {
-  readonly index: number
-  readonly captureIndices: readonly {
-    readonly start: number
-    readonly end: number
-    readonly length: number
-  }[]
-}
-
-export function convertToOnigMatch(result: OnigResult | null): IOnigMatch | null {
-  if (!result)
-    return null
-
-  return {
-    index: result.index,
-    captureIndices: result.captureIndices.map(capture => ({
-      start: capture.start,
-      end: capture.end,
-      length: capture.length,
-    })),
+import type { IOnigMatch, IToken } from '@shikijs/vscode-textmate'
+
+/** Reads a match findNextMatchPacked wrote into the shared match buffer. */
+export function unpackOnigMatch(values: Int32Array, captureCount: number): IOnigMatch {
+  const captureIndices = Array.from({ length: captureCount }, (_, i) => {
+    const start = values[1 + i * 2]
+    const end = values[2 + i * 2]
+    return { start, end, length: end - start }
+  })
+
+  return { index: values[0], captureIndices }
+}
+
+// Reads one [captureCount, index, start0, end0, ...] match at values[offset];
+// returns it with the offset just past it.
+function readPackedMatch(values: readonly number[], offset: number): [IOnigMatch, number] {
+  const captureCount = values[offset]
+  const index = values[offset + 1]
+  const first = offset + 2
+  const captureIndices = Array.from({ length: captureCount }, (_, j) => {
+    const start = values[first + j * 2]
+    const end = values[first + j * 2 + 1]
+    return { start, end, length: end - start }
+  })
+  return [{ index, captureIndices }, first + captureCount * 2]
+}
+
+/** Reads the per-line matches findNextMatchesAsync resolves with. */
+export function unpackOnigMatches(values: readonly number[]): (IOnigMatch | null)[] {
+  const matches: (IOnigMatch | null)[] = []
+  let i = 0
+  while (i < values.length) {
+    if (values[i] < 0) {
+      matches.push(null)
+      i++
+      continue
+    }
+
+    const [match, next] = readPackedMatch(values, i)
+    matches.push(match)
+    i = next
+  }
+  return matches
+}
+
+/** Reads the per-text matches findAllMatchesAsync resolves with. */
+export function unpackAllOnigMatches(values: readonly number[]): IOnigMatch[][] {
+  const snippets: IOnigMatch[][] = []
+  let i = 0
+  while (i < values.length) {
+    const matchCount = values[i++]
+    const matches: IOnigMatch[] = []
+    for (let j = 0; j < matchCount; j++) {
+      const [match, next] = readPackedMatch(values, i)
+      matches.push(match)
+      i = next
+    }
+    snippets.push(matches)
+  }
+  return snippets
+}
+
+/** Reads the tokens tokenizeLine returns, naming their scopes. */
+export function unpackTokens(values: readonly number[], scopeNames: readonly string[]): IToken[] {
+  const tokens: IToken[] = []
+  let i = 0
+  while (i < values.length) {
+    const startIndex = values[i]
+    const endIndex = values[i + 1]
+    const scopeCount = values[i + 2]
+    const scopes = values.slice(i + 3, i + 3 + scopeCount).map(scope => scopeNames[scope])
+    tokens.push({ startIndex, endIndex, scopes })
+    i += 3 + scopeCount
+  }
+  return tokens
+}
+
+// Reads one [valueCount, ...tokens] line at values[offset]; returns its
+// tokens with the offset just past it.
+function readLineTokens(values: readonly number[], offset: number, scopeNames: readonly string[]): [IToken[], number] {
+  const valueCount = values[offset]
+  const end = offset + 1 + valueCount
+  return [unpackTokens(values.slice(offset + 1, end), scopeNames), end]
+}
+
+/** Reads the per-line tokens tokenizeLinesAsync resolves with. */
+export function unpackTokenizedLines(values: readonly number[], scopeNames: readonly string[]): IToken[][] {
+  const lines: IToken[][] = []
+  let i = 0
+  while (i < values.length) {
+    const [tokens, next] = readLineTokens(values, i, scopeNames)
+    lines.push(tokens)
+    i = next
+  }
+  return lines
+}
+
+/** Reads the per-snippet lines tokenizeSnippetsAsync resolves with. */
+export function unpackTokenizedSnippets(
+  values: readonly number[],
+  scopeNames: readonly (readonly string[])[],
+): IToken[][][] {
+  const snippets: IToken[][][] = []
+  let i = 0
+  while (i < values.length) {
+    const lineCount = values[i++]
+    const names = scopeNames[snippets.length]
+    const lines: IToken[][] = []
+    for (let j = 0; j < lineCount; j++) {
+      const [tokens, next] = readLineTokens(values, i, names)
+      lines.push(tokens)
+      i = next
+    }
+    snippets.push(lines)
   }
+  return snippets
 }
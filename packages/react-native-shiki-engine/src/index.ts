@@ -1,4 +1,62 @@
-import { createNativeEngine, isNativeEngineAvailable } from './engine'
+import type {
+  MatchRequest,
+  MatchRequestOptions,
+  MatchSnippet,
+  NativeEngineOptions,
+  NativeGrammar,
+  NativeRegexEngine,
+  NativeRuleStack,
+  NativeTokenizeLineResult,
+  PreloadProgress,
+  SlicedMatchRequest,
+  SlicedMatchRequestOptions,
+  SlicedTokenizeRequest,
+  SlicedTokenizeRequestOptions,
+  TokenizeRequest,
+  TokenizeRequestOptions,
+  TokenizeSnippet,
+} from './engine'
+import {
+  createNativeEngine,
+  getCacheStats,
+  isNativeEngineAvailable,
+  loadGrammar,
+  MatchPriority,
+  preloadPatterns,
+  registerPatterns,
+  tokenizeSnippetsAsync,
+  TrimMemoryLevel,
+  trimMemory,
+} from './engine'
 
-export { type Spec } from './NativeShikiEngine'
-export { createNativeEngine, isNativeEngineAvailable }
+export { type CacheStats, type ScannerStats, type Spec } from './NativeShikiEngine'
+export type {
+  MatchRequest,
+  MatchRequestOptions,
+  MatchSnippet,
+  NativeEngineOptions,
+  NativeGrammar,
+  NativeRegexEngine,
+  NativeRuleStack,
+  NativeTokenizeLineResult,
+  PreloadProgress,
+  SlicedMatchRequest,
+  SlicedMatchRequestOptions,
+  SlicedTokenizeRequest,
+  SlicedTokenizeRequestOptions,
+  TokenizeRequest,
+  TokenizeRequestOptions,
+  TokenizeSnippet,
+}
+export {
+  createNativeEngine,
+  getCacheStats,
+  isNativeEngineAvailable,
+  loadGrammar,
+  MatchPriority,
+  preloadPatterns,
+  registerPatterns,
+  tokenizeSnippetsAsync,
+  TrimMemoryLevel,
+  trimMemory,
+}
@@ -0,0 +1,110 @@
+#!/bin/bash
+
+# Builds the engine and Oniguruma for the host with optimizations and runs
+# every engine benchmark, or only the ones named. The create benchmark times
+# bundled Shiki grammars when `pnpm install` has run. The alloc benchmark runs a
+# second time in a build on the system malloc, and scaling again on fewer
+# cores. Compare figures only between runs on the same idle machine.
+#
+# Usage: scripts/bench-engine.sh [benchmark]...
+
+set -e
+
+SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PROJECT_DIR="$( cd "$SCRIPT_DIR/.." && pwd )"
+ENGINE_CPP_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/cpp"
+ONIGURUMA_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/third_party/oniguruma"
+BUILD_DIR="$PROJECT_DIR/build-engine-bench"
+ALLOC_HOOKS_HEADER="$ENGINE_CPP_DIR/onig_alloc_hooks.h"
+
+if [ ! -f "$ONIGURUMA_DIR/src/oniguruma.h" ]; then
+    echo "Error: Could not find oniguruma.h"
+    echo "Run: git submodule update --init --recursive"
+    exit 1
+fi
+
+# Oniguruma for the host, out of tree so the submodule stays clean, with the
+# allocation hooks the device builds use
+cmake -S "$ONIGURUMA_DIR" -B "$BUILD_DIR/oniguruma" \
+    -DCMAKE_BUILD_TYPE=Release \
+    -DCMAKE_C_FLAGS="-include $ALLOC_HOOKS_HEADER -DONIG_ALLOC_HOOKS_IMPLEMENTATION" \
+    -DBUILD_SHARED_LIBS=OFF \
+    -DENABLE_POSIX_API=OFF > /dev/null
+cmake --build "$BUILD_DIR/oniguruma" -j"$(nproc 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo 4)" > /dev/null
+
+mkdir -p "$BUILD_DIR/include"
+cat > "$BUILD_DIR/include/onig_build_config.h" << EOF
+#ifndef ONIG_BUILD_CONFIG_H
+#define ONIG_BUILD_CONFIG_H
+
+#define ONIG_BUILT_WITH_ALLOC_HOOKS 1
+
+#endif
+EOF
+
+# The engine as the device builds it, with arenas and size-class pools
+${CXX:-c++} -std=c++20 -O2 -DNDEBUG \
+    -I"$BUILD_DIR/include" -I"$ENGINE_CPP_DIR" -I"$ONIGURUMA_DIR/src" \
+    "$SCRIPT_DIR/engine-bench-tool.cpp" \
+    "$ENGINE_CPP_DIR"/onig_*.cpp \
+    "$BUILD_DIR/oniguruma/libonig.a" -lpthread \
+    -o "$BUILD_DIR/engine-bench-tool"
+
+# Without onig_build_config.h the engine never installs the hooks, so the
+# same library falls back to the system malloc; the alloc baseline
+${CXX:-c++} -std=c++20 -O2 -DNDEBUG \
+    -I"$ENGINE_CPP_DIR" -I"$ONIGURUMA_DIR/src" \
+    "$SCRIPT_DIR/engine-bench-tool.cpp" \
+    "$ENGINE_CPP_DIR"/onig_*.cpp \
+    "$BUILD_DIR/oniguruma/libonig.a" -lpthread \
+    -o "$BUILD_DIR/engine-bench-tool-malloc"
+
+# Patterns of some of the biggest bundled grammars for the create benchmark,
+# once pnpm install has fetched them; it falls back to synthetic lists
+BENCH_ARGS=()
+mkdir -p "$BUILD_DIR/grammars"
+if (cd "$PROJECT_DIR" && node --input-type=module -e '
+import fs from "node:fs"
+const keys = new Set(["match", "begin", "end", "while"])
+const [dir, ...names] = process.argv.slice(1)
+function walk(node, patterns) {
+  if (Array.isArray(node)) {
+    node.forEach(child => walk(child, patterns))
+  } else if (node && typeof node === "object") {
+    for (const [key, value] of Object.entries(node)) {
+      if (keys.has(key) && typeof value === "string")
+        patterns.push(value)
+      else
+        walk(value, patterns)
+    }
+  }
+}
+for (const name of names) {
+  const registrations = (await import(`@shikijs/langs/${name}`)).default
+  const patterns = []
+  walk(registrations.find(registration => registration.name === name), patterns)
+  fs.writeFileSync(`${dir}/${name}`, patterns.join("\0"))
+}
+' "$BUILD_DIR/grammars" cpp html markdown php typescript 2> /dev/null); then
+    BENCH_ARGS=(--grammars "$BUILD_DIR/grammars")
+fi
+
+STATUS=0
+"$BUILD_DIR/engine-bench-tool" "${BENCH_ARGS[@]}" "$@" || STATUS=$?
+if [ $STATUS -eq 0 ] && { [ $# -eq 0 ] || [[ " $* " == *" alloc "* ]]; }; then
+    "$BUILD_DIR/engine-bench-tool-malloc" alloc || STATUS=$?
+fi
+
+# The pool is sized once per process, so scaling over fewer cores reruns the
+# tool pinned to 1, 2, 4, ... of them where taskset exists (Linux)
+if [ $STATUS -eq 0 ] && command -v taskset > /dev/null && { [ $# -eq 0 ] || [[ " $* " == *" scaling "* ]]; }; then
+    CORES="$(nproc)"
+    COUNT=1
+    while [ $STATUS -eq 0 ] && [ "$COUNT" -lt "$CORES" ]; do
+        taskset -c "0-$((COUNT - 1))" "$BUILD_DIR/engine-bench-tool" scaling || STATUS=$?
+        COUNT=$((COUNT * 2))
+    done
+fi
+
+rm -rf "$BUILD_DIR"
+exit $STATUS
@@ -5,6 +5,7 @@ PROJECT_DIR="$( cd "$SCRIPT_DIR/.." && pwd )"
 ONIGURUMA_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/third_party/oniguruma"
 BUILD_DIR="$PROJECT_DIR/build-onig-android"
 ANDROID_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/android"
+ALLOC_HOOKS_HEADER="$PROJECT_DIR/packages/react-native-shiki-engine/cpp/onig_alloc_hooks.h"
 
 # Get Oniguruma version
 if [ -f "$ONIGURUMA_DIR/src/oniguruma.h" ]; then
@@ -28,6 +29,21 @@ if [ -z "$ANDROID_NDK_HOME" ]; then
     exit 1
 fi
 
+# Route Oniguruma's allocations through the engine's tracking hooks
+ALLOC_HOOKS_CFLAGS="-include $ALLOC_HOOKS_HEADER -DONIG_ALLOC_HOOKS_IMPLEMENTATION"
+
+# Tell the engine the bundled library was built with allocation hooks
+write_build_config() {
+    cat > "$1/onig_build_config.h" << EOF
+#ifndef ONIG_BUILD_CONFIG_H
+#define ONIG_BUILD_CONFIG_H
+
+#define ONIG_BUILT_WITH_ALLOC_HOOKS 1
+
+#endif
+EOF
+}
+
 # Create the license bundle
 create_license_bundle() {
     echo "Creating license bundle..."
@@ -94,7 +110,7 @@ build_arch() {
     export STRIP="$toolchain/bin/llvm-strip"
 
     # Configure flags for Android
-    export CFLAGS="-fPIC -O2 -DANDROID -D__ANDROID_API__=$MIN_SDK -DONIGURUMA_VERSION=\"$ONIG_VERSION\""
+    export CFLAGS="-fPIC -O2 -DANDROID -D__ANDROID_API__=$MIN_SDK -DONIGURUMA_VERSION=\"$ONIG_VERSION\" $ALLOC_HOOKS_CFLAGS"
     export LDFLAGS="-fPIC"
 
     ./configure --host="$TARGET" \
@@ -110,6 +126,7 @@ build_arch() {
         make -j$(sysctl -n hw.ncpu 2>/dev/null || echo 4)
     fi
     make install || exit 1
+    write_build_config "$build_dir/include"
 
     # Copy the shared library to the jniLibs directory
     mkdir -p "$ANDROID_DIR/src/main/jniLibs/$arch"
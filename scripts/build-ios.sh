@@ -5,6 +5,7 @@ PROJECT_DIR="$( cd "$SCRIPT_DIR/.." && pwd )"
 ONIGURUMA_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/third_party/oniguruma"
 BUILD_DIR="$PROJECT_DIR/build-onig"
 IOS_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/apple"
+ALLOC_HOOKS_HEADER="$PROJECT_DIR/packages/react-native-shiki-engine/cpp/onig_alloc_hooks.h"
 
 # Get Oniguruma version
 if [ -f "$ONIGURUMA_DIR/src/oniguruma.h" ]; then
@@ -22,6 +23,21 @@ SIMULATOR_ARCHS="x86_64 arm64"  # arm64 for M1/M2 simulator
 DEVICE_ARCHS="arm64"
 MIN_IOS_VERSION="11.0"
 
+# Route Oniguruma's allocations through the engine's tracking hooks
+ALLOC_HOOKS_CFLAGS="-include $ALLOC_HOOKS_HEADER -DONIG_ALLOC_HOOKS_IMPLEMENTATION"
+
+# Tell the engine the bundled library was built with allocation hooks
+write_build_config() {
+    cat > "$1/onig_build_config.h" << EOF
+#ifndef ONIG_BUILD_CONFIG_H
+#define ONIG_BUILD_CONFIG_H
+
+#define ONIG_BUILT_WITH_ALLOC_HOOKS 1
+
+#endif
+EOF
+}
+
 # Create the license bundle
 create_license_bundle() {
     echo "Creating license bundle..."
@@ -71,10 +87,10 @@ build_arch() {
     export ZERO_TIMESTAMP=1
 
     if [ "$platform" == "simulator" ]; then
-        export CFLAGS="-arch $arch -isysroot $SDKROOT -mios-simulator-version-min=$MIN_IOS_VERSION -I$SDKROOT/usr/include -fembed-bitcode -DONIGURUMA_VERSION=\"$ONIG_VERSION\""
+        export CFLAGS="-arch $arch -isysroot $SDKROOT -mios-simulator-version-min=$MIN_IOS_VERSION -I$SDKROOT/usr/include -fembed-bitcode -DONIGURUMA_VERSION=\"$ONIG_VERSION\" $ALLOC_HOOKS_CFLAGS"
         export LDFLAGS="-arch $arch -isysroot $SDKROOT"
     else
-        export CFLAGS="-arch $arch -isysroot $SDKROOT -miphoneos-version-min=$MIN_IOS_VERSION -I$SDKROOT/usr/include -fembed-bitcode -DONIGURUMA_VERSION=\"$ONIG_VERSION\""
+        export CFLAGS="-arch $arch -isysroot $SDKROOT -miphoneos-version-min=$MIN_IOS_VERSION -I$SDKROOT/usr/include -fembed-bitcode -DONIGURUMA_VERSION=\"$ONIG_VERSION\" $ALLOC_HOOKS_CFLAGS"
         export LDFLAGS="-arch $arch -isysroot $SDKROOT"
     fi
 
@@ -87,6 +103,7 @@ build_arch() {
     make clean
     make -j$(sysctl -n hw.ncpu) || exit 1
     make install || exit 1
+    write_build_config "$build_dir/include"
 
     cd - > /dev/null
 }
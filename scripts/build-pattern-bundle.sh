@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Precomputes pattern analysis for TextMate grammars into a bundle the engine
+# memory-maps at startup (NativeEngineOptions.patternBundlePath).
+#
+# Usage: scripts/build-pattern-bundle.sh <output.bin> <grammar.json>...
+
+set -e
+
+SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PROJECT_DIR="$( cd "$SCRIPT_DIR/.." && pwd )"
+ENGINE_CPP_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/cpp"
+ONIGURUMA_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/third_party/oniguruma"
+BUILD_DIR="$PROJECT_DIR/build-pattern-bundle"
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 <output.bin> <grammar.json>..."
+    exit 1
+fi
+
+OUTPUT="$1"
+shift
+
+if [ ! -f "$ONIGURUMA_DIR/src/oniguruma.h" ]; then
+    echo "Error: Could not find oniguruma.h"
+    echo "Run: git submodule update --init --recursive"
+    exit 1
+fi
+
+# Build the generator from the engine's own analysis code, so bundles always
+# agree with what the device would compute.
+mkdir -p "$BUILD_DIR"
+${CXX:-c++} -std=c++20 -O2 \
+    -I"$ENGINE_CPP_DIR" -I"$ONIGURUMA_DIR/src" \
+    "$SCRIPT_DIR/pattern-bundle-tool.cpp" \
+    "$ENGINE_CPP_DIR/onig_pattern_analysis.cpp" \
+    "$ENGINE_CPP_DIR/onig_pattern_bundle.cpp" \
+    -o "$BUILD_DIR/pattern-bundle-tool"
+
+# Every regex a TextMate grammar can hand the scanner
+node -e '
+const fs = require("node:fs")
+const keys = new Set(["match", "begin", "end", "while"])
+const patterns = []
+function walk(node) {
+  if (Array.isArray(node)) {
+    node.forEach(walk)
+  } else if (node && typeof node === "object") {
+    for (const [key, value] of Object.entries(node)) {
+      if (keys.has(key) && typeof value === "string")
+        patterns.push(value)
+      else
+        walk(value)
+    }
+  }
+}
+for (const file of process.argv.slice(1))
+  walk(JSON.parse(fs.readFileSync(file, "utf8")))
+process.stdout.write(patterns.join("\0"))
+' "$@" | "$BUILD_DIR/pattern-bundle-tool" "$OUTPUT"
+
+rm -rf "$BUILD_DIR"
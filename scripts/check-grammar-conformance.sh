@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Checks the native TextMate tokenizer against vscode-textmate: tokenizes the
+# sample files with the bundled Shiki grammars on both and reports every line
+# whose tokens or scopes differ. Needs `pnpm install` for the reference side.
+#
+# Usage: scripts/check-grammar-conformance.sh [sample]...
+
+set -e
+
+SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PROJECT_DIR="$( cd "$SCRIPT_DIR/.." && pwd )"
+ENGINE_CPP_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/cpp"
+ONIGURUMA_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/third_party/oniguruma"
+BUILD_DIR="$PROJECT_DIR/build-grammar-conformance"
+
+if [ ! -f "$ONIGURUMA_DIR/src/oniguruma.h" ]; then
+    echo "Error: Could not find oniguruma.h"
+    echo "Run: git submodule update --init --recursive"
+    exit 1
+fi
+
+if [ $# -eq 0 ]; then
+    set -- "$SCRIPT_DIR"/conformance-samples/*
+fi
+
+# Oniguruma for the host, out of tree so the submodule stays clean
+cmake -S "$ONIGURUMA_DIR" -B "$BUILD_DIR/oniguruma" \
+    -DCMAKE_BUILD_TYPE=Release \
+    -DBUILD_SHARED_LIBS=OFF \
+    -DENABLE_POSIX_API=OFF > /dev/null
+cmake --build "$BUILD_DIR/oniguruma" -j"$(nproc 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo 4)" > /dev/null
+
+# The tokenizer from the engine's own sources, as the module runs it
+${CXX:-c++} -std=c++20 -O2 \
+    -I"$ENGINE_CPP_DIR" -I"$ONIGURUMA_DIR/src" \
+    "$SCRIPT_DIR/grammar-conformance-tool.cpp" \
+    "$ENGINE_CPP_DIR"/onig_*.cpp \
+    "$BUILD_DIR/oniguruma/libonig.a" -lpthread \
+    -o "$BUILD_DIR/grammar-conformance-tool"
+
+STATUS=0
+node "$SCRIPT_DIR/grammar-conformance.mjs" "$BUILD_DIR/grammar-conformance-tool" "$@" || STATUS=$?
+
+rm -rf "$BUILD_DIR"
+exit $STATUS
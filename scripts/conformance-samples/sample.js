@@ -0,0 +1,27 @@
+// Line comment with a URL: https://example.com
+/* Block comment
+   spanning lines */
+import { readFile } from 'node:fs/promises'
+
+const pattern = /^(\w+)\s*=\s*(?<value>.*)$/gm
+const greeting = `Hello, ${user.name ?? 'stranger'}! Total: ${items.reduce((a, b) => a + b, 0)}`
+
+export default class Parser extends Base {
+  #cache = new Map()
+
+  static create(options = {}) {
+    return new Parser({ ...options, strict: true })
+  }
+
+  async *entries(path) {
+    const text = await readFile(path, 'utf8')
+    for (const [, key, value] of text.matchAll(pattern)) {
+      if (key === 'ignore' || value?.length > 0x1F)
+        continue
+      yield { key, value: Number.parseFloat(value) || 1_000n }
+    }
+  }
+}
+
+const jsx = <Component prop="value" onPress={() => setCount(count => count + 1)}>text</Component>
+label: for (let i = 0; i < 10; i++) { if (i % 2) continue label }
@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+"""Module docstring
+spanning two lines."""
+
+from __future__ import annotations
+import re
+from dataclasses import dataclass, field
+
+
+@dataclass(frozen=True)
+class Token:
+    start: int
+    end: int
+    scopes: list[str] = field(default_factory=list)
+
+    def __repr__(self) -> str:
+        return f"Token({self.start}..{self.end}, {', '.join(self.scopes)!r})"
+
+
+async def tokenize(lines: list[str], *, limit: int | None = None) -> list[Token]:
+    pattern = re.compile(r"^(?P<indent>\s*)(\w+)\s*=\s*(.+)$")
+    result = []
+    for number, line in enumerate(lines[:limit], start=1):
+        if (match := pattern.match(line)) is not None and number % 2 == 0:
+            result.append(Token(match.start(2), match.end(3), [b"bytes".decode()]))
+        elif line.startswith('#'):
+            continue
+        else:
+            raise ValueError('unexpected line %d: %s' % (number, line))
+    return [token for token in result if token.end > 0x10 or token.start < 1e3]
+
+
+lambda x, y=2: x ** y  # trailing comment
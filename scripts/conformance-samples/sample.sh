@@ -0,0 +1,33 @@
+#!/bin/bash
+
+set -euo pipefail
+
+# Builds every architecture listed on the command line
+ARCHS="${*:-arm64 x86_64}"
+BUILD_DIR="$(pwd)/build"
+
+build_arch() {
+    local arch=$1
+    if [[ "$arch" == arm* && -n "${CROSS:-}" ]]; then
+        echo "Cross-compiling for $arch"
+    elif [ ! -d "$BUILD_DIR/$arch" ]; then
+        mkdir -p "$BUILD_DIR/$arch" || exit 1
+    fi
+    make -C "$BUILD_DIR/$arch" -j"$(nproc)" 2>&1 | tee "$BUILD_DIR/$arch.log"
+}
+
+for arch in $ARCHS; do
+    build_arch "$arch" &
+done
+wait
+
+cat <<EOT > "$BUILD_DIR/summary.txt"
+Built: $ARCHS
+Date: $(date +%F)
+EOT
+
+case "$(uname -s)" in
+    Darwin*) echo 'macOS' ;;
+    Linux*)  echo "Linux $((1 + 2))" ;;
+    *)       exit 1 ;;
+esac
@@ -0,0 +1,32 @@
+import type { Readable } from 'node:stream'
+
+/** A token with its UTF-16 range. */
+export interface Token<T extends string = string> {
+  readonly start: number
+  end?: number
+  scopes: T[]
+}
+
+type Handler = (event: { type: 'open' | 'close', id: number }) => Promise<void>
+
+enum Priority { Visible = 0, Background = 1 }
+
+export abstract class Tokenizer<S> implements Iterable<Token> {
+  private readonly lines: string[] = []
+  protected constructor(public state: S | null = null) {}
+
+  abstract tokenize(line: string): Token[]
+
+  *[Symbol.iterator](): Iterator<Token> {
+    for (const line of this.lines)
+      yield* this.tokenize(line)
+  }
+}
+
+function isToken(value: unknown): value is Token {
+  return typeof value === 'object' && value !== null && 'scopes' in value
+}
+
+const map = new Map<string, Array<Record<string, number>>>()
+let result = (input as Readable) satisfies Readable
+declare module 'shiki' { export const version: string }
@@ -0,0 +1,597 @@
+// Host-side benchmarks for the engine; see scripts/bench-engine.sh. Each one
+// drives the engine's own sources the way the module does and prints its
+// figures. Numbers are only worth comparing between runs on the same idle
+// machine, with an optimized build.
+//
+// Usage: engine-bench-tool [--grammars <dir>] [benchmark]...
+//
+// --grammars names a directory of NUL-separated pattern lists, one file per
+// grammar, for the create benchmark; bench-engine.sh extracts them from the
+// bundled Shiki grammars.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sched.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+#include "onig_memory.hpp"
+#include "onig_pattern_cache.hpp"
+#include "onig_regex.h"
+#include "onig_thread_pool.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Heap allocations made on each thread, counted by interposing the C
+// allocator, which operator new also goes through. Only glibc lets a program
+// do that simply; elsewhere the allocs benchmark reports no counts.
+#ifdef __GLIBC__
+static thread_local size_t t_allocations = 0;
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size) {
+  t_allocations++;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  t_allocations++;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  t_allocations++;
+  return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+// Set by --grammars.
+static std::string g_grammar_dir;
+
+static double elapsed_ms(Clock::time_point started) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - started).count();
+}
+
+// Distinct patterns shaped like a grammar's match rules.
+static std::vector<std::string> make_patterns(size_t count) {
+  std::vector<std::string> patterns;
+  for (size_t i = 0; i < count; i++) {
+    patterns.push_back("\\b(?:kw" + std::to_string(i) + "|id" + std::to_string(i) + ")\\b\\s*(=|\\()\\s*(\\w+)?");
+  }
+  return patterns;
+}
+
+// Lines of code-like text for the searches.
+static const std::vector<std::string> LINES = {
+  "let total = compute(1, 2.5) // sum",
+  "const label = \"say \\\"hi\\\"\"; var x = [3]",
+  "    Call(arg) { return kw12 = id7(42) }",
+  "héllo wöörld éé id3 = value",
+  "no tokens here at all",
+};
+
+// Patterns of a typical rule scanner for LINES.
+static const std::vector<std::string> RULE_PATTERNS = {
+  "\\b(let|const|var)\\s+(\\w+)",
+  "\"(?:[^\"\\\\]|\\\\.)*\"",
+  "//.*$",
+  "\\b\\d+(?:\\.\\d+)?\\b",
+  "(?<name>[A-Z]\\w*)\\(",
+  "\\G\\s+",
+  "[{}()\\[\\];,]",
+  "(é+|ö+)",
+};
+
+static std::vector<const char*> c_strings(const std::vector<std::string>& strings) {
+  std::vector<const char*> pointers;
+  for (const auto& string : strings) {
+    pointers.push_back(string.c_str());
+  }
+  return pointers;
+}
+
+// Pattern cache lookups with thousands of entries resident, then misses that
+// each evict the least recently used entry.
+static void bench_cache() {
+  constexpr size_t ENTRIES = 4096;
+  constexpr int HIT_ROUNDS = 100;
+  const std::vector<std::string> patterns = make_patterns(ENTRIES);
+  std::vector<const char*> sources = c_strings(patterns);
+
+  set_cache_max_entries(ENTRIES);
+  double fill_ms = 0;
+  preload_patterns(sources.data(), static_cast<int>(sources.size()), &fill_ms);
+
+  std::vector<size_t> order(ENTRIES);
+  for (size_t i = 0; i < ENTRIES; i++) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), std::mt19937(42));
+
+  auto started = Clock::now();
+  for (int round = 0; round < HIT_ROUNDS; round++) {
+    for (const size_t i : order) {
+      pattern_cache_release(pattern_cache_acquire(patterns[i]));
+    }
+  }
+  const double hit_ms = elapsed_ms(started);
+
+  // A quarter of the patterns fit, so cycling through all of them misses and
+  // evicts on every acquire. Compiling dominates; the rest is bookkeeping.
+  set_cache_max_entries(ENTRIES / 4);
+  OnigCacheStats before;
+  get_cache_stats(&before);
+  started = Clock::now();
+  for (size_t i = 0; i < ENTRIES; i++) {
+    pattern_cache_release(pattern_cache_acquire(patterns[order[i]]));
+  }
+  const double miss_ms = elapsed_ms(started);
+  OnigCacheStats after;
+  get_cache_stats(&after);
+  const double compile_ms = after.compile_time_ms - before.compile_time_ms;
+
+  printf("%zu entries, filled in %.1f ms\n", ENTRIES, fill_ms);
+  printf("  hit (acquire + release) %10.1f ns/op\n", hit_ms * 1e6 / (HIT_ROUNDS * ENTRIES));
+  printf("  miss with eviction      %10.1f ns/op\n", miss_ms * 1e6 / ENTRIES);
+  printf("    of which compiling    %10.1f ns/op\n", compile_ms * 1e6 / ENTRIES);
+  printf("  evictions               %10llu\n", after.evictions - before.evictions);
+
+  set_cache_max_entries(MAX_CACHE_SIZE);
+  trim_memory(ONIG_TRIM_CACHE);
+}
+
+// Searches of scanner over LINES from every start position; returns how many.
+static size_t search_lines(OnigContext* scanner) {
+  size_t searches = 0;
+  for (const auto& line : LINES) {
+    for (size_t start = 0; start <= line.size(); start++) {
+      free_result(find_next_match(scanner, line.c_str(), static_cast<int>(start)));
+      searches++;
+    }
+  }
+  return searches;
+}
+
+// Every match in text, searching from the start and then from the end of each
+// match as vscode-textmate and findAllMatchesAsync do; returns how many.
+static size_t find_all_matches(OnigContext* scanner, const std::string& text) {
+  size_t matches = 0;
+  int position = 0;
+  while (position <= static_cast<int>(text.size())) {
+    OnigResult* result = find_next_match(scanner, text.c_str(), position);
+    if (!result) {
+      break;
+    }
+    matches++;
+    position = result->match_end > position ? result->match_end : position + 1;
+    free_result(result);
+  }
+  return matches;
+}
+
+// Oniguruma's compile and search allocations. bench-engine.sh runs this in a
+// build with allocation hooks (arenas and size-class pools) and in one
+// without (the system malloc); compare the two.
+static void bench_alloc() {
+  constexpr int COMPILE_ROUNDS = 20;
+  constexpr int SEARCH_ROUNDS = 200;
+  const std::vector<std::string> patterns = make_patterns(256);
+  std::vector<const char*> sources = c_strings(patterns);
+
+  // Scanner creation from a cold cache, then teardown of every compiled regex
+  auto started = Clock::now();
+  for (int round = 0; round < COMPILE_ROUNDS; round++) {
+    free_scanner(create_scanner(sources.data(), static_cast<int>(sources.size()), MAX_CACHE_SIZE));
+    trim_memory(ONIG_TRIM_CACHE);
+  }
+  // Known once the first scanner has initialized Oniguruma
+  printf("allocator: %s\n", memory_tracking_enabled() ? "arenas and size-class pools" : "system malloc");
+  printf("  compile + free    %8.1f us/pattern\n", elapsed_ms(started) * 1e3 / (COMPILE_ROUNDS * patterns.size()));
+
+  std::vector<const char*> rule_sources = c_strings(RULE_PATTERNS);
+  OnigContext* scanner = create_scanner(rule_sources.data(), static_cast<int>(rule_sources.size()), MAX_CACHE_SIZE);
+  const unsigned cores = std::max(2u, std::thread::hardware_concurrency());
+  for (const unsigned threads : {1u, cores}) {
+    started = Clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned index = 0; index < threads; index++) {
+      pool.emplace_back([scanner] {
+        for (int round = 0; round < SEARCH_ROUNDS; round++) {
+          search_lines(scanner);
+        }
+      });
+    }
+    for (auto& thread : pool) {
+      thread.join();
+    }
+    const double searches = static_cast<double>(search_lines(scanner)) * SEARCH_ROUNDS * threads;
+    printf("  search, %2u threads %8.1f ns/search\n", threads, elapsed_ms(started) * 1e6 / searches);
+  }
+  free_scanner(scanner);
+}
+
+// A named pattern list for the create benchmark.
+struct PatternSet {
+  std::string name;
+  std::vector<std::string> patterns;
+};
+
+// The lists in g_grammar_dir, or synthetic ones of grammar-like sizes.
+static std::vector<PatternSet> load_pattern_sets() {
+  std::vector<PatternSet> sets;
+  if (g_grammar_dir.empty()) {
+    for (const size_t count : {64, 256, 1024}) {
+      sets.push_back({"synthetic", make_patterns(count)});
+    }
+    return sets;
+  }
+
+  std::vector<std::filesystem::path> files;
+  for (const auto& entry : std::filesystem::directory_iterator(g_grammar_dir)) {
+    files.push_back(entry.path());
+  }
+  std::sort(files.begin(), files.end());
+  for (const auto& file : files) {
+    std::ifstream stream(file, std::ios::binary);
+    const std::string input(std::istreambuf_iterator<char>(stream), {});
+    PatternSet set{file.filename().string(), {}};
+    size_t start = 0;
+    while (start < input.size()) {
+      size_t end = input.find('\0', start);
+      if (end == std::string::npos) {
+        end = input.size();
+      }
+      set.patterns.emplace_back(input, start, end - start);
+      start = end + 1;
+    }
+    sets.push_back(std::move(set));
+  }
+  return sets;
+}
+
+// Wall time of creating a scanner over a whole grammar's patterns from a cold
+// cache: the module's create_scanner, which compiles on the thread pool, next
+// to compiling the same patterns one after another on the calling thread.
+static void bench_create() {
+  constexpr int REPEATS = 5;
+  printf("thread pool: %zu workers + the caller\n", thread_pool_size());
+  printf("%-14s %8s %10s %12s %8s %10s\n", "grammar", "patterns", "serial ms", "scanner ms", "speedup", "lazy ms");
+  for (auto& set : load_pattern_sets()) {
+    // End patterns with back-references only compile once resolved, and one
+    // invalid pattern fails the whole scanner; keep what compiles on its own.
+    std::vector<std::string> patterns;
+    for (const auto& pattern : set.patterns) {
+      const char* source = pattern.c_str();
+      double compile_ms = 0;
+      if (preload_patterns(&source, 1, &compile_ms) == 0) {
+        patterns.push_back(pattern);
+      }
+    }
+    trim_memory(ONIG_TRIM_CACHE);
+    std::vector<const char*> sources = c_strings(patterns);
+    const int count = static_cast<int>(sources.size());
+
+    // Best of REPEATS, each from a cold cache
+    double serial_ms = 1e300;
+    double scanner_ms = 1e300;
+    double lazy_ms = 1e300;
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+      auto started = Clock::now();
+      for (const auto& pattern : patterns) {
+        pattern_cache_release(pattern_cache_acquire(pattern));
+      }
+      serial_ms = std::min(serial_ms, elapsed_ms(started));
+      trim_memory(ONIG_TRIM_CACHE);
+
+      started = Clock::now();
+      OnigContext* scanner = create_scanner(sources.data(), count, MAX_CACHE_SIZE);
+      scanner_ms = std::min(scanner_ms, elapsed_ms(started));
+      free_scanner(scanner);
+      trim_memory(ONIG_TRIM_CACHE);
+
+      started = Clock::now();
+      scanner = create_scanner_with_flags(sources.data(), count, MAX_CACHE_SIZE, ONIG_SCANNER_LAZY);
+      lazy_ms = std::min(lazy_ms, elapsed_ms(started));
+      free_scanner(scanner);
+      trim_memory(ONIG_TRIM_CACHE);
+    }
+    printf(
+      "%-14s %8d %10.2f %12.2f %7.2fx %10.2f\n",
+      set.name.c_str(),
+      count,
+      serial_ms,
+      scanner_ms,
+      serial_ms / scanner_ms,
+      lazy_ms
+    );
+  }
+}
+
+// Hardware cache misses of the calling thread, through perf_event_open where
+// the kernel allows it. Elsewhere, or in VMs without a PMU, available() is
+// false and only time is measured.
+class CacheMissCounter {
+ public:
+  CacheMissCounter() {
+#ifdef __linux__
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif
+  }
+
+  CacheMissCounter(const CacheMissCounter&) = delete;
+  CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+  bool available() const {
+    return fd_ >= 0;
+  }
+
+  uint64_t read() const {
+    uint64_t misses = 0;
+#ifdef __linux__
+    if (fd_ >= 0 && ::read(fd_, &misses, sizeof(misses)) != sizeof(misses)) {
+      misses = 0;
+    }
+#endif
+    return misses;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+// Cache misses and time per search when one scanner stays hot, and when
+// searches go round-robin over many scanners so each finds its context,
+// compiled regexes and prefilter tables evicted by the others.
+static void bench_misses() {
+  constexpr size_t SCANNERS = 1024;
+  constexpr size_t PATTERNS_PER_SCANNER = 8;
+  constexpr int ROUNDS = 20;
+  const std::vector<std::string> patterns = make_patterns(SCANNERS * PATTERNS_PER_SCANNER);
+  std::vector<const char*> sources = c_strings(patterns);
+  set_cache_max_entries(patterns.size());
+  std::vector<OnigContext*> scanners;
+  for (size_t i = 0; i < SCANNERS; i++) {
+    scanners.push_back(create_scanner(&sources[i * PATTERNS_PER_SCANNER], PATTERNS_PER_SCANNER, MAX_CACHE_SIZE));
+  }
+
+  CacheMissCounter counter;
+  if (!counter.available()) {
+    printf("hardware cache-miss counter unavailable; timing only\n");
+  }
+  printf("%-22s %12s %14s\n", "", "ns/search", "misses/search");
+  for (const size_t working_set : {size_t{1}, SCANNERS}) {
+    const uint64_t misses_before = counter.read();
+    const auto started = Clock::now();
+    size_t searches = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+      for (size_t i = 0; i < SCANNERS; i++) {
+        OnigContext* scanner = scanners[i % working_set];
+        const std::string& line = LINES[i % LINES.size()];
+        free_result(find_next_match(scanner, line.c_str(), 0));
+        searches++;
+      }
+    }
+    const double elapsed = elapsed_ms(started);
+    const double misses = static_cast<double>(counter.read() - misses_before) / searches;
+    const std::string label = working_set == 1 ? "1 scanner" : std::to_string(working_set) + " scanners";
+    if (counter.available()) {
+      printf("%-22s %12.1f %14.2f\n", label.c_str(), elapsed * 1e6 / searches, misses);
+    } else {
+      printf("%-22s %12.1f %14s\n", label.c_str(), elapsed * 1e6 / searches, "-");
+    }
+  }
+
+  for (OnigContext* scanner : scanners) {
+    free_scanner(scanner);
+  }
+  set_cache_max_entries(MAX_CACHE_SIZE);
+  trim_memory(ONIG_TRIM_CACHE);
+}
+
+// End and nested-rule patterns of similar cost, as vscode-textmate puts in
+// the small scanners of begin/end rules.
+static const std::vector<std::string> SMALL_PATTERNS = {
+  "\\}", "\"", "(?=[;)])", "\\\\.", "\\]", "(,)\\s*", "(?=\\bid7\\b)", "(=)",
+};
+
+// Searches with scanners of the first 1 to 8 SMALL_PATTERNS. Up to
+// SMALL_SCANNER_MAX_PATTERNS they take the unrolled loop, above it the
+// general one, so the step in ns/pattern after 4 shows what the
+// specialization saves.
+static void bench_small() {
+  constexpr int ROUNDS = 300;
+  std::vector<const char*> sources = c_strings(SMALL_PATTERNS);
+  printf("%8s %8s %12s %14s\n", "patterns", "loop", "ns/search", "ns/pattern");
+  for (size_t count = 1; count <= SMALL_PATTERNS.size(); count++) {
+    OnigContext* scanner = create_scanner(sources.data(), static_cast<int>(count), MAX_CACHE_SIZE);
+    search_lines(scanner);
+    const auto started = Clock::now();
+    size_t searches = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+      searches += search_lines(scanner);
+    }
+    const double ns = elapsed_ms(started) * 1e6 / searches;
+    const char* loop = count <= SMALL_SCANNER_MAX_PATTERNS ? "small" : "general";
+    printf("%8zu %8s %12.1f %14.1f\n", count, loop, ns, ns / count);
+    free_scanner(scanner);
+  }
+}
+
+// Heap allocations per line and per match while scanning lines the way
+// vscode-textmate does: search from the start, then from the end of each
+// match, until nothing matches. This is the native half of findNextMatchSync;
+// the JS objects built for each match need a JS runtime and are not counted.
+static void bench_allocs() {
+#ifndef __GLIBC__
+  printf("allocation counting needs glibc; skipped\n");
+#else
+  constexpr int ROUNDS = 100;
+  std::vector<const char*> sources = c_strings(RULE_PATTERNS);
+  for (const int flags : {ONIG_SCANNER_DEFAULT, ONIG_SCANNER_LAZY}) {
+    OnigContext* scanner = create_scanner_with_flags(
+      sources.data(),
+      static_cast<int>(sources.size()),
+      MAX_CACHE_SIZE,
+      flags
+    );
+    search_lines(scanner);
+
+    size_t lines = 0;
+    size_t matches = 0;
+    const size_t allocations_before = t_allocations;
+    for (int round = 0; round < ROUNDS; round++) {
+      for (const auto& line : LINES) {
+        matches += find_all_matches(scanner, line);
+        lines++;
+      }
+    }
+    const double allocations = static_cast<double>(t_allocations - allocations_before);
+    printf(
+      "%-6s scanner: %6.2f allocations/line, %5.2f allocations/match\n",
+      flags == ONIG_SCANNER_LAZY ? "lazy" : "eager",
+      allocations / lines,
+      matches ? allocations / matches : 0.0
+    );
+    free_scanner(scanner);
+  }
+#endif
+}
+
+// Cores this process may run on.
+static unsigned available_cores() {
+#ifdef __linux__
+  cpu_set_t cpus;
+  if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) {
+    return static_cast<unsigned>(CPU_COUNT(&cpus));
+  }
+#endif
+  return std::thread::hardware_concurrency();
+}
+
+// A batch of snippets of uneven length searched for every match, one after
+// another on the calling thread and then spread over the thread pool as
+// findAllMatchesAsync does. bench-engine.sh reruns it pinned to fewer cores,
+// since the pool is sized once per process.
+static void bench_scaling() {
+  constexpr size_t SNIPPETS = 48;
+  constexpr int ROUNDS = 20;
+  std::vector<std::string> snippets;
+  for (size_t i = 0; i < SNIPPETS; i++) {
+    std::string snippet;
+    for (size_t line = 0; line < 10 + (i * 37) % 150; line++) {
+      snippet += LINES[(i + line) % LINES.size()] + '\n';
+    }
+    snippets.push_back(std::move(snippet));
+  }
+  std::vector<const char*> sources = c_strings(RULE_PATTERNS);
+  OnigContext* scanner = create_scanner(sources.data(), static_cast<int>(sources.size()), MAX_CACHE_SIZE);
+
+  std::vector<size_t> expected(SNIPPETS);
+  auto started = Clock::now();
+  for (int round = 0; round < ROUNDS; round++) {
+    for (size_t i = 0; i < SNIPPETS; i++) {
+      expected[i] = find_all_matches(scanner, snippets[i]);
+    }
+  }
+  const double serial_ms = elapsed_ms(started) / ROUNDS;
+
+  std::vector<size_t> matches(SNIPPETS);
+  started = Clock::now();
+  for (int round = 0; round < ROUNDS; round++) {
+    thread_pool_parallel_for(SNIPPETS, [&](size_t i) { matches[i] = find_all_matches(scanner, snippets[i]); });
+  }
+  const double parallel_ms = elapsed_ms(started) / ROUNDS;
+  free_scanner(scanner);
+
+  printf(
+    "%u cores, %zu pool workers: %zu snippets in %.2f ms serial, %.2f ms on the pool, %.2fx%s\n",
+    available_cores(),
+    thread_pool_size(),
+    SNIPPETS,
+    serial_ms,
+    parallel_ms,
+    serial_ms / parallel_ms,
+    matches == expected ? "" : " (results differ!)"
+  );
+}
+
+struct Benchmark {
+  const char* name;
+  const char* description;
+  void (*run)();
+};
+
+static const Benchmark BENCHMARKS[] = {
+  {"cache", "pattern cache hits and evicting misses", bench_cache},
+  {"alloc", "Oniguruma memory through the engine's allocator", bench_alloc},
+  {"create", "createScanner wall time for whole grammars", bench_create},
+  {"misses", "cache misses per search, hot and over many scanners", bench_misses},
+  {"small", "searches with scanners of 1 to 8 patterns", bench_small},
+  {"allocs", "native heap allocations per line of matches", bench_allocs},
+  {"scaling", "batch snippet search over the thread pool", bench_scaling},
+};
+
+int main(int argc, char** argv) {
+  std::vector<const Benchmark*> selected;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--grammars") == 0 && i + 1 < argc) {
+      g_grammar_dir = argv[++i];
+      continue;
+    }
+    const auto found = std::find_if(std::begin(BENCHMARKS), std::end(BENCHMARKS), [&](const Benchmark& benchmark) {
+      return strcmp(benchmark.name, argv[i]) == 0;
+    });
+    if (found == std::end(BENCHMARKS)) {
+      fprintf(stderr, "usage: %s [--grammars <dir>] [benchmark]...\n", argv[0]);
+      for (const auto& benchmark : BENCHMARKS) {
+        fprintf(stderr, "  %-10s %s\n", benchmark.name, benchmark.description);
+      }
+      return 1;
+    }
+    selected.push_back(found);
+  }
+  if (selected.empty()) {
+    for (const auto& benchmark : BENCHMARKS) {
+      selected.push_back(&benchmark);
+    }
+  }
+
+  for (const Benchmark* benchmark : selected) {
+    printf("== %s: %s\n", benchmark->name, benchmark->description);
+    benchmark->run();
+  }
+  return 0;
+}
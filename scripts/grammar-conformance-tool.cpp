@@ -0,0 +1,148 @@
+// Host-side tokenizer for the grammar conformance check; see
+// scripts/check-grammar-conformance.sh. Reads a grammar and the lines of a
+// sample file from stdin as NUL-separated fields, in the order
+// grammar-conformance.mjs writes them, and prints each line's tokens as a JSON
+// array of [start, end, scopes...] with UTF-16 offsets, one line per line.
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "onig_grammar.hpp"
+
+// Splits stdin into fields and hands them out in order.
+class FieldReader {
+ public:
+  explicit FieldReader(std::string input) : input_(std::move(input)) {}
+
+  std::string next() {
+    if (position_ > input_.size()) {
+      throw std::runtime_error("unexpected end of input");
+    }
+    size_t end = input_.find('\0', position_);
+    if (end == std::string::npos) {
+      end = input_.size();
+    }
+    std::string field(input_, position_, end - position_);
+    position_ = end + 1;
+    return field;
+  }
+
+  size_t next_count() {
+    return std::stoul(next());
+  }
+
+ private:
+  std::string input_;
+  size_t position_ = 0;
+};
+
+static std::vector<GrammarCaptureSource> read_captures(FieldReader& reader) {
+  std::vector<GrammarCaptureSource> captures(reader.next_count());
+  for (auto& capture : captures) {
+    capture.index = std::stoi(reader.next());
+    capture.name = reader.next();
+  }
+  return captures;
+}
+
+static GrammarRuleSource read_rule(FieldReader& reader);
+
+static std::vector<GrammarRuleSource> read_rules(FieldReader& reader) {
+  std::vector<GrammarRuleSource> rules(reader.next_count());
+  for (auto& rule : rules) {
+    rule = read_rule(reader);
+  }
+  return rules;
+}
+
+static GrammarRuleSource read_rule(FieldReader& reader) {
+  GrammarRuleSource rule;
+  rule.key = reader.next();
+  rule.include = reader.next();
+  rule.name = reader.next();
+  rule.content_name = reader.next();
+  rule.match = reader.next();
+  rule.begin = reader.next();
+  rule.end = reader.next();
+  rule.while_ = reader.next();
+  rule.apply_end_pattern_last = reader.next() == "1";
+  rule.captures = read_captures(reader);
+  rule.begin_captures = read_captures(reader);
+  rule.end_captures = read_captures(reader);
+  rule.while_captures = read_captures(reader);
+  rule.patterns = read_rules(reader);
+  rule.repository = read_rules(reader);
+  return rule;
+}
+
+// UTF-16 offset of every byte offset in utf8, as the module converts them.
+static std::vector<int> utf16_offsets(const std::string& utf8) {
+  std::vector<int> offsets(utf8.size() + 1);
+  int u16 = 0;
+  size_t i = 0;
+  while (i < utf8.size()) {
+    const unsigned char c = static_cast<unsigned char>(utf8[i]);
+    const size_t len = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 1;
+    for (size_t k = 0; k < len && i + k < utf8.size(); k++) {
+      offsets[i + k] = u16;
+    }
+    u16 += len == 4 ? 2 : 1;
+    i += len;
+  }
+  offsets[utf8.size()] = u16;
+  return offsets;
+}
+
+static void print_json_string(const std::string& value) {
+  putchar('"');
+  for (const char c : value) {
+    if (c == '"' || c == '\\') {
+      putchar('\\');
+    }
+    putchar(c);
+  }
+  putchar('"');
+}
+
+int main() {
+  try {
+    FieldReader reader(std::string(std::istreambuf_iterator<char>(std::cin), {}));
+    GrammarSource source;
+    source.scope_name = reader.next();
+    source.patterns = read_rules(reader);
+    source.repository = read_rules(reader);
+    std::vector<std::string> lines(reader.next_count());
+    for (auto& line : lines) {
+      line = reader.next();
+    }
+
+    Grammar grammar(source);
+    GrammarState state;
+    std::vector<GrammarToken> tokens;
+    for (const auto& line : lines) {
+      state = grammar.tokenize_line(line, state, &tokens);
+      const std::vector<int> offsets = utf16_offsets(line + "\n");
+      putchar('[');
+      for (size_t i = 0; i < tokens.size(); i++) {
+        const int end = std::min<int>(tokens[i].end, static_cast<int>(offsets.size()) - 1);
+        printf("%s[%d,%d", i ? "," : "", offsets[tokens[i].start], offsets[end]);
+        for (const int scope : tokens[i].scopes) {
+          putchar(',');
+          print_json_string(grammar.scope_names()[scope]);
+        }
+        putchar(']');
+      }
+      printf("]\n");
+    }
+  } catch (const std::exception& error) {
+    fprintf(stderr, "error: %s\n", error.what());
+    return 1;
+  }
+  return 0;
+}
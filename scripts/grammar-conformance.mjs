@@ -0,0 +1,149 @@
+// Compares the native tokenizer with vscode-textmate; see
+// scripts/check-grammar-conformance.sh.
+//
+// Usage: node scripts/grammar-conformance.mjs <grammar-conformance-tool> <sample>...
+//
+// Each sample is tokenized with the grammar its extension names, loaded on its
+// own on both sides. Includes of other grammars are missing in both, and both
+// drop the rules those includes leave empty, such as markdown's fenced code
+// blocks for embedded languages.
+
+import { spawnSync } from 'node:child_process'
+import fs from 'node:fs'
+import path from 'node:path'
+import process from 'node:process'
+import { createOnigurumaEngine } from '@shikijs/engine-oniguruma'
+import { INITIAL, Registry } from '@shikijs/vscode-textmate'
+
+const languages = {
+  css: 'css',
+  js: 'javascript',
+  json: 'json',
+  md: 'markdown',
+  py: 'python',
+  sh: 'shellscript',
+  ts: 'typescript',
+}
+
+// Mismatching lines shown per sample
+const MAX_REPORTED_LINES = 5
+
+const [tool, ...samples] = process.argv.slice(2)
+if (!tool || samples.length === 0) {
+  console.error('Usage: node scripts/grammar-conformance.mjs <grammar-conformance-tool> <sample>...')
+  process.exit(1)
+}
+
+const engine = await createOnigurumaEngine(import('@shikijs/engine-oniguruma/wasm-inlined'))
+const onigLib = Promise.resolve({
+  createOnigScanner: patterns => engine.createScanner(patterns),
+  createOnigString: text => engine.createString(text),
+})
+
+async function loadLanguage(name) {
+  const registrations = (await import(`@shikijs/langs/${name}`)).default
+  return registrations.find(registration => registration.name === name)
+}
+
+// Writes a rule the way the module's readRule reads it from the grammar JSON.
+function writeRule(fields, rule, key = '') {
+  const string = value => typeof value === 'string' ? value : ''
+  const applyEndPatternLast = rule.applyEndPatternLast === true
+    || (typeof rule.applyEndPatternLast === 'number' && rule.applyEndPatternLast !== 0)
+  fields.push(
+    key,
+    string(rule.include),
+    string(rule.name),
+    string(rule.contentName),
+    string(rule.match),
+    string(rule.begin),
+    string(rule.end),
+    string(rule.while),
+    applyEndPatternLast ? '1' : '0',
+  )
+  for (const name of ['captures', 'beginCaptures', 'endCaptures', 'whileCaptures'])
+    writeCaptures(fields, rule[name])
+  writePatterns(fields, rule.patterns)
+  writeRepository(fields, rule.repository)
+}
+
+function writeCaptures(fields, captures) {
+  const entries = captures && typeof captures === 'object'
+    ? Object.entries(captures)
+        .filter(([index, capture]) => /^\d+$/.test(index) && capture && typeof capture === 'object')
+    : []
+  fields.push(String(entries.length))
+  for (const [index, capture] of entries)
+    fields.push(index, typeof capture.name === 'string' ? capture.name : '')
+}
+
+function writePatterns(fields, patterns) {
+  const rules = Array.isArray(patterns) ? patterns.filter(rule => rule && typeof rule === 'object') : []
+  fields.push(String(rules.length))
+  for (const rule of rules)
+    writeRule(fields, rule)
+}
+
+function writeRepository(fields, repository) {
+  const entries = repository && typeof repository === 'object'
+    ? Object.entries(repository).filter(([, rule]) => rule && typeof rule === 'object')
+    : []
+  fields.push(String(entries.length))
+  for (const [key, rule] of entries)
+    writeRule(fields, rule, key)
+}
+
+function tokenizeNative(grammar, lines) {
+  const fields = [grammar.scopeName]
+  writePatterns(fields, grammar.patterns)
+  writeRepository(fields, grammar.repository)
+  fields.push(String(lines.length), ...lines)
+
+  const result = spawnSync(tool, { input: fields.join('\0'), maxBuffer: 256 * 1024 * 1024 })
+  if (result.status !== 0)
+    throw new Error(`${tool} failed: ${result.stderr}`)
+  return result.stdout.toString().trimEnd().split('\n').map(line => JSON.parse(line))
+}
+
+async function tokenizeReference(grammar, lines) {
+  const registry = new Registry({
+    onigLib,
+    loadGrammar: async scopeName => scopeName === grammar.scopeName ? grammar : null,
+  })
+  const textmateGrammar = await registry.loadGrammar(grammar.scopeName)
+  let ruleStack = INITIAL
+  return lines.map((line) => {
+    const result = textmateGrammar.tokenizeLine(line, ruleStack)
+    ruleStack = result.ruleStack
+    return result.tokens.map(token => [token.startIndex, token.endIndex, ...token.scopes])
+  })
+}
+
+let mismatches = 0
+for (const sample of samples) {
+  const name = languages[path.extname(sample).slice(1)]
+  if (!name) {
+    console.error(`Skipping ${sample}: no grammar for its extension`)
+    continue
+  }
+
+  const grammar = await loadLanguage(name)
+  const lines = fs.readFileSync(sample, 'utf8').split(/\r?\n/)
+  const native = tokenizeNative(grammar, lines)
+  const reference = await tokenizeReference(grammar, lines)
+
+  const differing = []
+  for (let i = 0; i < lines.length; i++) {
+    if (JSON.stringify(native[i]) !== JSON.stringify(reference[i]))
+      differing.push(i)
+  }
+  mismatches += differing.length
+  console.log(`${path.basename(sample)} (${name}): ${lines.length - differing.length}/${lines.length} lines match`)
+  for (const i of differing.slice(0, MAX_REPORTED_LINES)) {
+    console.log(`  line ${i + 1}: ${JSON.stringify(lines[i])}`)
+    console.log(`    native:          ${JSON.stringify(native[i])}`)
+    console.log(`    vscode-textmate: ${JSON.stringify(reference[i])}`)
+  }
+}
+
+process.exit(mismatches === 0 ? 0 : 1)
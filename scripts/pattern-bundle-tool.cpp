@@ -0,0 +1,38 @@
+// Host-side generator for pattern bundles; see scripts/build-pattern-bundle.sh.
+// Reads NUL-separated pattern sources from stdin and writes the bundle to the
+// path given as the only argument.
+
+#include <cstdio>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "onig_pattern_bundle.hpp"
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <output.bin> < patterns\n", argv[0]);
+    return 1;
+  }
+
+  std::string input(std::istreambuf_iterator<char>(std::cin), {});
+  std::vector<std::string> sources;
+  size_t start = 0;
+  while (start < input.size()) {
+    size_t end = input.find('\0', start);
+    if (end == std::string::npos) {
+      end = input.size();
+    }
+    sources.emplace_back(input, start, end - start);
+    start = end + 1;
+  }
+
+  if (!pattern_bundle_write(argv[1], sources)) {
+    fprintf(stderr, "error: could not write %s\n", argv[1]);
+    return 1;
+  }
+
+  printf("Analyzed %zu patterns into %s\n", sources.size(), argv[1]);
+  return 0;
+}
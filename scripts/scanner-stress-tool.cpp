@@ -0,0 +1,335 @@
+// Host-side multi-threaded stress test for the engine; see
+// scripts/stress-scanners.sh. Searches shared scanners, churns the scanner
+// store and pattern registry, trims memory and tokenizes with one shared
+// grammar from several threads at once, and checks every result against a
+// single-threaded run. Built with ThreadSanitizer, so a data race fails the
+// run even when the results happen to agree. Then sweeps the thread count
+// from 1 up to threads, searching one shared scanner, and prints throughput
+// and speedup over a single thread; build with SANITIZER=none for numbers
+// worth comparing.
+//
+// Usage: scanner-stress-tool [threads] [iterations]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "onig_grammar.hpp"
+#include "onig_pattern_registry.hpp"
+#include "onig_regex.h"
+#include "onig_scanner_store.hpp"
+#include "onig_thread_pool.hpp"
+
+static const std::vector<std::string> PATTERNS = {
+  "\\b(let|const|var)\\s+(\\w+)",
+  "\"(?:[^\"\\\\]|\\\\.)*\"",
+  "//.*$",
+  "\\b\\d+(?:\\.\\d+)?\\b",
+  "(?<name>[A-Z]\\w*)\\(",
+  "\\G\\s+",
+  "[{}()\\[\\];,]",
+  "(é+|ö+)",
+};
+
+static const std::vector<std::string> TEXTS = {
+  "let total = compute(1, 2.5) // sum",
+  "const label = \"say \\\"hi\\\"\"; var x = [3]",
+  "    Call(arg) { return 42 }",
+  "héllo wöörld éé",
+  "no tokens here at all",
+  "",
+};
+
+// Kinds of traffic; threads take them round-robin.
+static constexpr unsigned ROLES = 5;
+
+// Grammar lines, tokenized as one document.
+static const std::vector<std::string> DOCUMENT = {
+  "let x = \"a\\\"b\" // comment",
+  "cat <<EOT",
+  "let y inside heredoc",
+  "EOT",
+  "> quoted let z",
+  "> more quote",
+  "after {block words}",
+  "héllo \"wörld\" let q",
+};
+
+// A search result as a string, so runs compare with ==.
+static std::string describe(OnigResult* result) {
+  if (!result) {
+    return "-";
+  }
+  std::string out = std::to_string(result->pattern_index);
+  for (int i = 0; i < result->capture_count * 2; i++) {
+    out += ',' + std::to_string(result->capture_indices[i]);
+  }
+  free_result(result);
+  return out;
+}
+
+// Every search of scanner over TEXTS, from every start position.
+static std::vector<std::string> search_all(OnigContext* scanner) {
+  std::vector<std::string> results;
+  for (const auto& text : TEXTS) {
+    for (size_t start = 0; start <= text.size(); start++) {
+      results.push_back(describe(find_next_match(scanner, text.c_str(), static_cast<int>(start))));
+    }
+  }
+  return results;
+}
+
+// Searches of scanner over TEXTS from every start position, without checking
+// the results; returns the number of searches.
+static size_t search_pass(OnigContext* scanner) {
+  size_t searches = 0;
+  for (const auto& text : TEXTS) {
+    for (size_t start = 0; start <= text.size(); start++) {
+      free_result(find_next_match(scanner, text.c_str(), static_cast<int>(start)));
+      searches++;
+    }
+  }
+  return searches;
+}
+
+// Times iterations search passes per thread over one shared scanner at 1, 2,
+// 4, ... max_threads threads.
+static void sweep_threads(OnigContext* scanner, int max_threads, int iterations) {
+  std::vector<int> counts;
+  for (int count = 1; count < max_threads; count *= 2) {
+    counts.push_back(count);
+  }
+  counts.push_back(max_threads);
+
+  printf("%8s %14s %8s\n", "threads", "searches/ms", "speedup");
+  double single = 0;
+  for (const int count : counts) {
+    std::atomic<size_t> searches{0};
+    const auto started = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (int index = 0; index < count; index++) {
+      pool.emplace_back([&] {
+        size_t local = 0;
+        for (int i = 0; i < iterations; i++) {
+          local += search_pass(scanner);
+        }
+        searches.fetch_add(local);
+      });
+    }
+    for (auto& thread : pool) {
+      thread.join();
+    }
+    const double elapsed_ms =
+      std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    const double throughput = searches.load() / elapsed_ms;
+    if (count == 1) {
+      single = throughput;
+    }
+    printf("%8d %14.1f %7.2fx\n", count, throughput, throughput / single);
+  }
+}
+
+static GrammarSource build_grammar() {
+  GrammarSource source;
+  source.scope_name = "source.stress";
+
+  GrammarRuleSource comment;
+  comment.match = "//.*$";
+  comment.name = "comment.line";
+  source.patterns.push_back(comment);
+  for (const char* include : {"#string", "#heredoc", "#quote", "#block"}) {
+    GrammarRuleSource rule;
+    rule.include = include;
+    source.patterns.push_back(rule);
+  }
+  GrammarRuleSource let;
+  let.match = "\\b(let)\\s+(\\w+)";
+  let.captures = {{1, "keyword.let"}, {2, "variable.name"}};
+  source.patterns.push_back(let);
+
+  GrammarRuleSource string;
+  string.key = "string";
+  string.begin = "\"";
+  string.end = "\"";
+  string.name = "string.quoted";
+  GrammarRuleSource escape;
+  escape.match = "\\\\.";
+  escape.name = "constant.character.escape";
+  string.patterns.push_back(escape);
+  source.repository.push_back(string);
+
+  // Back-referenced end pattern, resolved per begin match
+  GrammarRuleSource heredoc;
+  heredoc.key = "heredoc";
+  heredoc.begin = "<<(\\w+)";
+  heredoc.end = "^\\1$";
+  heredoc.name = "string.heredoc";
+  source.repository.push_back(heredoc);
+
+  GrammarRuleSource quote;
+  quote.key = "quote";
+  quote.begin = "^>\\s?";
+  quote.while_ = "^>\\s?";
+  quote.name = "markup.quote";
+  GrammarRuleSource self;
+  self.include = "$self";
+  quote.patterns.push_back(self);
+  source.repository.push_back(quote);
+
+  GrammarRuleSource block;
+  block.key = "block";
+  block.begin = "\\{";
+  block.end = "\\}";
+  block.name = "meta.block";
+  GrammarRuleSource word;
+  word.match = "\\G\\w+";
+  word.name = "entity.name";
+  block.patterns.push_back(word);
+  source.repository.push_back(block);
+  return source;
+}
+
+static std::vector<std::string> tokenize_document(Grammar& grammar) {
+  std::vector<std::string> results;
+  GrammarState state;
+  std::vector<GrammarToken> tokens;
+  for (const auto& line : DOCUMENT) {
+    state = grammar.tokenize_line(line, state, &tokens);
+    std::string out;
+    for (const auto& token : tokens) {
+      out += std::to_string(token.start) + '-' + std::to_string(token.end);
+      for (const int scope : token.scopes) {
+        out += ':' + grammar.scope_names()[scope];
+      }
+      out += ' ';
+    }
+    results.push_back(out);
+  }
+  return results;
+}
+
+int main(int argc, char** argv) {
+  const int threads = argc > 1 ? atoi(argv[1]) : std::max(ROLES, std::thread::hardware_concurrency());
+  const int iterations = argc > 2 ? atoi(argv[2]) : 50;
+  if (threads < 1 || iterations < 1) {
+    fprintf(stderr, "usage: %s [threads] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  // Small enough that evictions and recompiles happen during the run
+  set_cache_max_entries(PATTERNS.size() / 2);
+
+  std::vector<const char*> sources;
+  for (const auto& pattern : PATTERNS) {
+    sources.push_back(pattern.c_str());
+  }
+  OnigContext* eager = create_scanner(sources.data(), static_cast<int>(sources.size()), MAX_CACHE_SIZE);
+  OnigContext* lazy = create_scanner_with_flags(
+    sources.data(),
+    static_cast<int>(sources.size()),
+    MAX_CACHE_SIZE,
+    ONIG_SCANNER_LAZY
+  );
+  if (!eager || !lazy) {
+    fprintf(stderr, "error: could not create scanners: %s\n", scanner_last_error());
+    return 1;
+  }
+  const std::vector<std::string> expected = search_all(eager);
+
+  GrammarSource grammar_source = build_grammar();
+  Grammar grammar(grammar_source);
+  std::vector<std::string> expected_tokens;
+  {
+    Grammar reference(grammar_source);
+    expected_tokens = tokenize_document(reference);
+  }
+
+  std::atomic<int> failures{0};
+  auto check = [&failures](bool ok, const char* what) {
+    if (!ok && failures.fetch_add(1) < 10) {
+      fprintf(stderr, "mismatch: %s\n", what);
+    }
+  };
+
+  // Each thread takes one role, so every kind of traffic overlaps the others.
+  auto worker = [&](int index) {
+    for (int i = 0; i < iterations; i++) {
+      switch (index % ROLES) {
+        case 0:
+          check(search_all(eager) == expected, "shared eager scanner");
+          break;
+        case 1:
+          check(search_all(lazy) == expected, "shared lazy scanner");
+          break;
+        case 2: {
+          const int flags = i % 2 ? ONIG_SCANNER_LAZY : ONIG_SCANNER_DEFAULT;
+          OnigContext* scanner = i % 3
+            ? scanner_store_acquire(PATTERNS, MAX_CACHE_SIZE, flags)
+            : scanner_store_acquire_ids(
+                pattern_registry_intern_all({PATTERNS.begin(), PATTERNS.end()}),
+                MAX_CACHE_SIZE,
+                flags
+              );
+          if (!scanner) {
+            check(false, "scanner store acquire");
+            break;
+          }
+          // A second handle, as a background request holds one
+          check(scanner_store_retain(scanner), "scanner store retain");
+          check(search_all(scanner) == expected, "scanner store scanner");
+          check(scanner_store_release(scanner) && scanner_store_release(scanner), "scanner store release");
+          break;
+        }
+        case 3:
+          check(tokenize_document(grammar) == expected_tokens, "shared grammar");
+          break;
+        default: {
+          // Hibernates scanners between the other threads' searches
+          trim_memory(i % 2 ? ONIG_TRIM_ALL : ONIG_TRIM_CACHE);
+          OnigCacheStats stats;
+          get_cache_stats(&stats);
+          std::vector<std::string> parallel(TEXTS.size());
+          thread_pool_parallel_for(TEXTS.size(), [&](size_t text) {
+            OnigResult* result = find_next_match(eager, TEXTS[text].c_str(), 0);
+            parallel[text] = describe(result);
+          });
+          for (size_t text = 0; text < TEXTS.size(); text++) {
+            check(parallel[text] == describe(find_next_match(eager, TEXTS[text].c_str(), 0)), "thread pool search");
+          }
+          break;
+        }
+      }
+    }
+  };
+
+  const auto started = std::chrono::steady_clock::now();
+  std::vector<std::thread> pool;
+  for (int index = 0; index < threads; index++) {
+    pool.emplace_back(worker, index);
+  }
+  for (auto& thread : pool) {
+    thread.join();
+  }
+  const double elapsed_ms =
+    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+  if (failures.load() > 0) {
+    fprintf(stderr, "FAILED: %d mismatches\n", failures.load());
+    return 1;
+  }
+  printf("OK: %d threads x %d iterations in %.0f ms\n", threads, iterations, elapsed_ms);
+
+  // Without the stress run's tiny cache, so the sweep measures searching only
+  set_cache_max_entries(MAX_CACHE_SIZE);
+  sweep_threads(eager, threads, iterations);
+
+  free_scanner(eager);
+  free_scanner(lazy);
+  return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/bash
+
+# Builds the engine and Oniguruma for the host with ThreadSanitizer and runs
+# the multi-threaded stress test over shared scanners, the scanner store and a
+# shared grammar, followed by a thread-count sweep of search throughput. Set
+# SANITIZER=address to run it under ASan instead, or SANITIZER=none for an
+# optimized build whose sweep numbers reflect real scaling.
+#
+# Usage: scripts/stress-scanners.sh [threads] [iterations]
+
+set -e
+
+SCRIPT_DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+PROJECT_DIR="$( cd "$SCRIPT_DIR/.." && pwd )"
+ENGINE_CPP_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/cpp"
+ONIGURUMA_DIR="$PROJECT_DIR/packages/react-native-shiki-engine/third_party/oniguruma"
+BUILD_DIR="$PROJECT_DIR/build-scanner-stress"
+SANITIZER="${SANITIZER:-thread}"
+if [ "$SANITIZER" = "none" ]; then
+    BUILD_FLAGS="-O2"
+else
+    BUILD_FLAGS="-O1 -g -fsanitize=$SANITIZER"
+fi
+
+if [ ! -f "$ONIGURUMA_DIR/src/oniguruma.h" ]; then
+    echo "Error: Could not find oniguruma.h"
+    echo "Run: git submodule update --init --recursive"
+    exit 1
+fi
+
+# Oniguruma is instrumented too, so races inside a search are reported
+cmake -S "$ONIGURUMA_DIR" -B "$BUILD_DIR/oniguruma" \
+    -DCMAKE_BUILD_TYPE=RelWithDebInfo \
+    -DCMAKE_C_FLAGS="$BUILD_FLAGS" \
+    -DBUILD_SHARED_LIBS=OFF \
+    -DENABLE_POSIX_API=OFF > /dev/null
+cmake --build "$BUILD_DIR/oniguruma" -j"$(nproc 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo 4)" > /dev/null
+
+${CXX:-c++} -std=c++20 $BUILD_FLAGS \
+    -I"$ENGINE_CPP_DIR" -I"$ONIGURUMA_DIR/src" \
+    "$SCRIPT_DIR/scanner-stress-tool.cpp" \
+    "$ENGINE_CPP_DIR"/onig_*.cpp \
+    "$BUILD_DIR/oniguruma/libonig.a" -lpthread \
+    -o "$BUILD_DIR/scanner-stress-tool"
+
+STATUS=0
+TSAN_OPTIONS="halt_on_error=1 ${TSAN_OPTIONS:-}" "$BUILD_DIR/scanner-stress-tool" "$@" || STATUS=$?
+
+rm -rf "$BUILD_DIR"
+exit $STATUS